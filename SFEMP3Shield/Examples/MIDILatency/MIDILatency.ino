@@ -0,0 +1,177 @@
+/**
+ * \file MIDILatency.ino
+ *
+ * \brief Example sketch of the MP3Shield Arduino driver's real-time MIDI, measuring the latency of its Note Ons
+ * \remarks comments are implemented with Doxygen Markdown format
+ *
+ * This sketch enters the VSdsp's real-time MIDI mode with startMIDI() and
+ * plays a slow scale on the piano. Each pass of loop() queues the notes that
+ * are due, then stands in for the rest of a sketch's work by waiting
+ * work_us microseconds, and then sends the queue with flushMIDI().
+ *
+ * Once a second the statistics from getMIDIStats() are printed. Where
+ * lastLatency and maxLatency are the microseconds from the queuing of a Note
+ * On to the end of the burst sending it. Which is the work done between the
+ * two calls plus the time to send the burst to the VSdsp.
+ *
+ * Commands from a serial terminal (such as the Serial Monitor in the Arduino
+ * IDE):
+ * - '+' doubles the work per pass, up to 65536 microseconds.
+ * - '-' halves the work per pass, down to none.
+ * - 'c' plays a chord of 3 notes per beat, rather than 1.
+ *
+ * Sketch assumes you have rtmidi.053 in the root of the SdCard.
+ */
+
+#include <SPI.h>
+
+//Add the SdFat Libraries
+#include <SdFat.h>
+#include <FreeStack.h>
+
+//and the MP3 Shield Library
+#include <SFEMP3Shield.h>
+
+// Below is not needed if interrupt driven. Safe to remove if not using.
+#if defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_Timer1
+  #include <TimerOne.h>
+#elif defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_SimpleTimer
+  #include <SimpleTimer.h>
+#endif
+
+/**
+ * \brief Object instancing the SdFat library.
+ *
+ * principal object for handling all SdCard functions.
+ */
+SdFat sd;
+
+/**
+ * \brief Object instancing the SFEMP3Shield library.
+ *
+ * principal object for handling all the attributes, members and functions for the library.
+ */
+SFEMP3Shield MP3player;
+
+/**
+ * \brief The C major scale played, as MIDI note numbers.
+ */
+const uint8_t scale[] = {60, 62, 64, 65, 67, 69, 71, 72};
+
+uint32_t work_us = 1024; // microseconds of other work per pass of loop().
+uint8_t chord = 1; // notes queued per beat.
+uint8_t step = 0; // position in the scale.
+uint32_t beat_ms; // milliseconds of the last beat.
+uint32_t report_ms; // milliseconds of the last report.
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Setup the Arduino Chip's feature for our use.
+ *
+ * After Arduino's kernel has booted initialize basic features for this
+ * application, such as Serial port and MP3player objects with .begin.
+ * Then enter real-time MIDI mode.
+ *
+ * \note returned Error codes are typically passed up from MP3player.
+ * Whicn in turns creates and initializes the SdCard objects.
+ *
+ * \see
+ * \ref Error_Codes
+ */
+void setup() {
+
+  uint8_t result; //result code from some function as to be tested at later time.
+
+  Serial.begin(115200);
+
+  Serial.print(F("Free RAM = ")); // available in Version 1.0 F() bases the string to into Flash, to use less SRAM.
+  Serial.println(FreeStack(), DEC);  // FreeStack() is provided by SdFat
+
+  //Initialize the SdCard.
+  if(!sd.begin(SD_SEL, SPI_FULL_SPEED)) sd.initErrorHalt();
+  if(!sd.chdir("/")) sd.errorHalt("sd.chdir");
+
+  //Initialize the MP3 Player Shield
+  result = MP3player.begin();
+  //check result, see readme for error codes.
+  if((result != 0) && (result != 6)) {
+    Serial.print(F("Error code: "));
+    Serial.print(result);
+    Serial.println(F(" when trying to start MP3 player"));
+  }
+
+  result = MP3player.startMIDI();
+  if(result != 0) {
+    Serial.print(F("Error code: "));
+    Serial.print(result);
+    Serial.println(F(" when trying to start real-time MIDI"));
+    while(1);
+  }
+  MP3player.midiProgramChange(0, 0); // Acoustic Grand Piano
+  MP3player.flushMIDI();
+
+  Serial.println(F("'+' or '-' to change the work per pass, 'c' to toggle chords"));
+  beat_ms = millis();
+  report_ms = beat_ms;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Main Loop the Arduino Chip
+ *
+ * Queues the notes of each beat, waits as the rest of a sketch would work,
+ * then sends the queued messages. And prints the latency once a second.
+ */
+void loop() {
+
+  if(Serial.available()) {
+    switch(Serial.read()) {
+      case '+':
+        work_us = work_us ? min(work_us * 2, 65536UL) : 1;
+        break;
+      case '-':
+        work_us /= 2;
+        break;
+      case 'c':
+        chord = (chord == 1) ? 3 : 1;
+        break;
+    }
+  }
+
+  // a beat every 250 ms, each note sounding until the next.
+  if((millis() - beat_ms) >= 250) {
+    beat_ms += 250;
+    for(uint8_t i = 0; i < chord; i++) {
+      uint8_t note = scale[(step + 2 * i) % sizeof(scale)];
+      MP3player.midiNoteOff(0, scale[(step + sizeof(scale) - 1 + 2 * i) % sizeof(scale)]);
+      MP3player.midiNoteOn(0, note, 100);
+    }
+    step = (step + 1) % sizeof(scale);
+  }
+
+  // stand in for the rest of the sketch.
+  delayMicroseconds(work_us % 16384);
+  delay(work_us / 16384 * 16);
+
+  MP3player.flushMIDI();
+
+  if((millis() - report_ms) >= 1000) {
+    midi_stats_t stats;
+
+    report_ms += 1000;
+    MP3player.getMIDIStats(&stats);
+    Serial.print(F("work "));
+    Serial.print(work_us);
+    Serial.print(F(" us, Note On latency last "));
+    Serial.print(stats.lastLatency);
+    Serial.print(F(" us, max "));
+    Serial.print(stats.maxLatency);
+    Serial.print(F(" us, "));
+    Serial.print(stats.messages);
+    Serial.print(F(" messages in "));
+    Serial.print(stats.bursts);
+    Serial.print(F(" bursts, "));
+    Serial.print(stats.overflows);
+    Serial.println(F(" overflows"));
+  }
+}
@@ -12,6 +12,24 @@
 //avr pgmspace library for storing the LUT in program flash instead of sram
 #include <avr/pgmspace.h>
 
+/**
+ * \brief Statement compiled only when MP3_REFILL_STATS is set.
+ */
+#if MP3_REFILL_STATS
+#define REFILL_STAT(x) x
+#else
+#define REFILL_STAT(x)
+#endif
+
+/**
+ * \brief Statement compiled only when MP3_TRACE_RECORDS is set.
+ */
+#if MP3_TRACE_RECORDS
+#define MP3_TRACE(x) x
+#else
+#define MP3_TRACE(x)
+#endif
+
 /**
  * \brief bitrate lookup table
  *
@@ -40,6 +58,178 @@ static const uint16_t bitrate_table[15][6] PROGMEM = {
                  {448,384,320,256,160,160}  //1110
                };
 
+/**
+ * \brief Audio format from the extension of a filename
+ *
+ * \param[in] filename to be inspected, which is not modified.
+ *
+ * \return one of audio_format_m, format_unknown if not decodable by the VS10xx.
+ */
+static uint8_t formatFromFilename(const char* filename) {
+  const char* ext = strrchr(filename, '.');
+
+  if(ext == NULL) return format_unknown;
+  ext++;
+  if(!strcasecmp(ext, "mp3")) return format_mp3;
+  if(!strcasecmp(ext, "aac") || !strcasecmp(ext, "m4a")) return format_aac;
+  if(!strcasecmp(ext, "wma")) return format_wma;
+  if(!strcasecmp(ext, "wav")) return format_wav;
+  if(!strcasecmp(ext, "fla") || !strcasecmp(ext, "flac")) return format_flac;
+  if(!strcasecmp(ext, "mid") || !strcasecmp(ext, "midi")) return format_midi;
+  if(!strcasecmp(ext, "ogg")) return format_ogg;
+  return format_unknown;
+}
+
+#if MP3_SEEK_WAV || MP3_SEEK_FLAC || MP3_TRACK_INDEX
+/**
+ * \brief Value of a little endian field
+ *
+ * \param[in] p first byte of the field.
+ * \param[in] size of the field in bytes, up to 4.
+ *
+ * \return the value.
+ */
+static uint32_t getLittleEndian(const uint8_t* p, uint8_t size) {
+  uint32_t value = 0;
+  while(size--) {
+    value = (value << 8) | p[size];
+  }
+  return value;
+}
+#endif
+
+#if MP3_SEEK_FLAC || MP3_SEEK_MP4
+/**
+ * \brief Value of a big endian field
+ *
+ * \param[in] p first byte of the field.
+ * \param[in] size of the field in bytes, up to 4.
+ *
+ * \return the value.
+ */
+static uint32_t getBigEndian(const uint8_t* p, uint8_t size) {
+  uint32_t value = 0;
+  while(size--) {
+    value = (value << 8) | *p++;
+  }
+  return value;
+}
+#endif
+
+/**
+ * \brief Store a little endian value into a WAV header
+ *
+ * \param[out] p where to store the value.
+ * \param[in] value to be stored.
+ * \param[in] size of the value in bytes.
+ *
+ * \return the position following the value.
+ */
+static uint8_t* putLittleEndian(uint8_t* p, uint32_t value, uint8_t size) {
+  for(uint8_t i = 0; i < size; i++) {
+    *p++ = value;
+    value >>= 8;
+  }
+  return p;
+}
+
+/**
+ * \brief Samples, or bytes, of a duration
+ *
+ * \param[in] ms milliseconds.
+ * \param[in] rate samples, or bytes, per second.
+ *
+ * \return ms * rate / 1000, without overflowing in the product.
+ */
+static uint32_t msToSamples(uint32_t ms, uint32_t rate) {
+  return (ms / 1000) * rate + ((ms % 1000) * rate) / 1000;
+}
+
+#if MP3_SEEK_FLAC
+/**
+ * \brief Sample number of a FLAC frame header
+ *
+ * \param[in] p bytes following a candidate frame sync, of 0xFF 0xF8 or 0xF9.
+ * \param[in] len of \p p, at least 16 for the longest header.
+ * \param[in] block samples per frame if of fixed block size, else zero.
+ * \param[out] number the first sample of the frame.
+ * \param[out] samples of the frame.
+ *
+ * Checks the reserved codes and CRC-8 of the header, to tell real frames from
+ * the sync pattern within compressed data.
+ *
+ * \return true if a valid frame header.
+ */
+static bool flacFrameNumber(const uint8_t* p, uint8_t len, uint16_t block, uint32_t* number, uint32_t* samples) {
+  uint8_t bs;
+  uint8_t sr;
+  uint8_t i;
+  uint8_t more = 0;
+  uint32_t value;
+  uint8_t crc = 0;
+
+  if((len < 16) || (p[0] != 0xFF) || ((p[1] & 0xFE) != 0xF8)) return false;
+  bs = p[2] >> 4;
+  sr = p[2] & 0x0F;
+  value = p[4];
+  if(!bs || (sr == 15) || ((p[3] >> 4) > 10) || (((p[3] >> 1) & 7) == 3) || (p[3] & 1)) return false;
+
+  // the UTF-8 like coded frame or sample number.
+  while(value & (0x80 >> more)) more++;
+  if((more == 1) || (more > 7)) return false;
+  if(more) value &= 0x7F >> more;
+  for(i = 5; more > 1; more--, i++) {
+    if((p[i] & 0xC0) != 0x80) return false;
+    value = (value << 6) | (p[i] & 0x3F);
+  }
+  if(bs == 1) *samples = 192;
+  else if(bs <= 5) *samples = 576U << (bs - 2);
+  else if(bs == 6) *samples = p[i++] + 1;
+  else if(bs == 7) { *samples = (((uint16_t) p[i] << 8) | p[i + 1]) + 1; i += 2; }
+  else *samples = 256U << (bs - 8);
+  if(sr == 12) i += 1;
+  else if(sr >= 13) i += 2;
+
+  for(uint8_t j = 0; j < i; j++) {
+    crc ^= p[j];
+    for(uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  if(crc != p[i]) return false;
+
+  // fixed block sizes count frames, variable count samples.
+  *number = (p[1] & 1) ? value : value * block;
+  return true;
+}
+#endif
+
+/**
+ * \brief Audio format from the first bytes of a file
+ *
+ * \param[in] head the first FORMAT_SNIFF_SIZE bytes of the file, not modified.
+ *
+ * Recognizes the magic of an ID3v2 tag or MP3 frame sync, RIFF WAVE, OggS,
+ * fLaC, MThd, ASF, and the AAC's ADIF, ADTS sync or MP4 "ftyp" box.
+ *
+ * \return one of audio_format_m, format_unknown if not recognized.
+ */
+static uint8_t formatFromContent(const uint8_t* head) {
+
+  if(!memcmp(head, "ID3", 3)) return format_mp3;
+  if(!memcmp(head, "RIFF", 4) && !memcmp(&head[8], "WAVE", 4)) return format_wav;
+  if(!memcmp(head, "OggS", 4)) return format_ogg;
+  if(!memcmp(head, "fLaC", 4)) return format_flac;
+  if(!memcmp(head, "MThd", 4)) return format_midi;
+  if(!memcmp(head, "ADIF", 4) || !memcmp(&head[4], "ftyp", 4)) return format_aac;
+  if(!memcmp(head, "\x30\x26\xB2\x75", 4)) return format_wma; // ASF header GUID
+  if((head[0] == 0xFF) && ((head[1] & 0xE0) == 0xE0)) {
+    // a layer of 0 is ADTS, otherwise an MPEG audio frame.
+    return (head[1] & 0x06) ? format_mp3 : format_aac;
+  }
+  return format_unknown;
+}
+
 /*
  * Format of a MIDI file into a char arrar. Simply one note on and then off.
 */
@@ -90,6 +280,175 @@ PROGMEM const uint8_t SingleMIDInoteFile[] = {MIDI_HDR_CHUNK_ID, MIDI_CHUNKSIZE,
  */
 SdFile   SFEMP3Shield::track;
 
+#if USE_FAT_EXTENT_MAP
+/**
+ * \brief Initializer for the map of the track's cluster chain.
+ */
+FatExtent SFEMP3Shield::track_extent[MP3_EXTENT_MAP_SIZE];
+#endif
+
+#if USE_FAT_READ_AHEAD && MP3_READ_AHEAD_BLOCKS
+/**
+ * \brief Initializer for the window of blocks read ahead of the track.
+ */
+uint8_t SFEMP3Shield::track_window[512 * MP3_READ_AHEAD_BLOCKS];
+#endif
+
+#if USE_FAT_NAME_HASH && MP3_NAME_HASH_SIZE
+/**
+ * \brief Initializer for the hash table of the working directory's names.
+ */
+FatNameHash SFEMP3Shield::name_hash[MP3_NAME_HASH_SIZE];
+#endif
+
+#if MP3_TRACK_INDEX
+/**
+ * \brief Initializer for the instance of the on-card music library index.
+ */
+SdFile   SFEMP3Shield::index_file;
+uint16_t SFEMP3Shield::index_count;
+uint32_t SFEMP3Shield::index_dir;
+#endif
+
+#if MP3_TRACK_CACHE_SIZE
+/**
+ * \brief Initializer for the cache of the trackNNN.mp3 directory entries.
+ */
+track_cache_t SFEMP3Shield::track_cache[MP3_TRACK_CACHE_SIZE];
+uint32_t SFEMP3Shield::track_cache_dir = 0xFFFFFFFF;
+#endif
+
+#if MP3_RECORD_BLOCKS
+/**
+ * \brief Initializer for the blocks of recording buffered before writing.
+ */
+uint8_t SFEMP3Shield::record_buffer[512 * MP3_RECORD_BLOCKS];
+uint16_t SFEMP3Shield::record_fill;
+uint8_t SFEMP3Shield::record_head;
+uint8_t SFEMP3Shield::record_queued;
+uint32_t SFEMP3Shield::record_first;
+uint32_t SFEMP3Shield::record_sent;
+bool SFEMP3Shield::record_writing;
+#endif
+
+/**
+ * \brief Initializer for the progress of the recording.
+ */
+record_stats_t SFEMP3Shield::record_stats;
+uint32_t SFEMP3Shield::record_size;
+uint32_t SFEMP3Shield::record_limit;
+uint16_t SFEMP3Shield::record_rate;
+
+/**
+ * \brief Initializer for the sketch's buffer of samples to be streamed.
+ */
+uint8_t* SFEMP3Shield::stream_buffer;
+uint16_t SFEMP3Shield::stream_size;
+volatile uint16_t SFEMP3Shield::stream_head;
+volatile uint16_t SFEMP3Shield::stream_tail;
+stream_callback_t SFEMP3Shield::stream_callback;
+uint16_t SFEMP3Shield::stream_low;
+
+/**
+ * \brief Initializer for the queue of real-time MIDI messages.
+ */
+uint8_t SFEMP3Shield::midi_queue[MP3_MIDI_QUEUE_SIZE];
+volatile uint8_t SFEMP3Shield::midi_head;
+volatile uint8_t SFEMP3Shield::midi_tail;
+volatile uint32_t SFEMP3Shield::midi_stamp;
+midi_stats_t SFEMP3Shield::midi_stats;
+
+/**
+ * \brief Initializer for the sound effect preempting the track.
+ */
+#if MP3_EFFECT_FILE
+SdFile SFEMP3Shield::effect_file;
+#endif
+uint8_t SFEMP3Shield::effect_source;
+const uint8_t* SFEMP3Shield::effect_data;
+uint16_t SFEMP3Shield::effect_left;
+uint32_t SFEMP3Shield::effect_resume;
+state_m SFEMP3Shield::effect_state;
+uint8_t SFEMP3Shield::effect_header;
+bool SFEMP3Shield::effect_ended;
+
+#if MP3_SEEK_MP4
+/**
+ * \brief Initializer for the seek index of an MP4 track.
+ */
+seek_point_t SFEMP3Shield::seek_index[MP3_SEEK_INDEX_SIZE];
+#endif
+
+/**
+ * \brief Initializer for the jumps of refill() after re-priming a track.
+ */
+#if TRACK_JUMPS
+uint32_t SFEMP3Shield::jump_from[TRACK_JUMPS];
+uint32_t SFEMP3Shield::jump_to[TRACK_JUMPS];
+#endif
+uint8_t SFEMP3Shield::jump_count;
+uint8_t SFEMP3Shield::jump_next;
+
+/**
+ * \brief Initializer for the ramp of the volume's fade.
+ */
+SFEMP3Shield* SFEMP3Shield::fade_owner;
+uint8_t SFEMP3Shield::fade_level;
+uint8_t SFEMP3Shield::fade_from;
+uint8_t SFEMP3Shield::fade_to;
+uint8_t SFEMP3Shield::fade_action;
+uint16_t SFEMP3Shield::fade_time;
+uint32_t SFEMP3Shield::fade_start;
+uint16_t SFEMP3Shield::fade_in = MP3_FADE_MS;
+char SFEMP3Shield::fade_next[13];
+
+/**
+ * \brief Initializer for the millisecond position's interpolation.
+ */
+uint32_t SFEMP3Shield::pos_base;
+uint32_t SFEMP3Shield::pos_stamp;
+uint32_t SFEMP3Shield::pos_read;
+uint16_t SFEMP3Shield::pos_secs;
+uint8_t SFEMP3Shield::pos_mode;
+bool SFEMP3Shield::pos_valid;
+uint16_t SFEMP3Shield::play_speed = 1;
+
+/**
+ * \brief Initializer for the fast forward or rewind scan.
+ */
+SFEMP3Shield* SFEMP3Shield::scan_owner;
+int8_t SFEMP3Shield::scan_speed;
+uint16_t SFEMP3Shield::scan_play_speed;
+uint32_t SFEMP3Shield::scan_pos;
+uint32_t SFEMP3Shield::scan_stamp;
+
+/**
+ * \brief Initializer for the queue of events.
+ */
+volatile uint8_t SFEMP3Shield::event_queue[MP3_EVENT_QUEUE_SIZE];
+volatile uint8_t SFEMP3Shield::event_head;
+volatile uint8_t SFEMP3Shield::event_tail;
+event_callback_t SFEMP3Shield::event_callback;
+bool SFEMP3Shield::stream_starved;
+
+#if MP3_REFILL_STATS
+/**
+ * \brief Initializer for the counters of refill and register performance.
+ */
+refill_stats_t SFEMP3Shield::refill_stats;
+#endif
+
+#if MP3_TRACE_RECORDS
+/**
+ * \brief Initializer for the ring of trace records.
+ */
+trace_record_t SFEMP3Shield::trace_ring[MP3_TRACE_RECORDS];
+volatile uint16_t SFEMP3Shield::trace_next;
+volatile bool SFEMP3Shield::trace_full;
+volatile bool SFEMP3Shield::trace_paused;
+uint8_t SFEMP3Shield::trace_state;
+#endif
+
 /**
  * \brief Initializer for the instance of the SdCard's static member.
  */
@@ -160,6 +519,10 @@ if (int8_t(sd.vol()->fatType()) == 0) {
 
   playing_state = initialized;
 
+#if MP3_TRACE_RECORDS && FAT_TRACE
+  fatTraceHook = traceFat; // SdFat's block reads and cache misses.
+#endif
+
   uint8_t result = vs_init();
   if(result) {
     return result;
@@ -284,6 +647,8 @@ uint8_t SFEMP3Shield::vs_init() {
   int MP3Clock = Mp3ReadRegister(SCI_CLOCKF);
   if(MP3Clock != 0x6000) return 5;
 
+  play_speed = 1; // as the VSdsp was reset.
+
   setVolume(40, 40);
   // one would think the following patch would over write the volume.
   // But the SCI_VOL register space is not in the VSdsp's WRAM space.
@@ -360,6 +725,7 @@ uint8_t SFEMP3Shield::VSLoadUserCode(char* fileName){
   }
   track.close(); //Close out this track
   //playing_state = ready;
+  postEvent(event_plugin_loaded);
   return 0;
 }
 
@@ -594,12 +960,13 @@ void SFEMP3Shield::setVolume(uint8_t data) {
  * As specified by Data Sheet Section 8.7.11
  *
  * \note input values are -1/2dB. e.g. 40 results in -20dB.
+ * \note during a fade its attenuation is added, see fadeIn() and fadeOut().
  */
 void SFEMP3Shield::setVolume(uint8_t leftchannel, uint8_t rightchannel){
 
   VolL = leftchannel;
   VolR = rightchannel;
-  Mp3WriteRegister(SCI_VOL, leftchannel, rightchannel);
+  writeFade(fade_level);
 }
 
 //------------------------------------------------------------------------------
@@ -621,6 +988,183 @@ uint16_t SFEMP3Shield::getVolume() {
   uint16_t MP3SCI_VOL = Mp3ReadRegister(SCI_VOL);
   return MP3SCI_VOL;
 }
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write the master volume, less the fade's attenuation
+ *
+ * \param[in] level of attenuation in -1/2dB steps, added to VolL and VolR.
+ *
+ * The only writer of SCI_VOL, other than the VSdsp's reset. Such that the
+ * fade is held over setVolume().
+ */
+void SFEMP3Shield::writeFade(uint8_t level) {
+  uint16_t left = VolL + level;
+  uint16_t right = VolR + level;
+
+  fade_level = level;
+  Mp3WriteRegister(SCI_VOL, left < FADE_SILENT ? left : FADE_SILENT,
+                            right < FADE_SILENT ? right : FADE_SILENT);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Start a ramp of the fade's attenuation
+ *
+ * \param[in] level of attenuation to reach, in -1/2dB steps.
+ * \param[in] ms duration of the ramp.
+ * \param[in] action at the end of the ramp, FADE_NONE, FADE_STOP or FADE_NEXT.
+ *
+ * The attenuation moves linearly from where it is, such that the ramp is
+ * linear in dB. Nothing is written here, serviceFade() does that from
+ * available().
+ */
+void SFEMP3Shield::startFade(uint8_t level, uint16_t ms, uint8_t action) {
+  fade_from = fade_level;
+  fade_to = level;
+  fade_time = ms;
+  fade_start = millis();
+  fade_action = action;
+  fade_owner = this;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Attenuation of the fade's ramp at present
+ *
+ * \return the attenuation in -1/2dB steps, as of millis() since startFade().
+ */
+uint8_t SFEMP3Shield::fadeRamp() {
+  uint32_t elapsed = millis() - fade_start;
+
+  if(elapsed >= fade_time) return fade_to;
+  return fade_from + ((int32_t) fade_to - fade_from) * (int32_t) elapsed / fade_time;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Step the fade's ramp
+ *
+ * Called from available(). Writes SCI_VOL at most once per call, only when
+ * the attenuation has moved, and never waits on the ramp. At its end the
+ * ramp's action is taken: FADE_STOP stops the track and then restores the
+ * volume, FADE_NEXT stops the track and plays fade_next fading in.
+ *
+ * \note Not stepped by refill(), as the SCI write would wait on DREQ within
+ * the interrupt.
+ */
+void SFEMP3Shield::serviceFade() {
+  uint8_t level = fadeRamp();
+
+  if(level != fade_level) {
+    writeFade(level);
+  }
+  if(level != fade_to) return;
+
+  if(fade_action == FADE_STOP) {
+    stopTrack();
+    startFade(0, 0, FADE_NONE); // restored on the next call.
+  } else if(fade_action == FADE_NEXT) {
+    stopTrack();
+    if(playMP3(fade_next)) {
+      startFade(0, 0, FADE_NONE);
+    } else {
+      startFade(0, fade_time, FADE_NONE);
+    }
+  } else {
+    fade_owner = 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Set the fade in of tracks as they start
+ *
+ * \param[in] ms duration of the fade in, or 0 to start at full volume.
+ *
+ * Default is MP3_FADE_MS.
+ */
+void SFEMP3Shield::setFadeTime(uint16_t ms) {
+  fade_in = ms;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Fade the volume in
+ *
+ * \param[in] ms duration of the ramp from the present attenuation, such as
+ * silence, to the volume of setVolume().
+ *
+ * Returns at once, where the ramp is stepped by available(), which must be
+ * polled.
+ */
+void SFEMP3Shield::fadeIn(uint16_t ms) {
+  startFade(0, ms, FADE_NONE);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Fade the volume out
+ *
+ * \param[in] ms duration of the ramp from the present volume to silence.
+ * \param[in] stop the track when silent, and restore the volume.
+ *
+ * Returns at once, where the ramp is stepped by available(), which must be
+ * polled. Otherwise the volume stays where it is and isFading() stays true.
+ */
+void SFEMP3Shield::fadeOut(uint16_t ms, bool stop) {
+  startFade(FADE_SILENT, ms, stop ? FADE_STOP : FADE_NONE);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Change to another track by fading
+ *
+ * \param[out] fileName pointer of a char array (aka string), contianing the filename
+ * \param[in] ms duration of the change.
+ *
+ * Fades out the playing track over half of \p ms, then stops it and plays
+ * \p fileName fading in over the other half. As the VSdsp decodes only one
+ * stream, the tracks are faded one after the other rather than mixed.
+ * Without a playing track \p fileName simply fades in.
+ *
+ * Returns at once, where the fades and the change of track are stepped by
+ * available(), which must be polled. Otherwise the track plays on and
+ * isFading() stays true.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * - 0 indicates the change has begun.
+ * - 1 thru 3 are as from playMP3(), where no track was playing.
+ * - 4 indicates \p fileName is longer than 8.3.
+ */
+uint8_t SFEMP3Shield::fadeToMP3(char* fileName, uint16_t ms) {
+  uint8_t result;
+
+  if(strlen(fileName) >= sizeof(fade_next)) return 4;
+
+  if(isPlaying() != 1) {
+    result = playMP3(fileName);
+    if(!result) {
+      writeFade(FADE_SILENT);
+      fadeIn(ms);
+    }
+    return result;
+  }
+
+  strcpy(fade_next, fileName);
+  startFade(FADE_SILENT, ms / 2, FADE_NEXT);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Indicate if the volume is fading
+ *
+ * \return true while a fade or its action is still to be completed.
+ */
+bool SFEMP3Shield::isFading() {
+  return fade_owner != 0;
+}
 // @}
 // Volume_Group
 
@@ -842,53 +1386,222 @@ uint16_t SFEMP3Shield::getPlaySpeed() {
  * SdCard, Arduino and VS10xx may result in erratic behavior.
  */
 void SFEMP3Shield::setPlaySpeed(uint16_t data) {
+  pos_base = getPositionMsec(); // anchor the position at the old speed.
+  pos_stamp = millis();
+  play_speed = data ? data : 1;
   Mp3WriteWRAM(para_playSpeed, data);
 }
-// @}
-//PlaySpeed_Group
-
-//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-// @{
-// EarSpeaker_Group
 
 //------------------------------------------------------------------------------
 /**
- * \brief Get the current Spatial EarSpeaker setting from the VS10xx chip
+ * \brief Scan the playing track forward or backward, as to cue or review
  *
- * Read the VS10xx SCI_MODE register bits SM_EARSPEAKER_LO and SM_EARSPEAKER_HIGH
- * for current EarSpeaker and return its results as a composite integer.
- * As specified by Data Sheet Section 8.7.1 and 8.4
+ * \param[in] speed multiple of normal speed, negative to rewind. Where 0 or 1
+ * end the scan, playing on from where it got to.
  *
- * \return result between 0 and 3. Where 0 is OFF and 3 is maximum.
+ * Forward, the VSdsp plays at \p speed, as of setPlaySpeed(), and the track's
+ * read ahead is sized to MP3_SCAN_AHEAD_MS at the multiplied byte rate.
+ *
+ * Backward, snippets of MP3_SCAN_SNIPPET_MS play forward at the present play
+ * speed, each starting \p speed snippets before the last, as stepped by
+ * available(). The steps are found by seekOffset() and jump as of
+ * jumpResync(), without a cancel or mute between them. Reaching the start of
+ * the track ends the scan.
+ *
+ * \return
+ * - 0 indicates the scan was started, changed or ended.
+ * - 1 indicates no action, in lieu of any current file stream.
+ * - 2 indicates the track can not be scanned backward, being of a format
+ * that is re-primed by each seek, such as WAV, FLAC, Ogg or MP4.
+ *
+ * \note skip(), skipTo() and stopTrack() end the scan.
  */
-uint8_t SFEMP3Shield::getEarSpeaker() {
-  uint8_t result = 0;
-  uint16_t MP3SCI_MODE = Mp3ReadRegister(SCI_MODE);
+uint8_t SFEMP3Shield::scanTrack(int8_t speed) {
 
-  // SM_EARSPEAKER bits are not adjacent hence need to add them together
-  if(MP3SCI_MODE & SM_EARSPEAKER_LO) {
-    result += 0b01;
+  if((isPlaying() != 1) || !digitalRead(MP3_RESET) || stream_buffer || effect_source)
+    return 1;
+  if((speed < 0) && seek_exact)
+    return 2;
+
+  if(speed < 0) {
+    scan_pos = getPositionMsec(); // the snippet being played.
+    scan_stamp = millis();
   }
-  if(MP3SCI_MODE & SM_EARSPEAKER_HI) {
-    result += 0b10;
+  endScan();
+  if(speed > 1) {
+    scan_play_speed = play_speed;
+    setPlaySpeed(speed);
   }
-  return result;
+
+  // resize the read ahead, while the track is not being read.
+  state_m state = playing_state;
+  disableRefill();
+  playing_state = paused_playback;
+  scanAhead((speed > 1) ? speed : 1);
+  playing_state = state; // a paused track stays paused.
+  if(playing_state == playback) {
+    refill(); // DREQ may have risen while detached.
+    if(playing_state == playback) enableRefill();
+  }
+
+  if((speed > 1) || (speed < 0)) {
+    scan_speed = speed;
+    scan_owner = this;
+  }
+  return 0;
 }
 
 //------------------------------------------------------------------------------
 /**
- * \brief Set the current Spatial EarSpeaker setting of the VS10xx chip
+ * \brief Speed of the scan of scanTrack()
  *
- * \param[in] EarSpeaker integer value between 0 and 3. Where 0 is OFF and 3 is maximum.
- *
- * The input value is mapped onto SM_EARSPEAKER_LO and SM_EARSPEAKER_HIGH bits
- * and written the VS10xx SCI_MODE register, preserving the remainder of SCI_MODE.
- * As specified by Data Sheet Section 8.7.1 and 8.4
+ * \return the multiple of normal speed, negative if rewinding, or zero if not
+ * scanning.
  */
-void SFEMP3Shield::setEarSpeaker(uint16_t EarSpeaker) {
-  uint16_t MP3SCI_MODE = Mp3ReadRegister(SCI_MODE);
+int8_t SFEMP3Shield::getScanSpeed() {
 
-  // SM_EARSPEAKER bits are not adjacent hence need to add them individually
+  return scan_speed;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Step the scan of scanTrack()
+ *
+ * Called by available(). Backward, once MP3_SCAN_SNIPPET_MS has played, jumps
+ * the track to the next snippet back, with SCI_DECODE_TIME set to its time.
+ * Ends the scan should the track have ended.
+ */
+void SFEMP3Shield::serviceScan() {
+  uint32_t now = millis();
+
+  if((playing_state != playback) && (playing_state != paused_playback)) {
+    endScan();
+    return;
+  }
+  if((scan_speed > 0) || (playing_state != playback) || stream_buffer || effect_source
+     || (now - scan_stamp < MP3_SCAN_SNIPPET_MS))
+    return;
+  scan_stamp = now;
+
+  // back by speed snippets, from the start of the one just played.
+  uint32_t step = (uint32_t) -scan_speed * MP3_SCAN_SNIPPET_MS;
+  bool start = (scan_pos <= step);
+  scan_pos = start ? 0 : scan_pos - step;
+
+  disableRefill();
+  playing_state = paused_playback;
+  if(track.seekSet(seekOffset(scan_pos))) {
+    jumpResync();
+    // written twice, as the VSdsp may otherwise overwrite it.
+    Mp3WriteRegister(SCI_DECODE_TIME, scan_pos / 1000);
+    Mp3WriteRegister(SCI_DECODE_TIME, scan_pos / 1000);
+  }
+  restartPosition(pos_mode);
+
+  playing_state = playback;
+  refill();
+  if(playing_state == playback) enableRefill();
+
+  if(start) endScan(); // on from the start.
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief End the scan of scanTrack()
+ *
+ * Restores the play speed of before a forward scan, along with the track's
+ * read ahead to the track_window, should scanAhead() have borrowed the
+ * MP3_RECORD_BLOCKS buffer.
+ */
+void SFEMP3Shield::endScan() {
+
+  if(scan_speed > 1) {
+    setPlaySpeed(scan_play_speed);
+#if USE_FAT_READ_AHEAD && MP3_READ_AHEAD_BLOCKS && (MP3_RECORD_BLOCKS > MP3_READ_AHEAD_BLOCKS)
+    if(track.isOpen()) {
+      // while the track is not being read.
+      disableRefill();
+      track.setReadAhead(track_window, MP3_READ_AHEAD_BLOCKS);
+      enableRefill();
+    }
+#endif
+  }
+  scan_speed = 0;
+  scan_owner = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Size the track's read ahead to a play speed
+ *
+ * \param[in] speed multiple of the VSdsp's byte rate to be read.
+ *
+ * MP3_SCAN_AHEAD_MS at the multiplied rate. When more than
+ * MP3_READ_AHEAD_BLOCKS, the MP3_RECORD_BLOCKS buffer is read into instead,
+ * being the larger and idle while playing. Otherwise, and always at normal
+ * speed, the track_window, as set up by playMP3().
+ */
+void SFEMP3Shield::scanAhead(uint16_t speed) {
+#if USE_FAT_READ_AHEAD && MP3_READ_AHEAD_BLOCKS
+#if MP3_RECORD_BLOCKS > MP3_READ_AHEAD_BLOCKS
+  uint32_t blocks = (msToSamples(MP3_SCAN_AHEAD_MS, (uint32_t) Mp3ReadWRAM(para_byteRate) * speed) + 511) >> 9;
+  if((speed > 1) && (blocks > MP3_READ_AHEAD_BLOCKS)) {
+    track.setReadAhead(record_buffer, (blocks < MP3_RECORD_BLOCKS) ? blocks : MP3_RECORD_BLOCKS);
+    return;
+  }
+#else
+  (void)speed;
+#endif
+  track.setReadAhead(track_window, MP3_READ_AHEAD_BLOCKS);
+#else
+  (void)speed;
+#endif
+}
+// @}
+//PlaySpeed_Group
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// EarSpeaker_Group
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Get the current Spatial EarSpeaker setting from the VS10xx chip
+ *
+ * Read the VS10xx SCI_MODE register bits SM_EARSPEAKER_LO and SM_EARSPEAKER_HIGH
+ * for current EarSpeaker and return its results as a composite integer.
+ * As specified by Data Sheet Section 8.7.1 and 8.4
+ *
+ * \return result between 0 and 3. Where 0 is OFF and 3 is maximum.
+ */
+uint8_t SFEMP3Shield::getEarSpeaker() {
+  uint8_t result = 0;
+  uint16_t MP3SCI_MODE = Mp3ReadRegister(SCI_MODE);
+
+  // SM_EARSPEAKER bits are not adjacent hence need to add them together
+  if(MP3SCI_MODE & SM_EARSPEAKER_LO) {
+    result += 0b01;
+  }
+  if(MP3SCI_MODE & SM_EARSPEAKER_HI) {
+    result += 0b10;
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Set the current Spatial EarSpeaker setting of the VS10xx chip
+ *
+ * \param[in] EarSpeaker integer value between 0 and 3. Where 0 is OFF and 3 is maximum.
+ *
+ * The input value is mapped onto SM_EARSPEAKER_LO and SM_EARSPEAKER_HIGH bits
+ * and written the VS10xx SCI_MODE register, preserving the remainder of SCI_MODE.
+ * As specified by Data Sheet Section 8.7.1 and 8.4
+ */
+void SFEMP3Shield::setEarSpeaker(uint16_t EarSpeaker) {
+  uint16_t MP3SCI_MODE = Mp3ReadRegister(SCI_MODE);
+
+  // SM_EARSPEAKER bits are not adjacent hence need to add them individually
   if(EarSpeaker & 0b01) {
     MP3SCI_MODE |=  SM_EARSPEAKER_LO;
   } else {
@@ -1006,15 +1719,106 @@ void SFEMP3Shield::setMonoMode(uint16_t StereoMode) {
 // @{
 // Play_Control_Group
 
+#if MP3_TRACK_CACHE_SIZE
+//------------------------------------------------------------------------------
+/**
+ * \brief Track number of a trackNNN.mp3 filename
+ *
+ * \param[in] name filename to be inspected, ignoring case.
+ * \param[out] number the track's number, if matched.
+ *
+ * \return true if the name is exactly as formatted by SFEMP3Shield::playTrack().
+ */
+static bool parseTrackName(const char* name, uint16_t* number) {
+  char canonical[16];
+  uint32_t value = 0;
+  const char* digit = name + 5;
+
+  if(strncasecmp(name, "track", 5)) return false;
+  for( ; isdigit(*digit); digit++) {
+    value = value * 10 + (*digit - '0');
+    if(value >= TRACK_CACHE_EMPTY) return false;
+  }
+  sprintf(canonical, "track%03u.mp3", (uint16_t) value);
+  if(strcasecmp(name, canonical)) return false;
+  *number = value;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Scan the current working directory for the trackNNN.mp3 files
+ *
+ * Refills the cache of directory entry indices used by SFEMP3Shield::playTrack()
+ * with a single pass over the directory. Read by a handle of its own, leaving
+ * the sketch's position in the directory as it is.
+ */
+void SFEMP3Shield::scanTrackCache() {
+  char name[16];
+  SdFile file;
+  FatFile dir;
+  uint16_t number;
+
+  for(uint16_t i = 0; i < MP3_TRACK_CACHE_SIZE; i++) {
+    track_cache[i].number = TRACK_CACHE_EMPTY;
+  }
+
+  track_cache_dir = sd.vwd()->firstCluster();
+  if(!dir.openDir(sd.vwd())) return;
+  while(file.openNext(&dir, O_READ)) {
+    if(file.isFile() && file.getName(name, sizeof(name)) && parseTrackName(name, &number)) {
+      track_cache[number % MP3_TRACK_CACHE_SIZE].number = number;
+      track_cache[number % MP3_TRACK_CACHE_SIZE].dirIndex = file.dirIndex();
+    }
+    file.close();
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Open a track from its cached directory entry
+ *
+ * \param[in] trackNo number of the track.
+ * \param[in] trackName filename the directory entry is expected to have.
+ *
+ * The first call within a directory scans it, see scanTrackCache(). The entry
+ * found is verified to still have the expected name, as the directory may have
+ * changed since.
+ *
+ * \return true if track was opened.
+ */
+bool SFEMP3Shield::openCachedTrack(uint16_t trackNo, const char* trackName) {
+  char name[16];
+  track_cache_t* slot = &track_cache[trackNo % MP3_TRACK_CACHE_SIZE];
+
+  if(track_cache_dir != sd.vwd()->firstCluster()) {
+    scanTrackCache();
+  }
+  if(slot->number != trackNo) return false;
+
+  if(track.open(sd.vwd(), slot->dirIndex, O_READ)) {
+    if(track.isFile() && track.getName(name, sizeof(name)) && !strcasecmp(name, trackName)) {
+      return true;
+    }
+    track.close();
+  }
+  slot->number = TRACK_CACHE_EMPTY;
+  return false;
+}
+#endif
+
 //------------------------------------------------------------------------------
 /**
  * \brief Begin playing a mp3 file, just with a number
  *
- * \param[in] trackNo integer value between 0 and 9, corresponding to the track to play.
+ * \param[in] trackNo integer value between 0 and 65534, corresponding to the track to play.
+ * \param[in] timecode (optional) milliseconds from the begining of the file.
  *
  * Formats the input number into a corresponding filename,
- * from track001.mp3 through track009.mp3. Then executes the track by
- * calling SFEMP3Shield::playMP3(char* fileName)
+ * from track000.mp3 through track65534.mp3. Then opens the track from its
+ * directory entry remembered by an earlier scan of the directory, see
+ * MP3_TRACK_CACHE_SIZE. Otherwise executes the track by calling
+ * SFEMP3Shield::playMP3(char* fileName)
  *
  * \return Any Value other than zero indicates a problem occured.
  * where value indicates specific error
@@ -1022,17 +1826,104 @@ void SFEMP3Shield::setMonoMode(uint16_t StereoMode) {
  * \see
  * \ref Error_Codes
  */
-uint8_t SFEMP3Shield::playTrack(uint8_t trackNo, uint32_t timecode){
+uint8_t SFEMP3Shield::playTrack(uint16_t trackNo, uint32_t timecode){
 
   //a storage place for track names
-  char trackName[] = "track001.mp3";
-  uint8_t trackNumber = 1;
+  char trackName[16];
+  uint8_t result;
 
   //tack the number onto the rest of the filename
-  sprintf(trackName, "track%03d.mp3", trackNo);
+  sprintf(trackName, "track%03u.mp3", trackNo);
+
+  if(isPlaying()) return 1;
+  if(!digitalRead(MP3_RESET)) return 3;
+
+#if MP3_TRACK_CACHE_SIZE
+  //open straight from the directory entry, if known
+  if((trackNo != TRACK_CACHE_EMPTY) && openCachedTrack(trackNo, trackName)) {
+    return playOpenTrack(timecode);
+  }
+#endif
 
   //play the file
-  return playMP3(trackName, timecode);
+  result = playMP3(trackName, timecode);
+
+#if MP3_TRACK_CACHE_SIZE
+  //remember where it was found, for the next time
+  if((result == 0) && (trackNo != TRACK_CACHE_EMPTY)) {
+    track_cache[trackNo % MP3_TRACK_CACHE_SIZE].number = trackNo;
+    track_cache[trackNo % MP3_TRACK_CACHE_SIZE].dirIndex = track.dirIndex();
+  }
+#endif
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin playing a file by the index of its directory entry.
+ *
+ * \param[in] dirIndex index of the file's entry within the current working
+ *  directory, such as from SdFile::dirIndex() or track_index_t::dirIndex.
+ * \param[in] timecode (optional) milliseconds from the begining of the file.
+ *  Only works with mp3 files, otherwise do nothing.
+ *
+ * Reads only the one directory entry, rather than searching the directory by
+ * name as SFEMP3Shield::playMP3() does.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t SFEMP3Shield::playDirIndex(uint16_t dirIndex, uint32_t timecode) {
+
+  if(isPlaying()) return 1;
+  if(!digitalRead(MP3_RESET)) return 3;
+
+  if(!track.open(sd.vwd(), dirIndex, O_READ)) return 2;
+  if(!track.isFile()) {
+    track.close();
+    return 2;
+  }
+
+  return playOpenTrack(timecode);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin playing a track of the on-card music library index.
+ *
+ * \param[in] number position of the track in the index, in order of name.
+ * \param[in] timecode (optional) milliseconds from the begining of the file.
+ *  Only works with mp3 files, otherwise do nothing.
+ *
+ * Opens the file from the directory entry recorded in the index, and verifies
+ * it still has the recorded first cluster and size. Hence a stale index results
+ * in file not found, rather than playing the wrong file.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t SFEMP3Shield::playIndexedTrack(uint16_t number, uint32_t timecode) {
+  track_index_t rec;
+
+  if(isPlaying()) return 1;
+  if(!digitalRead(MP3_RESET)) return 3;
+
+  if(getIndexedTrack(number, &rec)) return 2;
+  if(!track.open(sd.vwd(), rec.dirIndex, O_READ)) return 2;
+  if(!track.isFile()
+     || (track.firstCluster() != rec.firstCluster)
+     || (track.fileSize() != rec.fileSize)) {
+    track.close();
+    return 2;
+  }
+
+  return playOpenTrack(timecode);
 }
 
 //------------------------------------------------------------------------------
@@ -1045,7 +1936,8 @@ uint8_t SFEMP3Shield::playTrack(uint8_t trackNo, uint32_t timecode){
  *
  * Skip, if already playing. Otherwise initialize the SdCard track to desired filehandle.
  * Reset the ByteRate and Play position and set playing to indicate such.
- * If the filename extension is MP3, then pre-read the byterate from the file.
+ * The format is detected from the first bytes of the file, not its name,
+ * see getTrackFormat(). If it is MP3, then pre-read the byterate from the file.
  * And initially fill the VSDsp's buffer, then enable refilling.
  *
  * \return Any Value other than zero indicates a problem occured.
@@ -1068,28 +1960,104 @@ uint8_t SFEMP3Shield::playMP3(char* fileName, uint32_t timecode) {
   if(isPlaying()) return 1;
   if(!digitalRead(MP3_RESET)) return 3;
 
+#if USE_FAT_NAME_HASH && MP3_NAME_HASH_SIZE
+  // Hash the names of a newly entered directory, see MP3_NAME_HASH_SIZE.
+  if(!sd.vwd()->nameHashCount()) {
+    sd.vwd()->setNameHash(name_hash, MP3_NAME_HASH_SIZE);
+  }
+#endif
+
   //Open the file in read mode.
   if(!track.open(fileName, O_READ)) return 2;
 
-  // find length of arrary at pointer
-  int fileNamefileName_length = 0;
-  while(*(fileName + fileNamefileName_length))
-    fileNamefileName_length++;
+  return playOpenTrack(timecode);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin playing the already opened track.
+ *
+ * \param[in] timecode milliseconds from the begining of the file.
+ *  Only works with mp3 files, otherwise do nothing.
+ *
+ * Common to all the play functions, once they have opened the track.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ */
+uint8_t SFEMP3Shield::playOpenTrack(uint32_t timecode) {
+  uint8_t head[FORMAT_SNIFF_SIZE];
+
+  stream_buffer = 0;
+  effect_source = EFFECT_NONE;
+  endScan();
+
+#if USE_FAT_EXTENT_MAP
+  // remember the cluster chain as it is read, for quicker seeks.
+  track.setExtentMap(track_extent, MP3_EXTENT_MAP_SIZE);
+#endif
+#if USE_FAT_READ_AHEAD && MP3_READ_AHEAD_BLOCKS
+  // stream the refill()'s small reads through multi-block reads.
+  track.setReadAhead(track_window, MP3_READ_AHEAD_BLOCKS);
+#endif
+
+  // Detect the format from the first block, which is to be played anyway.
+  track_format = format_unknown;
+  if(track.read(head, sizeof(head)) == sizeof(head)) {
+    track_format = formatFromContent(head);
+  }
+  track.seekSet(0);
+  start_of_music = 0;
+#if MP3_SEEK_WAV
+  wav_align = 0;
+#endif
+#if MP3_SEEK_FLAC || MP3_SEEK_MP4
+  seek_rate = 0;
+#endif
+  jump_count = 0;
+  jump_next = 0;
+
+  Mp3WriteRegister(SCI_DECODE_TIME, 0); // Reset the Decode and bitrate from previous play back.
 
   // Only know how to read bitrate from MP3 file. ignore the rest.
   // Note bitrate may get updated later by getAudioInfo()
-  if(strstr(strlwr(fileName), "mp3") )  {
-    getBitRateFromMP3File(fileName);
+  if(track_format == format_mp3) {
+    seek_exact = false;
+    getBitRateFromMP3File();
     if (timecode > 0) {
-      track.seekSet(timecode * bitrate + start_of_music); // skip to X ms.
+      track.seekSet(seekOffset(timecode)); // skip to X ms.
     }
   }
+  else {
+    // the formats whose headers give their exact positions.
+    switch(track_format) {
+#if MP3_SEEK_WAV
+      case format_wav:  seek_exact = parseWav();  break;
+#endif
+#if MP3_SEEK_FLAC
+      case format_flac: seek_exact = parseFlac(); break;
+      case format_ogg:  seek_exact = parseOgg();  break;
+#endif
+#if MP3_SEEK_MP4
+      case format_aac:  seek_exact = parseMp4();  break;
+#endif
+      default:          seek_exact = false;       break;
+    }
+    // MP4 is primed from the start too, as to feed a trailing moov first.
+    uint32_t offset = (seek_exact && ((timecode > 0) || (track_format == format_aac))) ? seekOffset(timecode) : 0;
+    if(track.seekSet(offset) && offset) primeTrack(offset, timecode);
+  }
 
   playing_state = playback;
 
-  Mp3WriteRegister(SCI_DECODE_TIME, 0); // Reset the Decode and bitrate from previous play back.
+  restartPosition(POSITION_UNKNOWN);
   delay(100); // experimentally found that we need to let this settle before sending data.
 
+  if(fade_in) {
+    writeFade(FADE_SILENT);
+    fadeIn(fade_in);
+  }
+
   //gotta start feeding that hungry mp3 chip
   refill();
 
@@ -1109,6 +2077,7 @@ uint8_t SFEMP3Shield::playMP3(char* fileName, uint32_t timecode) {
  */
 void SFEMP3Shield::stopTrack(){
 
+  serviceEffect(); // back in the track, as to stop it.
   if(((playing_state != playback) && (playing_state != paused_playback)) || !digitalRead(MP3_RESET))
     return;
 
@@ -1117,6 +2086,12 @@ void SFEMP3Shield::stopTrack(){
   playing_state = ready;
 
   track.close(); //Close out this track
+  stream_buffer = 0;
+  jump_count = 0;
+  jump_next = 0;
+  endScan();
+  closeEffect(effect_source);
+  effect_source = EFFECT_NONE;
 
   flush_cancel(pre); //possible mode of "none" for faster response.
 
@@ -1133,7 +2108,9 @@ void SFEMP3Shield::stopTrack(){
  * \return
  * - 0 indicates \b NO file is currently being streamed to the VSdsp.
  * - 1 indicates that a file is currently being streamed to the VSdsp.
+ * - 2 indicates that the VSdsp is being recorded to a file.
  * - 3 indicates that the VSdsp is in reset.
+ * - 4 indicates that the VSdsp is in real-time MIDI mode.
  */
 uint8_t SFEMP3Shield::isPlaying(){
   uint8_t result;
@@ -1144,6 +2121,10 @@ uint8_t SFEMP3Shield::isPlaying(){
     result = 1;
   else if(getState() == paused_playback)
     result = 1;
+  else if(getState() == recording)
+    result = 2;
+  else if(getState() == realtime_midi)
+    result = 4;
   else
     result = 0;
 
@@ -1159,6 +2140,7 @@ uint8_t SFEMP3Shield::isPlaying(){
  * \return the value held by SFEMP3Shield::playing_state
  */
 state_m SFEMP3Shield::getState(){
+ serviceEffect(); // such that the state is not that of an effect's end.
  return playing_state;
 }
 
@@ -1229,8 +2211,17 @@ void SFEMP3Shield::pauseMusic() {
 uint8_t SFEMP3Shield::resumeMusic(uint32_t timecode) {
   if((playing_state == paused_playback) && digitalRead(MP3_RESET)) {
 
-    if(!track.seekSet(((timecode * Mp3ReadWRAM(para_byteRate))/1000) + start_of_music))    //if(!track.seekCur((uint32_t(timecode/1000 * Mp3ReadWRAM(para_byteRate)))))
+    uint32_t offset = seekOffset(timecode);
+    if(!track.seekSet(offset))
       return 2;
+    if(seek_exact) {
+      // paused, so the header is sent ahead of resumeDataStream()'s refill().
+      flush_cancel(pre);
+      primeTrack(offset, timecode);
+    } else {
+      jumpResync();
+    }
+    postEvent(event_seek_complete);
 
     resumeDataStream();
     return 0;
@@ -1274,36 +2265,45 @@ bool SFEMP3Shield::resumeMusic() {
  * - 2 indicates failure to skip to new file location.
  *
  * \warning Limited to +/- 32768ms, since SdFile::seekCur(int32_t);
+ * \note Other than the tracks re-primed by primeTrack(), the VSdsp resyncs to
+ * the new position as per jumpResync(), without cancel, mute or delay.
  */
 uint8_t SFEMP3Shield::skip(int32_t timecode){
 
-  if(isPlaying() && digitalRead(MP3_RESET)) {
+  if((isPlaying() == 1) && digitalRead(MP3_RESET) && !stream_buffer && !effect_source) {
+
+    endScan();
+    if(seek_exact) getPositionMsec(); // held in pos_base, while paused.
 
     //stop interupt for now
     disableRefill();
     playing_state = paused_playback;
 
-    // try to set the files position to current position + offset(in bytes)
-    // as calculated from current byte rate, as per VSdsp.
-    if(!track.seekCur((uint32_t(timecode/1000 * Mp3ReadWRAM(para_byteRate))))) // skip next X ms.
-      return 2;
-
-    Mp3WriteRegister(SCI_VOL, 0xFE, 0xFE);
-    //seeked successfully
-
-    flush_cancel(pre); //possible mode of "none" for faster response.
-
-    //gotta start feeding that hungry mp3 chip
-    refill();
-
-    //again, I'm being bad and not following the spec sheet.
-    //I already turned the volume down, so when the MP3 chip gets upset at me
-    //for just slammin in new bits of the file, you won't hear it.
-    //so we'll wait a bit, and restore the volume to previous level
-    delay(50);
-
-    //one of these days I'll come back and try to do it the right way.
-    setVolume(VolL,VolR);
+    if(seek_exact) {
+      // from the time being played, as of before the pause.
+      int32_t to = (int32_t) pos_base + timecode;
+      if(to < 0) to = 0;
+      uint32_t offset = seekOffset(to);
+      if(!track.seekSet(offset))
+        return 2;
+
+      flush_cancel(pre);
+      primeTrack(offset, to); // a fresh header, so there is nothing to hide.
+      refill();
+    } else {
+      // try to set the files position to current position + offset(in bytes)
+      // as calculated from current byte rate, as per VSdsp.
+      if(!track.seekCur((uint32_t(timecode/1000 * Mp3ReadWRAM(para_byteRate))))) // skip next X ms.
+        return 2;
+
+      //seeked successfully, so the VSdsp resyncs to the new bits.
+      jumpResync();
+
+      //gotta start feeding that hungry mp3 chip
+      refill();
+    }
+    restartPosition(pos_mode);
+    postEvent(event_seek_complete);
 
     playing_state = playback;
     //attach refill interrupt off DREQ line, pin 2
@@ -1322,7 +2322,7 @@ uint8_t SFEMP3Shield::skip(int32_t timecode){
  * \param[in] timecode offset milliseconds from the begining of the file.
  *
  * Repositions the filehandles track location to the requested offset.
- * As calculated by the bitrate multiplied by the desired ms offset.
+ * As calculated by seekOffset(), for the format of the track.
  *
  * \return
  * - 0 indicates the position was changed.
@@ -1330,10 +2330,14 @@ uint8_t SFEMP3Shield::skip(int32_t timecode){
  * - 2 indicates failure to skip to new file location.
  *
  * \warning Limited to first 65535ms, since SdFile::seekSet(int32_t);
+ * \note Other than the tracks re-primed by primeTrack(), the VSdsp resyncs to
+ * the new position as per jumpResync(), without cancel, mute or delay.
  */
 uint8_t SFEMP3Shield::skipTo(uint32_t timecode){
 
-  if(isPlaying() && digitalRead(MP3_RESET)) {
+  if((isPlaying() == 1) && digitalRead(MP3_RESET) && !stream_buffer && !effect_source) {
+
+    endScan();
 
     //stop interupt for now
     disableRefill();
@@ -1341,26 +2345,22 @@ uint8_t SFEMP3Shield::skipTo(uint32_t timecode){
 
     // try to set the files position to current position + offset(in bytes)
     // as calculated from current byte rate, as per VSdsp.
-    if(!track.seekSet(((timecode * Mp3ReadWRAM(para_byteRate))/1000) + start_of_music)) // skip to X ms.
-    //if(!track.seekCur((uint32_t(timecode/1000 * Mp3ReadWRAM(para_byteRate))))) // skip next X ms.
+    uint32_t offset = seekOffset(timecode);
+    if(!track.seekSet(offset)) // skip to X ms.
       return 2;
 
-    Mp3WriteRegister(SCI_VOL, 0xFE, 0xFE);
-    //seeked successfully
-
-    flush_cancel(pre); //possible mode of "none" for faster response.
+    if(seek_exact) {
+      flush_cancel(pre);
+      primeTrack(offset, timecode); // a fresh header, so there is nothing to hide.
+    } else {
+      //seeked successfully, so the VSdsp resyncs to the new bits.
+      jumpResync();
+    }
 
     //gotta start feeding that hungry mp3 chip
     refill();
-
-    //again, I'm being bad and not following the spec sheet.
-    //I already turned the volume down, so when the MP3 chip gets upset at me
-    //for just slammin in new bits of the file, you won't hear it.
-    //so we'll wait a bit, and restore the volume to previous level
-    delay(50);
-
-    //one of these days I'll come back and try to do it the right way.
-    setVolume(VolL,VolR);
+    restartPosition(pos_mode);
+    postEvent(event_seek_complete);
 
     playing_state = playback;
     //attach refill interrupt off DREQ line, pin 2
@@ -1385,13 +2385,102 @@ uint8_t SFEMP3Shield::skipTo(uint32_t timecode){
  * the position for each file stream. Erasing prior streams weight.
  *
  * \warning Not very accurate, rounded off to second. And Variable Bit-Rates
- * are completely inaccurate.
+ * are completely inaccurate. See getPositionMsec().
  */
 uint32_t SFEMP3Shield::currentPosition(){
 
   return(Mp3ReadRegister(SCI_DECODE_TIME) << 10); // multiply by 1024 to convert to milliseconds.
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Current timecode in ms, to the millisecond
+ *
+ * Reads the VSdsp's positionMsec, both of its words in a single block access
+ * of the WRAM, at most every MP3_POSITION_REFRESH_MS. In between, the
+ * position is interpolated from the clock scaled by the play speed, so it
+ * may be polled often without an SCI round trip each time.
+ *
+ * For codecs without positionMsec, being all but WMA and Ogg Vorbis, the
+ * seconds of SCI_DECODE_TIME are read instead. Where the interpolation is
+ * re-anchored as each second ticks over, and held short of the next second
+ * until it is seen.
+ *
+ * \return the milliseconds offset of stream played.
+ *
+ * \note The position restarts with each playMP3() and is re-read after
+ * skip() and skipTo().
+ */
+uint32_t SFEMP3Shield::getPositionMsec() {
+  uint32_t now = millis();
+  uint32_t position;
+
+  if(playing_state != playback) {
+    // paused or stopped, hold the position.
+    pos_stamp = now;
+    return pos_base;
+  }
+
+  position = pos_base + (now - pos_stamp) * play_speed;
+
+  if(!pos_valid || (now - pos_read >= MP3_POSITION_REFRESH_MS) ||
+     ((pos_mode == POSITION_DECODE_TIME) && (position >= (pos_secs + 1) * 1000UL))) {
+    pos_read = now;
+
+    if(pos_mode != POSITION_DECODE_TIME) {
+      uint16_t w[2];
+      Mp3ReadWRAM(para_positionMsec_0, w, 2);
+      if(w[0] >= 0xFC00) {
+        // the low word may have carried before the high word was read, where
+        // a low word that has since wrapped marks the re-read as the whole one.
+        uint16_t v[2];
+        Mp3ReadWRAM(para_positionMsec_0, v, 2);
+        if(v[0] < w[0]) {
+          w[0] = v[0];
+          w[1] = v[1];
+        }
+      }
+      position = ((uint32_t) w[1] << 16) | w[0];
+      if(position != 0xFFFFFFFF) {
+        pos_mode = POSITION_MSEC;
+        pos_base = position;
+        pos_stamp = now;
+        pos_valid = true;
+        return position;
+      }
+      pos_mode = POSITION_DECODE_TIME;
+    }
+
+    uint16_t secs = Mp3ReadRegister(SCI_DECODE_TIME);
+    if(!pos_valid || (secs != pos_secs)) {
+      pos_secs = secs;
+      pos_base = secs * 1000UL;
+      pos_stamp = now;
+      pos_valid = true;
+      return pos_base;
+    }
+  }
+
+  if((pos_mode == POSITION_DECODE_TIME) && (position >= (pos_secs + 1) * 1000UL)) {
+    position = (pos_secs + 1) * 1000UL - 1;
+  }
+  return position;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Restart the millisecond position
+ *
+ * \param[in] mode POSITION_UNKNOWN as for a new stream, or the present
+ * pos_mode as to re-read it after a seek.
+ */
+void SFEMP3Shield::restartPosition(uint8_t mode) {
+  pos_mode = mode;
+  pos_base = 0;
+  pos_stamp = millis();
+  pos_valid = false;
+}
+
 // @}
 // Play_Control_Group
 
@@ -1491,19 +2580,18 @@ void SFEMP3Shield::getTrackInfo(uint8_t offset, char* infobuffer){
 /**
  * \brief Display various Audio information from the VSdsp.
  *
- * Read numerous attributes from the VSdsp's registers about either the currently
+ * Takes a snapshot with getAudioInfo(audio_info_t*) about either the currently
  * or prior played stream and display in a column format for easy reviewing.
  *
  * This may be called while playing a current stream.
  *
- * \note this suspends currently playing streams and returns afterwards.
- * Restoring the file position to where it left off, before resuming.
+ * \note Only this printing uses Serial, for sketches needing the values
+ * themselves see getAudioInfo(audio_info_t*).
  */
 void SFEMP3Shield::getAudioInfo() {
+  audio_info_t info;
 
-  //disable interupts
-  // already disabled in Mp3ReadRegister function
-  //pauseDataStream();
+  getAudioInfo(&info);
 
   Serial.print(F("HDAT1"));
   Serial.print(F("\tHDAT0"));
@@ -1517,188 +2605,2951 @@ void SFEMP3Shield::getAudioInfo() {
   Serial.print(F("\tPlaySpeed"));
   Serial.print(F("\tDECODE_TIME"));
   Serial.print(F("\tCurrentPos"));
+  Serial.print(F("\tFormat"));
+  Serial.print(F("\tRate"));
+  Serial.print(F("\tChannels"));
+  Serial.println();
+
+  Serial.print(F("0x"));
+  Serial.print(info.hdat1, HEX);
+  Serial.print(F("\t0x"));
+  Serial.print(info.hdat0, HEX);
+  Serial.print(F("\t0x"));
+  Serial.print(info.volume, HEX);
+  Serial.print(F("\t0x"));
+  Serial.print(info.mode, HEX);
+  Serial.print(F("\t0x"));
+  Serial.print(info.status, HEX);
+  Serial.print(F("\t0x"));
+  Serial.print(info.clockf, HEX);
+  Serial.print(F("\t0x"));
+  Serial.print(info.version, HEX);
+  Serial.print(F("\t\t"));
+  Serial.print(info.byteRate, HEX);
+  Serial.print(F("\t\t"));
+  Serial.print((info.byteRate>>7), DEC); // shift 7 is the same as *8/1024, and easier math.
+  Serial.print(F("\t\t"));
+  Serial.print(info.playSpeed, HEX);
+  Serial.print(F("\t\t"));
+  Serial.print(info.decodeTime, DEC);
+  Serial.print(F("\t\t"));
+  Serial.print((uint32_t) info.decodeTime << 10, DEC); // as currentPosition()
+  Serial.print(F("\t\t"));
+  Serial.print(audioFormat(&info), DEC);
+  Serial.print(F("\t"));
+  Serial.print(audioSampleRate(&info), DEC);
+  Serial.print(F("\t"));
+  Serial.print(audioChannels(&info), DEC);
   Serial.println();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Take a snapshot of the Audio information from the VSdsp.
+ *
+ * \param[out] info filled with the VSdsp's registers.
+ *
+ * The data stream is paused once for all of the reads, rather than around
+ * each, with the consecutive para_version thru para_byteRate read as one
+ * block of the WRAM. Where \c position is the file position of the track.
+ *
+ * This may be called while playing a current stream. Where the stream is
+ * resumed only if it was this call that paused it, so a track paused with
+ * pauseMusic() stays paused.
+ */
+void SFEMP3Shield::getAudioInfo(audio_info_t* info) {
+  uint16_t para[4];
+  bool paused_here = (playing_state == playback);
+
+  // only this call's own pause is undone, a user's pause stays put.
+  if(paused_here) pauseDataStream();
+
+  info->hdat1 = Mp3ReadRegister(SCI_HDAT1);
+  info->hdat0 = Mp3ReadRegister(SCI_HDAT0);
+  info->audata = Mp3ReadRegister(SCI_AUDATA);
+  info->volume = Mp3ReadRegister(SCI_VOL);
+  info->mode = Mp3ReadRegister(SCI_MODE);
+  info->status = Mp3ReadRegister(SCI_STATUS);
+  info->clockf = Mp3ReadRegister(SCI_CLOCKF);
+  info->decodeTime = Mp3ReadRegister(SCI_DECODE_TIME);
+  Mp3ReadWRAM(para_version, para, 4); // thru para_config1, para_playSpeed
+  info->version = para[0];
+  info->playSpeed = para[2];
+  info->byteRate = para[3];
+  info->position = track.isOpen() ? track.curPosition() : 0;
+
+  if(paused_here) resumeDataStream();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Decode the format of an Audio information snapshot.
+ *
+ * \param[in] info as from getAudioInfo(audio_info_t*).
+ *
+ * As SCI_HDAT1 holds the format being decoded, per Data Sheet Section 9.6.8.
+ * Such as "ve" for WAV, "Og" for Ogg Vorbis, or an MP3 frame's sync.
+ *
+ * \return one of audio_format_m, format_unknown if nothing is being decoded.
+ */
+audio_format_m SFEMP3Shield::audioFormat(const audio_info_t* info) {
+
+  if(info->hdat1 >= 0xFFE0) return format_mp3;
+  switch(info->hdat1) {
+    case 0x7665: return format_wav;  // "ve"
+    case 0x4154:                     // "AT", ADTS
+    case 0x4144:                     // "AD", ADIF
+    case 0x4D34: return format_aac;  // "M4", MP4
+    case 0x574D: return format_wma;  // "WM"
+    case 0x4D54: return format_midi; // "MT"
+    case 0x4F67: return format_ogg;  // "Og"
+    case 0x664C: return format_flac; // "fL", with the patch
+  }
+  return format_unknown;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Decode the sample rate of an Audio information snapshot.
+ *
+ * \param[in] info as from getAudioInfo(audio_info_t*).
+ *
+ * \return samples per second, being bits 15:1 of SCI_AUDATA times two.
+ */
+uint16_t SFEMP3Shield::audioSampleRate(const audio_info_t* info) {
+
+  return info->audata & 0xFFFE;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Decode the channels of an Audio information snapshot.
+ *
+ * \param[in] info as from getAudioInfo(audio_info_t*).
+ *
+ * \return 1 for mono or 2 for stereo, from bit 0 of SCI_AUDATA. Or 0 when
+ * nothing is being decoded.
+ */
+uint8_t SFEMP3Shield::audioChannels(const audio_info_t* info) {
+
+  if(!info->audata) return 0;
+  return (info->audata & 1) + 1;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read the Bit-Rate from the current track's filehandle.
+ *
+ * locate the MP3 header in the current file and from there determine the
+ * Bit-Rate, using bitrate_table located in flash. And return the position
+ * to the prior location.
+ *
+ * \note the bitrate will be updated, as read back from the VS10xx when needed.
+ *
+ * \warning This feature only works on MP3 files.
+ * It will \b LOCK-UP on other file formats, looking for the MP3 header.
+ */
+void SFEMP3Shield::getBitRateFromMP3File() {
+  //look for first MP3 frame (11 1's)
+  bitrate = 0;
+  uint8_t temp = 0;
+  uint8_t row_num =0;
+
+    for(uint16_t i = 0; i<65535; i++) {
+      if(track.read() == 0xFF) {
+
+        temp = track.read();
+
+        if(((temp & 0b11100000) == 0b11100000) && ((temp & 0b00000110) != 0b00000000)) {
+
+          //found the 11 1's
+          //parse version, layer and bitrate out and save bitrate
+          if(!(temp & 0b00001000)) { //!true if Version 1, !false version 2 and 2.5
+            row_num = 3;
+          }
+          else if((temp & 0b00000110) == 0b00000100) { //true if layer 2, false if layer 1 or 3
+            row_num += 1;
+          }
+          else if((temp & 0b00000110) == 0b00000010) { //true if layer 3, false if layer 2 or 1
+            row_num += 2;
+          } else {
+            continue; // Not found, need to skip the rest and continue looking.
+                      // \warning But this can lead to a dead end and file end of file.
+          }
+
+          //parse bitrate code from next byte
+          temp = track.read();
+          temp = temp>>4;
+
+          //lookup bitrate
+          bitrate = pgm_read_word_near ( &(bitrate_table[temp][row_num]) );
+
+          //convert kbps to Bytes per mS
+          bitrate /= 8;
+
+          //record file position
+          track.seekCur(-3);
+          start_of_music = track.curPosition();
+
+//          Serial.print(F("POS: "));
+//          Serial.println(start_of_music);
+
+//          Serial.print(F("Bitrate: "));
+//          Serial.println(bitrate);
+
+          //break out of for loop
+          break;
+
+        }
+      }
+    }
+  }
+
+//------------------------------------------------------------------------------
+/**
+ * \brief File position of a timecode in the current track
+ *
+ * \param[in] timecode milliseconds from the begining of the track.
+ *
+ * As per the format detected by playMP3() from the track's content. WAV is
+ * exact from its header, FLAC from its SEEKTABLE or else like Ogg Vorbis by
+ * bisection on the sample numbers of its frames or pages, and MP4 from its
+ * sample tables by way of the seek index. Otherwise constant rates are
+ * assumed, as read back from the VSdsp's para_byteRate. Before the VSdsp
+ * knows the rate of an MP3 file, that of its first frame is used.
+ *
+ * \return offset in bytes from the begining of the file.
+ */
+uint32_t SFEMP3Shield::seekOffset(uint32_t timecode) {
+  uint32_t rate = Mp3ReadWRAM(para_byteRate);
+
+  seek_reads = 0;
+  seek_block = 0xFFFFFFFF;
+  switch(track_format) {
+    case format_mp3:
+      if(!rate) rate = (uint32_t) bitrate * 1000; // bytes per ms, as bytes/s.
+      break;
+#if MP3_SEEK_WAV
+    case format_wav:
+      if(wav_align) {
+        // exactly, to the sample frame or ADPCM block, without overflow.
+        uint32_t offset = msToSamples(timecode, wav_byteRate);
+        if(offset > wav_size) offset = wav_size;
+        return start_of_music + offset - (offset % wav_align);
+      }
+      break;
+#endif
+#if MP3_SEEK_FLAC
+    case format_flac:
+      if(flac_points) return seekTable(msToSamples(timecode, seek_rate));
+      // without a SEEKTABLE, bisect on the frames' sample numbers.
+      // fall through
+    case format_ogg:
+      if(seek_rate) return seekBisect(msToSamples(timecode, seek_rate), start_of_music, 0, track.fileSize(), 0);
+      break;
+#endif
+#if MP3_SEEK_MP4
+    case format_aac:
+      if(seek_exact) return seekMp4(timecode);
+      break;
+#endif
+    default:
+      break;
+  }
+  return msToSamples(timecode, rate) + start_of_music;
+}
+
+#if MP3_SEEK_WAV
+//------------------------------------------------------------------------------
+/**
+ * \brief Parse the chunks of the current WAV track
+ *
+ * Walks the RIFF chunk list once, from the begining of the track, keeping the
+ * "fmt " chunk and the offset and size of the "data" chunk. Such that
+ * seekOffset() finds exact, block aligned, positions and primeWav() may
+ * rebuild the header.
+ *
+ * \return true if the track may be seeked exactly, with wav_align set.
+ */
+bool SFEMP3Shield::parseWav() {
+  uint8_t hdr[8];
+  uint32_t pos = 12; // following "RIFF", its size and "WAVE".
+
+  wav_fmt_size = 0;
+  for(uint8_t i = 0; i < 16; i++) {
+    if(!track.seekSet(pos) || (track.read(hdr, sizeof(hdr)) != sizeof(hdr))) break;
+    uint32_t size = getLittleEndian(&hdr[4], 4);
+
+    if(!memcmp(hdr, "fmt ", 4)) {
+      if((size < 16) || (size > WAV_FMT_SIZE) || (track.read(wav_fmt, size) != (int) size)) break;
+      wav_fmt_size = size;
+    }
+    else if(!memcmp(hdr, "data", 4)) {
+      if(!wav_fmt_size) break;
+      start_of_music = pos + sizeof(hdr);
+      wav_size = size;
+      if(wav_size > track.fileSize() - start_of_music) wav_size = track.fileSize() - start_of_music;
+      wav_byteRate = getLittleEndian(&wav_fmt[8], 4);
+      if(wav_byteRate) wav_align = getLittleEndian(&wav_fmt[12], 2);
+      break;
+    }
+    pos += sizeof(hdr) + size + (size & 1); // chunks are padded to words.
+  }
+  return wav_align;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Send a WAV header for the samples following an offset
+ *
+ * \param[in] offset of the samples of the current WAV track to be sent next.
+ *
+ * Following a cancel, the VSdsp needs a header before it may decode the
+ * samples from the middle of the "data" chunk. So one is rebuilt from the
+ * track's "fmt " chunk, with a "data" chunk of the bytes remaining. The new
+ * stream then starts cleanly, without muting.
+ */
+void SFEMP3Shield::primeWav(uint32_t offset) {
+  uint8_t hdr[28 + WAV_FMT_SIZE];
+  uint8_t* p = hdr;
+  uint32_t remaining = start_of_music + wav_size - offset;
+
+  memcpy(p, "RIFF", 4);
+  p = putLittleEndian(p + 4, 20 + wav_fmt_size + remaining, 4);
+  memcpy(p, "WAVEfmt ", 8);
+  p = putLittleEndian(p + 8, wav_fmt_size, 4);
+  memcpy(p, wav_fmt, wav_fmt_size);
+  p += wav_fmt_size;
+  memcpy(p, "data", 4);
+  p = putLittleEndian(p + 4, remaining, 4);
+
+  sendData(hdr, p - hdr);
+}
+#endif
+
+#if MP3_SEEK_FLAC
+//------------------------------------------------------------------------------
+/**
+ * \brief Parse the metadata blocks of the current FLAC track
+ *
+ * Walks the metadata blocks once, keeping the sample rate and any fixed block
+ * size from STREAMINFO, the position of the SEEKTABLE, and the offset of the
+ * first frame as start_of_music.
+ *
+ * \return true if the track may be seeked exactly.
+ */
+bool SFEMP3Shield::parseFlac() {
+  uint8_t hdr[18];
+  uint32_t pos = 4; // following "fLaC".
+
+  flac_points = 0;
+  for(uint8_t i = 0; i < 32; i++) {
+    if(!track.seekSet(pos) || (track.read(hdr, 4) != 4)) return false;
+    uint32_t size = ((uint32_t) hdr[1] << 16) | ((uint16_t) hdr[2] << 8) | hdr[3];
+    uint8_t type = hdr[0] & 0x7F;
+    bool last = hdr[0] & 0x80;
+
+    if(type == 0) { // STREAMINFO
+      if(track.read(hdr, sizeof(hdr)) != sizeof(hdr)) return false;
+      flac_block = (hdr[0] == hdr[2]) && (hdr[1] == hdr[3]) ? ((uint16_t) hdr[0] << 8) | hdr[1] : 0;
+      seek_rate = ((uint32_t) hdr[10] << 12) | ((uint16_t) hdr[11] << 4) | (hdr[12] >> 4);
+    }
+    else if(type == 3) { // SEEKTABLE
+      flac_table = pos + 4;
+      flac_points = size / 18;
+    }
+    pos += 4 + size;
+    if(last) {
+      start_of_music = pos;
+      return seek_rate;
+    }
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Parse the header pages of the current Ogg Vorbis track
+ *
+ * Keeps the sample rate of the identification header, and the offset of the
+ * first page of audio as start_of_music. As the Vorbis headers end their
+ * pages, these header pages are exactly what primeTrack() resends.
+ *
+ * \return true if the track may be seeked exactly.
+ */
+bool SFEMP3Shield::parseOgg() {
+  uint8_t hdr[48];
+  uint32_t pos = 0;
+
+  // the identification header, alone on the first page.
+  if(!track.seekSet(0) || (track.read(hdr, sizeof(hdr)) != sizeof(hdr))) return false;
+  uint8_t* id = &hdr[27 + hdr[26]];
+  if((hdr[26] != 1) || (id[0] != 1) || memcmp(&id[1], "vorbis", 6)) return false;
+  seek_rate = getLittleEndian(&id[12], 4);
+
+  for(uint8_t i = 0; i < 16; i++) {
+    if(!track.seekSet(pos) || (track.read(hdr, 27) != 27) || memcmp(hdr, "OggS", 4)) return false;
+    uint32_t granule_lo = getLittleEndian(&hdr[6], 4);
+    uint32_t granule_hi = getLittleEndian(&hdr[10], 4);
+    // -1 marks a page on which no packet ends, such as within a long header.
+    if((granule_lo || granule_hi) && ((granule_lo & granule_hi) != 0xFFFFFFFF)) {
+      start_of_music = pos; // the first page with a granule position.
+      return seek_rate;
+    }
+    uint8_t segments = hdr[26];
+    uint32_t size = 27 + segments;
+    while(segments) {
+      uint8_t n = (segments > sizeof(hdr)) ? sizeof(hdr) : segments;
+      if(track.read(hdr, n) != n) return false;
+      for(uint8_t j = 0; j < n; j++) size += hdr[j];
+      segments -= n;
+    }
+    pos += size;
+  }
+  return false;
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Re-prime the VSdsp for the current track from an offset
+ *
+ * \param[in] offset of the track, as from seekOffset(), to be played next.
+ * \param[in] timecode milliseconds of \p offset.
+ *
+ * Following a cancel, the VSdsp needs the headers of the track before its
+ * frames. For WAV a header is rebuilt with primeWav(). For FLAC "fLaC" and its
+ * STREAMINFO are resent, marked as the last metadata block. For Ogg Vorbis the
+ * header pages are played again, after which refill() jumps to \p offset. For
+ * MP4 the boxes ahead of the samples are played again, with a moov box that
+ * trails the mdat box jumped to first, such that the VSdsp has the sample
+ * tables before the samples, then refill() jumps to \p offset and stops at
+ * the end of the mdat box. SCI_DECODE_TIME is set to \p timecode.
+ */
+void SFEMP3Shield::primeTrack(uint32_t offset, uint32_t timecode) {
+  uint8_t hdr[42];
+
+  jump_count = 0;
+  jump_next = 0;
+  switch(track_format) {
+#if MP3_SEEK_WAV
+    case format_wav:
+      primeWav(offset);
+      break;
+#endif
+    case format_flac:
+      if(seekRead(0, hdr, sizeof(hdr)) == sizeof(hdr)) {
+        hdr[4] |= 0x80;
+        sendData(hdr, sizeof(hdr));
+      }
+      track.seekSet(offset);
+      break;
+#if MP3_SEEK_FLAC
+    case format_ogg:
+      track.seekSet(0);
+      queueJump(start_of_music, offset);
+      break;
+#endif
+#if MP3_SEEK_MP4
+    case format_aac:
+      track.seekSet(0);
+      if(mp4_moov > mp4_mdat) {
+        queueJump(mp4_mdat, mp4_moov);
+        queueJump(mp4_moov_end, mp4_mdat);
+      }
+      queueJump(start_of_music, offset);
+      queueJump(mp4_mdat_end, track.fileSize());
+      break;
+#endif
+  }
+  // written twice, as the VSdsp may otherwise overwrite it.
+  Mp3WriteRegister(SCI_DECODE_TIME, timecode / 1000);
+  Mp3WriteRegister(SCI_DECODE_TIME, timecode / 1000);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read from the current track for a seek
+ *
+ * \param[in] pos file position to be read.
+ * \param[out] buf the bytes read.
+ * \param[in] n bytes to be read.
+ *
+ * Counts the blocks of the SdCard read by the seek, into seek_reads.
+ *
+ * \return the bytes read.
+ */
+uint8_t SFEMP3Shield::seekRead(uint32_t pos, uint8_t* buf, uint8_t n) {
+
+  if(!track.seekSet(pos)) return 0;
+  for(uint32_t block = pos >> 9; block <= (pos + n - 1) >> 9; block++) {
+    if(block != seek_block) seek_reads++;
+    seek_block = block;
+  }
+  int got = track.read(buf, n);
+  return got > 0 ? got : 0;
+}
+
+#if MP3_SEEK_FLAC
+//------------------------------------------------------------------------------
+/**
+ * \brief Find a sample in the SEEKTABLE of the current FLAC track
+ *
+ * \param[in] sample to be seeked to.
+ *
+ * Bisects the seek points as read from the track, for the last point at or
+ * before \p sample and the one following. Placeholder points sort last and are
+ * never taken. Then seekBisect() finds the frame between them.
+ *
+ * \return file position of the frame of \p sample.
+ */
+uint32_t SFEMP3Shield::seekTable(uint32_t sample) {
+  uint8_t point[18];
+  uint16_t lo = 0;
+  uint16_t hi = flac_points;
+  uint32_t from = 0;
+  uint32_t from_n = 0;
+  uint32_t to = track.fileSize() - start_of_music;
+  uint32_t to_n = 0;
+
+  while(lo < hi) {
+    uint16_t mid = lo + (hi - lo) / 2;
+    if(seekRead(flac_table + mid * 18UL, point, sizeof(point)) != sizeof(point)) break;
+    // big endian 64 bit sample number and offset, of which the low words.
+    bool high = point[0] | point[1] | point[2] | point[3];
+    uint32_t number = getBigEndian(&point[4], 4);
+    uint32_t offset = getBigEndian(&point[12], 4);
+    if(high || (number > sample)) {
+      if(!high) {
+        to = offset;
+        to_n = number;
+      }
+      hi = mid;
+    } else {
+      from = offset;
+      from_n = number;
+      lo = mid + 1;
+    }
+  }
+  return seekBisect(sample, start_of_music + from, from_n, start_of_music + to, to_n);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Search the current FLAC or Ogg track for a sample
+ *
+ * \param[in] sample to be seeked to.
+ * \param[in] lo file position of a frame or page at or before \p sample.
+ * \param[in] lo_n first sample of the frame, or granule position of the page, at \p lo.
+ * \param[in] hi file position of a frame or page after \p sample, or the end.
+ * \param[in] hi_n sample number at \p hi, or zero if not known.
+ *
+ * Probes between \p lo and \p hi, interpolating on the sample numbers once
+ * both are known and otherwise halving, finding the first frame or page of
+ * each probe with seekSync(). Until the frame holding \p sample is found, or
+ * the page before the one holding it, with at most SEEK_BISECT_STEPS probes.
+ * A probe that finds nothing within SEEK_SCAN_BYTES, short of the range, is
+ * followed by one from where it stopped, as a long frame or page may span it.
+ *
+ * \return file position of the frame or page.
+ */
+uint32_t SFEMP3Shield::seekBisect(uint32_t sample, uint32_t lo, uint32_t lo_n, uint32_t hi, uint32_t hi_n) {
+  uint32_t top = hi; // no frames between it and hi.
+  uint32_t next = 0; // where a probe that found nothing stopped short of top.
+  uint32_t span = 0;
+  uint32_t number;
+  uint32_t length;
+
+  // the length of the frame or page at lo, which may already be past the sample.
+  if(seekSync(lo, hi, &number, &length) == lo) {
+    if(number > sample) return lo;
+    span = length;
+  }
+
+  for(uint8_t i = 0; i < SEEK_BISECT_STEPS; i++) {
+    // done when the frame at lo holds the sample, or the page after lo does.
+    if((track_format == format_flac) ? (sample < lo_n + span) : (lo + span >= top)) break;
+    if(top - lo < 2) break;
+
+    uint32_t mid = lo + (top - lo) / 2;
+    if(hi_n > lo_n) {
+      // aim a frame early, as the first frame following the probe is found.
+      uint32_t aim = (track_format == format_flac) && (sample - lo_n > span) ? sample - span : sample;
+      uint32_t guess = lo + (uint32_t) ((float) (hi - lo) * (aim - lo_n) / (hi_n - lo_n));
+      // else halving, should the guess not narrow the range enough.
+      if((guess > lo) && (guess < top - (top - lo) / 8)) mid = guess;
+    }
+    if(next > lo) mid = next; // on past the window already scanned.
+    next = 0;
+
+    uint32_t pos = seekSync(mid, top, &number, &length);
+    if(!pos) {
+      // only what was scanned is known to be without frames.
+      if(top - mid > SEEK_SCAN_BYTES) {
+        next = mid + SEEK_SCAN_BYTES;
+      } else {
+        top = mid;
+      }
+    } else if(number <= sample) {
+      lo = pos;
+      lo_n = number;
+      span = length;
+    } else {
+      // the first following mid is already past the sample.
+      top = mid;
+      hi = pos;
+      hi_n = number;
+    }
+  }
+  return lo;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Find the next FLAC frame or Ogg page
+ *
+ * \param[in] pos file position from which to scan.
+ * \param[in] end file position before which the frame or page must start.
+ * \param[out] number first sample of the FLAC frame, or granule position of
+ * the Ogg page.
+ * \param[out] length samples of the FLAC frame, or bytes of the Ogg page.
+ *
+ * Scans at most SEEK_SCAN_BYTES. Ogg pages on which no packet ends are
+ * passed over, as they have no granule position.
+ *
+ * \return file position of the frame or page, or zero if none.
+ */
+uint32_t SFEMP3Shield::seekSync(uint32_t pos, uint32_t end, uint32_t* number, uint32_t* length) {
+  uint8_t buf[64];
+  uint32_t limit = (end - pos > SEEK_SCAN_BYTES) ? pos + SEEK_SCAN_BYTES : end;
+
+  while(pos < limit) {
+    uint8_t n = seekRead(pos, buf, sizeof(buf));
+    if(n < 28) break;
+    for(uint8_t i = 0; (i + 28 <= n) && (pos + i < limit); i++) {
+      if(track_format == format_flac) {
+        if(flacFrameNumber(&buf[i], n - i, flac_block, number, length)) return pos + i;
+      }
+      else if(!memcmp(&buf[i], "OggS", 4) && !buf[i + 4]
+              && ((*number = getLittleEndian(&buf[i + 6], 4)) != 0xFFFFFFFF)) {
+        // the page's length, from its segment table.
+        uint8_t segments = buf[i + 26];
+        uint32_t page = pos + i;
+        *length = 27 + segments;
+        for(uint32_t at = page + 27; segments; ) {
+          uint8_t m = seekRead(at, buf, (segments > sizeof(buf)) ? sizeof(buf) : segments);
+          if(!m) return 0;
+          for(uint8_t j = 0; j < m; j++) *length += buf[j];
+          segments -= m;
+          at += m;
+        }
+        return page;
+      }
+    }
+    pos += n - 27; // overlapping, for a header across reads.
+  }
+  return 0;
+}
+#endif
+
+#if MP3_SEEK_MP4
+//------------------------------------------------------------------------------
+/**
+ * \brief Parse the boxes of the current MP4 track
+ *
+ * Finds the top level moov and mdat boxes, and within the moov the sample
+ * tables of the first sound track. Then walks its chunks once, keeping the
+ * first sample and offset of every seek_stride'th chunk in seek_index, such
+ * that the index spans the track within MP3_SEEK_INDEX_SIZE points.
+ *
+ * \return true if the track may be seeked exactly.
+ */
+bool SFEMP3Shield::parseMp4() {
+  uint8_t hdr[24];
+  uint32_t end = track.fileSize();
+  uint32_t box;
+  uint32_t size;
+  uint32_t moov_size;
+  uint32_t stbl = 0;
+  uint32_t stbl_size;
+
+  seek_points = 0;
+  uint32_t moov = findBox(0, end, "moov", &mp4_moov, &moov_size);
+  uint32_t mdat = findBox(0, end, "mdat", &mp4_mdat, &size);
+  if(!moov || !mdat) return false;
+  mp4_moov_end = moov + moov_size;
+  mp4_mdat_end = mdat + size;
+
+  // the first track whose handler is of sound, and its timescale.
+  for(uint32_t pos = moov; !stbl; ) {
+    uint32_t trak_size;
+    uint32_t mdia_size;
+    uint32_t minf_size;
+    uint32_t trak = findBox(pos, mp4_moov_end, "trak", &box, &trak_size);
+    if(!trak) return false;
+    pos = trak + trak_size;
+
+    uint32_t mdia = findBox(trak, trak + trak_size, "mdia", &box, &mdia_size);
+    if(!mdia) continue;
+    uint32_t hdlr = findBox(mdia, mdia + mdia_size, "hdlr", &box, &size);
+    if(!hdlr || (seekRead(hdlr + 8, hdr, 4) != 4) || memcmp(hdr, "soun", 4)) continue;
+    uint32_t mdhd = findBox(mdia, mdia + mdia_size, "mdhd", &box, &size);
+    if(!mdhd || (seekRead(mdhd, hdr, sizeof(hdr)) != sizeof(hdr))) return false;
+    seek_rate = getBigEndian(&hdr[hdr[0] ? 20 : 12], 4); // following 64 bit times, if version 1.
+    uint32_t minf = findBox(mdia, mdia + mdia_size, "minf", &box, &minf_size);
+    if(minf) stbl = findBox(minf, minf + minf_size, "stbl", &box, &stbl_size);
+  }
+
+  // the sample tables, each following the box's version and flags.
+  uint32_t stts = findBox(stbl, stbl + stbl_size, "stts", &box, &size);
+  uint32_t stsc = findBox(stbl, stbl + stbl_size, "stsc", &box, &size);
+  uint32_t stsz = findBox(stbl, stbl + stbl_size, "stsz", &box, &size);
+  uint32_t stco = findBox(stbl, stbl + stbl_size, "stco", &box, &size);
+  mp4_stco_size = 4;
+  if(!stco) {
+    stco = findBox(stbl, stbl + stbl_size, "co64", &box, &size);
+    mp4_stco_size = 8;
+  }
+  if(!stts || !stsc || !stsz || !stco || !seek_rate) return false;
+  if((seekRead(stts + 4, hdr, 4) != 4)) return false;
+  mp4_stts_count = getBigEndian(hdr, 4);
+  mp4_stts = stts + 8;
+  if((seekRead(stsc + 4, hdr, 4) != 4)) return false;
+  mp4_stsc_count = getBigEndian(hdr, 4);
+  mp4_stsc = stsc + 8;
+  if((seekRead(stsz + 4, hdr, 4) != 4)) return false;
+  mp4_sample_size = getBigEndian(hdr, 4);
+  mp4_stsz = stsz + 12;
+  if((seekRead(stco + 4, hdr, 4) != 4)) return false;
+  mp4_chunks = getBigEndian(hdr, 4);
+  mp4_stco = stco + 8;
+  if(!mp4_chunks || !mp4_stsc_count) return false;
+
+  // every seek_stride'th chunk, counting the samples per chunk of "stsc".
+  seek_stride = (mp4_chunks + MP3_SEEK_INDEX_SIZE - 1) / MP3_SEEK_INDEX_SIZE;
+  uint32_t sample = 0;
+  uint32_t per = 0;
+  uint32_t next = 1; // first chunk of the "stsc" entry to be read.
+  uint32_t entry = 0;
+  for(uint32_t chunk = 1; chunk <= mp4_chunks; chunk++) {
+    while((entry < mp4_stsc_count) && (chunk >= next)) {
+      if(seekRead(mp4_stsc + entry * 12 + 4, hdr, 12) < 4) return false;
+      per = getBigEndian(hdr, 4);
+      next = (++entry < mp4_stsc_count) ? getBigEndian(&hdr[8], 4) : 0xFFFFFFFF;
+    }
+    if(!((chunk - 1) % seek_stride)) {
+      seek_index[seek_points].sample = sample;
+      seek_index[seek_points++].offset = chunkOffset(chunk);
+    }
+    sample += per;
+  }
+  start_of_music = mdat;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Find a box of the current MP4 track
+ *
+ * \param[in] pos file position of the first box to be inspected.
+ * \param[in] end file position following the last box, as of its parent.
+ * \param[in] type four character code of the box.
+ * \param[out] box file position of the box found.
+ * \param[out] size bytes of the box found, following its header.
+ *
+ * Walks the boxes of one level, from \p pos. A box sized past \p end, as of
+ * a truncated file, is taken to end there.
+ *
+ * \return file position of the contents of the box, or zero if not found.
+ */
+uint32_t SFEMP3Shield::findBox(uint32_t pos, uint32_t end, const char* type, uint32_t* box, uint32_t* size) {
+  uint8_t hdr[16];
+
+  for(uint8_t i = 0; (i < 64) && (pos < end) && (end - pos >= 8); i++) {
+    uint8_t n = seekRead(pos, hdr, (end - pos < sizeof(hdr)) ? end - pos : sizeof(hdr));
+    if(n < 8) break;
+    uint32_t length = getBigEndian(hdr, 4);
+    uint8_t head = 8;
+    if(length == 1) {
+      // a 64 bit size, of which the low word, as FAT files are 32 bit.
+      if((n < 16) || getBigEndian(&hdr[8], 4)) break;
+      length = getBigEndian(&hdr[12], 4);
+      head = 16;
+    }
+    else if(!length) {
+      length = end - pos; // to the end of the file.
+    }
+    if(length < head) break;
+    if(length > end - pos) length = end - pos;
+
+    if(!memcmp(&hdr[4], type, 4)) {
+      *box = pos;
+      *size = length - head;
+      return pos + head;
+    }
+    pos += length;
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief File position of a timecode in the current MP4 track
+ *
+ * \param[in] timecode milliseconds from the begining of the track.
+ *
+ * Finds the sample of \p timecode from the durations of "stts", then the
+ * last point of seek_index at or before it. From the point's chunk, walks at
+ * most seek_stride chunks to the one holding the sample, and then its sizes
+ * of "stsz" to the sample itself.
+ *
+ * \return file position of the sample, the last if past the end.
+ */
+uint32_t SFEMP3Shield::seekMp4(uint32_t timecode) {
+  uint8_t entry[8];
+  uint32_t time = msToSamples(timecode, seek_rate);
+  uint32_t target = 0;
+
+  // runs of samples of the same duration.
+  for(uint32_t i = 0; i < mp4_stts_count; i++) {
+    if(seekRead(mp4_stts + i * 8, entry, sizeof(entry)) != sizeof(entry)) break;
+    uint32_t count = getBigEndian(entry, 4);
+    uint32_t delta = getBigEndian(&entry[4], 4);
+    if(!delta || (time / delta < count)) {
+      if(delta) target += time / delta;
+      break;
+    }
+    target += count;
+    time -= count * delta;
+  }
+
+  uint16_t lo = 0;
+  uint16_t hi = seek_points;
+  while(hi - lo > 1) {
+    uint16_t mid = lo + (hi - lo) / 2;
+    if(seek_index[mid].sample <= target) lo = mid;
+    else hi = mid;
+  }
+  uint32_t chunk = lo * seek_stride + 1;
+  uint32_t sample = seek_index[lo].sample;
+  uint32_t offset = seek_index[lo].offset;
+  uint32_t per = chunkSamples(chunk);
+
+  // on to the chunk holding the target, short of the next point.
+  for(uint32_t i = 1; (i < seek_stride) && (chunk < mp4_chunks) && (sample + per <= target); i++) {
+    sample += per;
+    per = chunkSamples(++chunk);
+  }
+  if(chunk != lo * seek_stride + 1) offset = chunkOffset(chunk);
+  if(!per) return offset;
+  if(target - sample >= per) target = sample + per - 1; // past the end.
+
+  // past the samples ahead of it in the chunk.
+  if(mp4_sample_size) return offset + (target - sample) * mp4_sample_size;
+  for(; sample < target; sample++) {
+    if(seekRead(mp4_stsz + sample * 4, entry, 4) != 4) break;
+    offset += getBigEndian(entry, 4);
+  }
+  return offset;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Samples of a chunk of the current MP4 track
+ *
+ * \param[in] chunk number, from 1.
+ *
+ * Bisects the "stsc" entries, for the last whose first chunk is at or before
+ * \p chunk.
+ *
+ * \return the samples of the chunk.
+ */
+uint32_t SFEMP3Shield::chunkSamples(uint32_t chunk) {
+  uint8_t entry[8];
+  uint32_t lo = 0;
+  uint32_t hi = mp4_stsc_count;
+  uint32_t per = 0;
+
+  while(lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if(seekRead(mp4_stsc + mid * 12, entry, sizeof(entry)) != sizeof(entry)) break;
+    if(getBigEndian(entry, 4) <= chunk) {
+      per = getBigEndian(&entry[4], 4);
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return per;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief File position of a chunk of the current MP4 track
+ *
+ * \param[in] chunk number, from 1.
+ *
+ * \return the offset of "stco", or the low word of that of "co64".
+ */
+uint32_t SFEMP3Shield::chunkOffset(uint32_t chunk) {
+  uint8_t entry[8];
+
+  if(seekRead(mp4_stco + (chunk - 1) * mp4_stco_size, entry, mp4_stco_size) != mp4_stco_size)
+    return start_of_music;
+  return getBigEndian(&entry[mp4_stco_size - 4], 4);
+}
+#endif
+
+#if TRACK_JUMPS
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue a jump of the track for refill()
+ *
+ * \param[in] from file position at which to jump, once the track reaches it.
+ * \param[in] to file position to which to jump.
+ *
+ * The jumps are taken in the order queued, up to TRACK_JUMPS. A jump to where
+ * it is from is not queued.
+ */
+void SFEMP3Shield::queueJump(uint32_t from, uint32_t to) {
+
+  if((from != to) && (jump_count < TRACK_JUMPS)) {
+    jump_from[jump_count] = from;
+    jump_to[jump_count++] = to;
+  }
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Format of the current track
+ *
+ * As detected from the first bytes of the file by playMP3(), rather than from
+ * its filename.
+ *
+ * \return one of audio_format_m, format_unknown if not recognized.
+ */
+uint8_t SFEMP3Shield::getTrackFormat() {
+
+  return track_format;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Block reads of the last seek
+ *
+ * The blocks of the SdCard read in finding the file position of the last
+ * skip(), skipTo() or resumeMusic(uint32_t). For FLAC and Ogg tracks, as
+ * their SEEKTABLE or pages are searched, bounded by SEEK_BISECT_STEPS. For
+ * MP4 tracks, as the sample tables are walked from the seek index.
+ *
+ * \return the number of blocks read, zero for the other formats.
+ */
+uint16_t SFEMP3Shield::getSeekReads() {
+
+  return seek_reads;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief get the status of the VSdsp VU Meter
+ *
+ * \return responds with the current value of the SS_VU_ENABLE bit of the
+ * SCI_STATUS register indicating if the VU meter is enabled.
+ *
+ * See data patches data sheet VU meter for details.
+ * \warning This feature is only available with patches that support VU meter.
+ */
+int8_t SFEMP3Shield::getVUmeter() {
+  if(Mp3ReadRegister(SCI_STATUS) & SS_VU_ENABLE) {
+    return 1;
+  }
+  return 0;
+ }
+
+//------------------------------------------------------------------------------
+/**
+ * \brief enable VSdsp VU Meter
+ *
+ * \param[in] enable when set will enable the VU meter
+ *
+ * Writes the SS_VU_ENABLE bit of the SCI_STATUS register to enable VU meter on
+ * board to the VSdsp.
+ *
+ * See data patches data sheet VU meter for details.
+ * \warning This feature is only available with patches that support VU meter.
+ * \n The VU meter takes about 0.2MHz of processing power with 48 kHz samplerate.
+ */
+int8_t SFEMP3Shield::setVUmeter(int8_t enable) {
+  uint16_t MP3Status = Mp3ReadRegister(SCI_STATUS);
+
+  if(enable) {
+    Mp3WriteRegister(SCI_STATUS, MP3Status | SS_VU_ENABLE);
+  } else {
+    Mp3WriteRegister(SCI_STATUS, MP3Status & ~SS_VU_ENABLE);
+  }
+  return 1; // in future return if not available, if patch not applied.
+ }
+
+//------------------------------------------------------------------------------
+/**
+ * \brief get current measured VU Meter
+ *
+ * Returns the calculated peak sample values from both channels in 3 dB
+ * increaments through. Where the high byte represent the left channel,
+ * and the low bytes the right channel.
+ *
+ * Values from 0 to 31 are valid for both channels.
+ *
+ * \warning This feature is only available with patches that support VU meter.
+ */
+int16_t SFEMP3Shield::getVUlevel() {
+  return Mp3ReadRegister(SCI_AICTRL3);
+}
+
+// @}
+// Audio_Information_Group
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// Track_Index_Group
+
+#if MP3_TRACK_INDEX
+/**
+ * \brief Header of the on-card music library index
+ *
+ * Occupies the first record slot of MP3_INDEX_FILENAME, such that the
+ * following track_index_t records remain aligned to the SdCard's blocks.
+ */
+struct track_index_header_t {
+  char     magic[4];
+  uint16_t version;
+  uint16_t recordSize;
+  uint16_t count;
+  uint16_t reserved;
+  uint32_t dirCluster;
+};
+
+/**
+ * \brief Signature found at the start of a valid MP3_INDEX_FILENAME
+ */
+static const char track_index_magic[4] = {'S', 'F', 'E', 'I'};
+
+/**
+ * \brief Layout version of MP3_INDEX_FILENAME, to be bumped with any change of track_index_t
+ */
+#define TRACK_INDEX_VERSION 1
+
+/**
+ * \brief How far past the ID3v2 tag to search for the first MP3 frame header.
+ */
+#define TRACK_INDEX_SYNC_SEARCH 4096
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read and validate the header of the index
+ *
+ * \param[in] file the opened index file.
+ * \param[out] hdr header to be filled in.
+ *
+ * \return true if the header is of the current version and record size.
+ */
+static bool readIndexHeader(SdFile* file, track_index_header_t* hdr) {
+  if(!file->seekSet(0)) return false;
+  if(file->read(hdr, sizeof(track_index_header_t)) != sizeof(track_index_header_t)) return false;
+  return (memcmp(hdr->magic, track_index_magic, sizeof(track_index_magic)) == 0)
+      && (hdr->version == TRACK_INDEX_VERSION)
+      && (hdr->recordSize == sizeof(track_index_t));
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read a record of the index
+ *
+ * \param[in] file the opened index file.
+ * \param[in] number of the record, where the header is not counted.
+ * \param[out] rec record to be filled in.
+ *
+ * \return true on success.
+ */
+static bool readIndexRecord(SdFile* file, uint16_t number, track_index_t* rec) {
+  if(!file->seekSet(((uint32_t) number + 1) * sizeof(track_index_t))) return false;
+  return file->read(rec, sizeof(track_index_t)) == sizeof(track_index_t);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write a record of the index
+ *
+ * \param[in] file the opened index file.
+ * \param[in] number of the record, where the header is not counted.
+ * \param[in] rec record to be written.
+ *
+ * \note The file can not be seeked past its end, so a new record must follow
+ * the last, at the end of the file.
+ *
+ * \return true on success.
+ */
+static bool writeIndexRecord(SdFile* file, uint16_t number, const track_index_t* rec) {
+  if(!file->seekSet(((uint32_t) number + 1) * sizeof(track_index_t))) return false;
+  return file->write(rec, sizeof(track_index_t)) == sizeof(track_index_t);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Order of two records of the index
+ *
+ * \param[in] name of the first record.
+ * \param[in] dirIndex of the first record.
+ * \param[in] rec the second record.
+ *
+ * By name ignoring case, where long names may be cut to the same leading
+ * characters, then by the index of the directory entry.
+ *
+ * \return less than, equal to or greater than zero, as the first record sorts
+ * before, with or after \p rec.
+ */
+static int compareIndex(const char* name, uint16_t dirIndex, const track_index_t* rec) {
+  int cmp = strcasecmp(name, rec->name);
+
+  if(cmp) return cmp;
+  return (dirIndex > rec->dirIndex) - (dirIndex < rec->dirIndex);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Binary search the sorted index by name
+ *
+ * \param[in] file the opened index file.
+ * \param[in] count number of records in the index.
+ * \param[in] key name to be found, ignoring case.
+ * \param[in] prefix when true only the leading strlen(key) characters must match.
+ * \param[out] rec record to be filled in with the first match.
+ *
+ * \return number of the first matching record, or -1 if none matched.
+ */
+static int32_t searchIndex(SdFile* file, uint16_t count, const char* key, bool prefix, track_index_t* rec) {
+  size_t len = strlen(key);
+  uint16_t lo = 0;
+  uint16_t hi = count;
+
+  // find the lowest record not sorted before the key.
+  while(lo < hi) {
+    uint16_t mid = lo + ((hi - lo) >> 1);
+    if(!readIndexRecord(file, mid, rec)) return -1;
+    int cmp = prefix ? strncasecmp(rec->name, key, len) : strcasecmp(rec->name, key);
+    if(cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if((lo >= count) || !readIndexRecord(file, lo, rec)) return -1;
+  if((prefix ? strncasecmp(rec->name, key, len) : strcasecmp(rec->name, key)) != 0) return -1;
+  return lo;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Find the prior record of a file in the sorted index
+ *
+ * \param[in] file the opened index file.
+ * \param[in] count number of records in the index.
+ * \param[in] rec record of the file, whose name, dirIndex and firstCluster are set.
+ * \param[out] old record to be filled in with the match.
+ *
+ * The search by name only narrows down the records, as long names may share
+ * their leading characters. A match must be of the same directory entry and
+ * first cluster.
+ *
+ * \return true if found.
+ */
+static bool findIndexRecord(SdFile* file, uint16_t count, const track_index_t* rec, track_index_t* old) {
+  int32_t number = searchIndex(file, count, rec->name, false, old);
+
+  if(number < 0) return false;
+  while((old->dirIndex != rec->dirIndex) || (old->firstCluster != rec->firstCluster)) {
+    if((++number >= count) || !readIndexRecord(file, number, old)
+       || strcasecmp(old->name, rec->name)) return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Sift a record down into the heap of the index
+ *
+ * \param[in] file the opened index file.
+ * \param[in] root number of the record to be sifted down.
+ * \param[in] count number of records in the heap.
+ * \param[in] a scratch record, holding the record being sifted.
+ * \param[in] b scratch record, holding the larger child.
+ *
+ * \return true on success.
+ */
+static bool siftIndex(SdFile* file, uint16_t root, uint16_t count, track_index_t* a, track_index_t* b) {
+  char name[sizeof(a->name)];
+  uint16_t dirIndex;
+
+  if(!readIndexRecord(file, root, a)) return false;
+  for(uint32_t child = 2 * (uint32_t) root + 1; child < count; child = 2 * (uint32_t) root + 1) {
+    if(!readIndexRecord(file, child, b)) return false;
+    // only the sort key of the sibling is needed to pick the larger of the two.
+    if(child + 1 < count) {
+      uint32_t pos = (child + 2) * sizeof(track_index_t);
+      if(!file->seekSet(pos) || (file->read(name, sizeof(name)) != sizeof(name))) return false;
+      if(!file->seekSet(pos + offsetof(track_index_t, dirIndex))
+         || (file->read(&dirIndex, sizeof(dirIndex)) != sizeof(dirIndex))) return false;
+      if(compareIndex(name, dirIndex, b) > 0) {
+        child++;
+        if(!readIndexRecord(file, child, b)) return false;
+      }
+    }
+    if(compareIndex(a->name, a->dirIndex, b) >= 0) break;
+    if(!writeIndexRecord(file, root, b)) return false;
+    root = child;
+  }
+  return writeIndexRecord(file, root, a);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Sort the records of the index by name, in place on the SdCard
+ *
+ * \param[in] file the opened index file.
+ * \param[in] count number of records in the index.
+ *
+ * A heap sort is used, as it needs only two records of RAM regardless of the
+ * number of tracks. Which costs about 2 * log2(count) record reads and writes
+ * per track, each through the block cache, so O(n log n) I/O of the SdCard.
+ *
+ * \return true on success.
+ */
+static bool sortIndex(SdFile* file, uint16_t count) {
+  track_index_t a;
+  track_index_t b;
+
+  if(count < 2) return true;
+  for(uint16_t start = count / 2; start > 0; start--) {
+    if(!siftIndex(file, start - 1, count, &a, &b)) return false;
+  }
+  for(uint16_t end = count - 1; end > 0; end--) {
+    // move the largest remaining name behind the heap.
+    if(!readIndexRecord(file, 0, &a)) return false;
+    if(!readIndexRecord(file, end, &b)) return false;
+    if(!writeIndexRecord(file, end, &a)) return false;
+    if(!writeIndexRecord(file, 0, &b)) return false;
+    if(!siftIndex(file, 0, end, &a, &b)) return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Bit-rate from an MP3 frame header
+ *
+ * \param[in] hdr1 second byte of the frame header, following the 0xFF.
+ * \param[in] hdr2 third byte of the frame header.
+ *
+ * \return bit-rate in kbits per second, or zero if not a valid frame header.
+ */
+static uint16_t mp3FrameBitRate(uint8_t hdr1, uint8_t hdr2) {
+  uint8_t layer = (hdr1 >> 1) & 0b11;
+  uint8_t row = hdr2 >> 4;
+  uint8_t column;
+
+  // remaining sync bits, reserved layer and free or bad bit-rates.
+  if(((hdr1 & 0b11100000) != 0b11100000) || (layer == 0) || (row == 0) || (row == 15)) return 0;
+  if(hdr1 & 0b00001000) {
+    column = 3 - layer; // MPEG Version 1
+  } else {
+    column = (layer == 3) ? 3 : 4; // MPEG Version 2 and 2.5
+  }
+  return pgm_read_word_near(&(bitrate_table[row][column]));
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Copy an ID3v1 field and trim its padding
+ *
+ * \param[out] dest zero terminated result, at least len + 1 in size.
+ * \param[in] src field of the tag.
+ * \param[in] len size of the field.
+ */
+static void copyTagField(char* dest, const char* src, uint8_t len) {
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+  while(len && ((dest[len - 1] == ' ') || (dest[len - 1] == '\0'))) {
+    dest[--len] = '\0';
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Fill in the tag and rate fields of an index record
+ *
+ * \param[in] file the opened audio file.
+ * \param[in,out] rec record, whose name, format and fileSize are already set.
+ *
+ * The format named by the file's extension is corrected by that of its
+ * content, where recognized. For MP3 the bit-rate is found from the first
+ * frame after any ID3v2 tag, and from it the duration. For WAV the duration
+ * is from the byte rate of its "fmt " chunk. The title and artist are taken
+ * from the ID3v1 tag, if present.
+ */
+static void probeIndexRecord(SdFile* file, track_index_t* rec) {
+  char tag[TRACK_ARTIST + 30];
+  uint8_t hdr[32];
+  uint32_t start = 0;
+
+  rec->title[0] = '\0';
+  rec->artist[0] = '\0';
+  rec->bitrate = 0;
+  rec->duration = 0;
+
+  if(file->read(hdr, sizeof(hdr)) == sizeof(hdr)) {
+    uint8_t format = formatFromContent(hdr);
+    if(format != format_unknown) rec->format = format;
+  } else {
+    memset(hdr, 0, sizeof(hdr));
+  }
+
+  if((rec->format == format_wav) && !memcmp(&hdr[12], "fmt ", 4)) {
+    uint32_t byteRate = getLittleEndian(&hdr[28], 4);
+    // the canonical header is 44 bytes, from "RIFF" thru the "data" chunk's.
+    if(byteRate && (rec->fileSize > 44)) {
+      rec->bitrate = (byteRate * 8 + 500) / 1000;
+      uint32_t size = rec->fileSize - 44;
+      rec->duration = (size / byteRate) * 1000 + ((size % byteRate) * 1000) / byteRate;
+    }
+  }
+
+  if(rec->format == format_mp3) {
+    // skip over an ID3v2 tag, whose size is syncsafe and excludes its header.
+    if(!memcmp(hdr, "ID3", 3)) {
+      start = 10 + (((uint32_t) (hdr[6] & 0x7F) << 21)
+                  | ((uint32_t) (hdr[7] & 0x7F) << 14)
+                  | ((uint32_t) (hdr[8] & 0x7F) << 7)
+                  |  (uint32_t) (hdr[9] & 0x7F));
+    }
+    if(file->seekSet(start)) {
+      int16_t prev = 0;
+      for(uint16_t i = 0; i < TRACK_INDEX_SYNC_SEARCH; i++) {
+        int16_t c = file->read();
+        if(c < 0) break;
+        if(prev == 0xFF) {
+          int16_t next = file->read();
+          if(next < 0) break;
+          rec->bitrate = mp3FrameBitRate(c, next);
+          if(rec->bitrate) break;
+          c = next;
+        }
+        prev = c;
+      }
+    }
+    if(rec->bitrate && (rec->fileSize > start)) {
+      // kbits per second is the same as bits per millisecond.
+      rec->duration = ((rec->fileSize - start) / rec->bitrate) * 8;
+    }
+  }
+
+  if((rec->fileSize >= 128) && file->seekSet(rec->fileSize - 128)
+     && (file->read(tag, sizeof(tag)) == sizeof(tag)) && !memcmp(tag, "TAG", 3)) {
+    copyTagField(rec->title, &tag[TRACK_TITLE], 30);
+    copyTagField(rec->artist, &tag[TRACK_ARTIST], 30);
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Open the index of the current working directory
+ *
+ * Keeps the index file open across queries, while it still describes the
+ * current working directory. Without MP3_INDEX_FILENAME, MP3_INDEX_TMPNAME is
+ * opened instead, as left by a power loss while buildTrackIndex() replaced
+ * the prior index. It is complete if its header is valid, as the header is
+ * written last.
+ *
+ * \return true if a valid index of the current working directory is open.
+ */
+bool SFEMP3Shield::openTrackIndex() {
+  track_index_header_t hdr;
+  FatFile* dir = sd.vwd();
+
+  if(index_file.isOpen()) {
+    if(index_dir == dir->firstCluster()) return true;
+    index_file.close();
+  }
+  if(!index_file.open(dir, MP3_INDEX_FILENAME, O_READ)
+     && !index_file.open(dir, MP3_INDEX_TMPNAME, O_READ)) return false;
+  if(!readIndexHeader(&index_file, &hdr) || (hdr.dirCluster != dir->firstCluster())) {
+    index_file.close();
+    return false;
+  }
+  index_count = hdr.count;
+  index_dir = hdr.dirCluster;
+  return true;
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Build the index of the audio files in the current working directory
+ *
+ * Scans the current working directory for files of the extensions the VS10xx
+ * may decode, writing a track_index_t for each into MP3_INDEX_FILENAME, sorted
+ * by name. Where a prior index exists, the records of files whose size and
+ * modify date and time have not changed are carried over, such that only new
+ * or changed files need to be opened and probed for their ID3 tags and
+ * bit-rate.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * The format of each file is found from its short filename, whose extension
+ * is kept, as the long filename of the record may be cut short. Files are
+ * matched to their prior records by their directory entry and first cluster.
+ *
+ * \warning This may take several seconds on large directories and can not be
+ * called while playing. The sort takes O(n log n) record reads and writes of
+ * the SdCard, see sortIndex().
+ *
+ * \note Requires MP3_TRACK_INDEX, otherwise returns 2.
+ */
+uint8_t SFEMP3Shield::buildTrackIndex() {
+#if MP3_TRACK_INDEX
+  track_index_header_t hdr;
+  track_index_t rec;
+  track_index_t old;
+  SdFile tmp;
+  SdFile file;
+  FatFile scan;
+  dir_t entry;
+  char sfn[13];
+  FatFile* dir = sd.vwd();
+  uint16_t oldCount = 0;
+  uint16_t count = 0;
+
+  if(isPlaying()) return 1;
+
+  // finish a replacement of the index cut short, see openTrackIndex().
+  index_file.close();
+  if(!dir->exists(MP3_INDEX_FILENAME) && tmp.open(dir, MP3_INDEX_TMPNAME, O_RDWR)) {
+    if(readIndexHeader(&tmp, &hdr)) tmp.rename(dir, MP3_INDEX_FILENAME);
+    tmp.close();
+  }
+
+  // the prior index, if any, is used to skip probing unchanged files.
+  if(openTrackIndex()) {
+    oldCount = index_count;
+  }
+
+  if(!tmp.open(dir, MP3_INDEX_TMPNAME, O_CREAT | O_TRUNC | O_RDWR)) return 2;
+
+  // a placeholder for the header, such that the records are appended in turn.
+  memset(&rec, 0, sizeof(rec));
+  if(tmp.write(&rec, sizeof(rec)) != sizeof(rec)) {
+    tmp.remove();
+    return 2;
+  }
+
+  // scanned by a handle of its own, leaving the sketch's position as it is.
+  if(!scan.openDir(dir)) {
+    tmp.remove();
+    return 2;
+  }
+  while(file.openNext(&scan, O_READ)) {
+    if(file.isFile() && file.getSFN(sfn)
+       && ((rec.format = formatFromFilename(sfn)) != format_unknown)
+       && file.getName(rec.name, sizeof(rec.name)) && file.dirEntry(&entry)) {
+      rec.firstCluster = file.firstCluster();
+      rec.fileSize = file.fileSize();
+      rec.dirIndex = file.dirIndex();
+      rec.modifyDate = entry.lastWriteDate;
+      rec.modifyTime = entry.lastWriteTime;
+      memset(rec.reserved, 0, sizeof(rec.reserved));
+
+      if(oldCount && findIndexRecord(&index_file, oldCount, &rec, &old)
+         && (old.fileSize == rec.fileSize)
+         && (old.modifyDate == rec.modifyDate)
+         && (old.modifyTime == rec.modifyTime)) {
+        memcpy(rec.title, old.title, sizeof(rec.title));
+        memcpy(rec.artist, old.artist, sizeof(rec.artist));
+        rec.duration = old.duration;
+        rec.bitrate = old.bitrate;
+      } else {
+        probeIndexRecord(&file, &rec);
+      }
+
+      if(!writeIndexRecord(&tmp, count, &rec) || (++count == 0xFFFF)) {
+        file.close();
+        tmp.remove();
+        return 4;
+      }
+    }
+    file.close();
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, track_index_magic, sizeof(track_index_magic));
+  hdr.version = TRACK_INDEX_VERSION;
+  hdr.recordSize = sizeof(track_index_t);
+  hdr.count = count;
+  hdr.dirCluster = dir->firstCluster();
+
+  // the header last, such that a valid header marks a complete index.
+  if(!sortIndex(&tmp, count) || !tmp.sync() || !tmp.seekSet(0)
+     || (tmp.write(&hdr, sizeof(hdr)) != sizeof(hdr))
+     || !tmp.sync()) {
+    tmp.remove();
+    return 4;
+  }
+
+  // replace the prior index only once the new one is complete. Should power
+  // be lost in between, openTrackIndex() finds the new one by MP3_INDEX_TMPNAME.
+  index_file.close();
+  if(dir->exists(MP3_INDEX_FILENAME)) {
+    FatFile::remove(dir, MP3_INDEX_FILENAME);
+  }
+  if(!tmp.rename(dir, MP3_INDEX_FILENAME)) {
+    tmp.close();
+    return 4;
+  }
+  tmp.close();
+
+  return openTrackIndex() ? 0 : 4;
+#else
+  return 2;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Number of tracks in the index
+ *
+ * \return number of records in the index of the current working directory,
+ * or zero if there is no valid index.
+ *
+ * \note Can be called while playing.
+ */
+uint16_t SFEMP3Shield::getTrackIndexCount() {
+#if MP3_TRACK_INDEX
+  uint16_t result = 0;
+
+  if(playing_state == playback) {
+    disableRefill();
+  }
+
+  if(openTrackIndex()) {
+    result = index_count;
+  }
+
+  if(playing_state == playback) {
+    enableRefill();
+  }
+  return result;
+#else
+  return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Fetch a record of the index
+ *
+ * \param[in] number position of the track in the index, in order of name.
+ * \param[out] rec record to be filled in.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \note Can be called while playing, as only a single block is read.
+ */
+uint8_t SFEMP3Shield::getIndexedTrack(uint16_t number, track_index_t* rec) {
+#if MP3_TRACK_INDEX
+  uint8_t result = 0;
+
+  if(playing_state == playback) {
+    disableRefill();
+  }
+
+  if(!openTrackIndex()) {
+    result = 3;
+  } else if(number >= index_count) {
+    result = 5;
+  } else if(!readIndexRecord(&index_file, number, rec)) {
+    result = 4;
+  }
+
+  if(playing_state == playback) {
+    enableRefill();
+  }
+  return result;
+#else
+  (void)number;
+  (void)rec;
+  return 3;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Find a track of the index by name
+ *
+ * \param[in] prefix leading characters of the name, ignoring case.
+ * \param[out] rec record to be filled in with the first match.
+ *
+ * As the index is sorted by name, the following records may be fetched with
+ * getIndexedTrack() to enumerate all the tracks sharing the prefix.
+ *
+ * \return position of the first matching track in the index, or -1 if none.
+ *
+ * \note Can be called while playing.
+ */
+int32_t SFEMP3Shield::findIndexedTrack(const char* prefix, track_index_t* rec) {
+#if MP3_TRACK_INDEX
+  int32_t result = -1;
+
+  if(playing_state == playback) {
+    disableRefill();
+  }
+
+  if(openTrackIndex()) {
+    result = searchIndex(&index_file, index_count, prefix, true, rec);
+  }
+
+  if(playing_state == playback) {
+    enableRefill();
+  }
+  return result;
+#else
+  (void)prefix;
+  (void)rec;
+  return -1;
+#endif
+}
+
+// @}
+// Track_Index_Group
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// Recording_Group
+
+/**
+ * \brief Bytes of each IMA ADPCM block, as encoded by the VSdsp in mono.
+ */
+#define RECORD_ADPCM_BLOCK 256
+
+/**
+ * \brief Samples held by each IMA ADPCM block.
+ */
+#define RECORD_ADPCM_SAMPLES 505
+
+/**
+ * \brief Size of the recording's WAV header, padded to keep the data block aligned.
+ */
+#define RECORD_HEADER_SIZE 512
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write the IMA ADPCM WAV header of a recording
+ *
+ * \param[in] file the opened recording.
+ * \param[in] rate sample rate in Hz.
+ * \param[in] dataSize bytes of ADPCM data following the header.
+ *
+ * The "RIFF", "fmt " and "fact" chunks are followed by a "JUNK" chunk, which
+ * pads the header out to RECORD_HEADER_SIZE, less the "data" chunk's header.
+ *
+ * \return true if the header was written.
+ */
+static bool writeRecordHeader(SdFile* file, uint16_t rate, uint32_t dataSize) {
+  uint8_t hdr[60];
+  uint8_t* p = hdr;
+
+  memcpy(p, "RIFF", 4);
+  p = putLittleEndian(p + 4, RECORD_HEADER_SIZE - 8 + dataSize, 4);
+  memcpy(p, "WAVEfmt ", 8);
+  p = putLittleEndian(p + 8, 20, 4);
+  p = putLittleEndian(p, 0x11, 2); // IMA ADPCM
+  p = putLittleEndian(p, 1, 2); // mono
+  p = putLittleEndian(p, rate, 4);
+  p = putLittleEndian(p, ((uint32_t) rate * RECORD_ADPCM_BLOCK) / RECORD_ADPCM_SAMPLES, 4);
+  p = putLittleEndian(p, RECORD_ADPCM_BLOCK, 2);
+  p = putLittleEndian(p, 4, 2); // bits per sample
+  p = putLittleEndian(p, 2, 2); // size of the following
+  p = putLittleEndian(p, RECORD_ADPCM_SAMPLES, 2);
+  memcpy(p, "fact", 4);
+  p = putLittleEndian(p + 4, 4, 4);
+  p = putLittleEndian(p, (dataSize / RECORD_ADPCM_BLOCK) * RECORD_ADPCM_SAMPLES, 4);
+  memcpy(p, "JUNK", 4);
+  putLittleEndian(p + 4, RECORD_HEADER_SIZE - sizeof(hdr) - 8, 4);
+
+  if(!file->seekSet(0) || (file->write(hdr, sizeof(hdr)) != sizeof(hdr))) return false;
+
+  // zero the padding, then the "data" chunk's header.
+  memset(hdr, 0, sizeof(hdr));
+  for(uint16_t i = sizeof(hdr); i < RECORD_HEADER_SIZE - 8; i += sizeof(hdr)) {
+    uint8_t n = sizeof(hdr);
+    if(i + n > RECORD_HEADER_SIZE - 8) n = RECORD_HEADER_SIZE - 8 - i;
+    if(file->write(hdr, n) != n) return false;
+  }
+  memcpy(hdr, "data", 4);
+  putLittleEndian(hdr + 4, dataSize, 4);
+  return file->write(hdr, 8) == 8;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin recording the microphone or line input to a WAV file
+ *
+ * \param[in] fileName of the WAV file to be recorded, replaced if present.
+ * \param[in] seconds longest duration to be recorded, at most what keeps the
+ * count of samples within 32 bits, over 24 hours at 48000 Hz.
+ * \param[in] sampleRate in Hz, from 8000 to 48000.
+ * \param[in] lineIn zero to record the microphone, otherwise the left line input.
+ *
+ * Preallocates a contiguous file for \p seconds of IMA ADPCM with
+ * \c FatFile::createContiguous() and writes its WAV header. When
+ * MP3_RECORD_BLOCKS is nonzero, a multi-block write of the rest of the file is
+ * started, pre-erasing it. Then puts the VSdsp into IMA ADPCM recording, as
+ * per Data Sheet Section 9.8, with the input gain of MP3_RECORD_GAIN. The
+ * encoded data is moved from the VSdsp to the file by serviceRecording(),
+ * which is to be called from the sketch's loop() until stopRecording().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \warning Other files must not be accessed while recording, as the SdCard is
+ * kept in its multi-block write.
+ */
+uint8_t SFEMP3Shield::startRecording(char* fileName, uint32_t seconds, uint16_t sampleRate, uint8_t lineIn) {
+  uint32_t blocks;
+#if MP3_RECORD_BLOCKS
+  uint32_t last;
+#endif
+
+  if(isPlaying()) return 1;
+  if(!digitalRead(MP3_RESET)) return 3;
+  if((sampleRate < 8000) || (sampleRate > 48000)) return 5;
+
+  if(seconds > (0xFFFFFFFF - RECORD_ADPCM_SAMPLES) / sampleRate) {
+    seconds = (0xFFFFFFFF - RECORD_ADPCM_SAMPLES) / sampleRate;
+  }
+  // whole ADPCM blocks, rounded up to whole blocks of the SdCard.
+  blocks = (seconds * sampleRate + RECORD_ADPCM_SAMPLES - 1) / RECORD_ADPCM_SAMPLES;
+  record_limit = ((blocks + 1) / 2) * 512;
+
+  sd.remove(fileName);
+  if(!track.createContiguous(sd.vwd(), fileName, RECORD_HEADER_SIZE + record_limit)) return 2;
+
+  // describe the whole file, until finished by stopRecording().
+  if(!writeRecordHeader(&track, sampleRate, record_limit) || !track.seekSet(RECORD_HEADER_SIZE)) {
+    track.remove();
+    return 4;
+  }
+#if MP3_RECORD_BLOCKS
+  // stream the blocks following the header, see writeRecording().
+  if(!track.sync() || !track.contiguousRange(&record_first, &last)
+     || !sd.card()->writeStart(++record_first, record_limit / 512)) {
+    track.remove();
+    return 4;
+  }
+  record_writing = true; // until stopRecordWrite().
+  sd.card()->spiStop();
+  record_fill = 0;
+  record_head = 0;
+  record_queued = 0;
+#endif
+  record_rate = sampleRate;
+  record_size = 0;
+  memset(&record_stats, 0, sizeof(record_stats));
+
+  Mp3WriteRegister(SCI_AICTRL0, sampleRate);
+  Mp3WriteRegister(SCI_AICTRL1, MP3_RECORD_GAIN);
+  Mp3WriteRegister(SCI_AICTRL2, 0); // default limit of automatic gain.
+  Mp3WriteRegister(SCI_AICTRL3, 2); // left channel, IMA ADPCM.
+  Mp3WriteRegister(SCI_MODE, SM_SDINEW | SM_RESET | SM_ADPCM | (lineIn ? SM_LINE1 : 0));
+
+  playing_state = recording;
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Move the VSdsp's encoded data to the recording
+ *
+ * Reads the words the VSdsp holds, from SCI_HDAT0 as counted by SCI_HDAT1,
+ * 32 bytes at a time. Each filled block of the MP3_RECORD_BLOCKS buffer is
+ * queued for writeRecording(), or if zero each 32 bytes are written through
+ * SdFat.
+ *
+ * \return false if the recording could not be written.
+ */
+bool SFEMP3Shield::readRecording() {
+  uint16_t words = Mp3ReadRegister(SCI_HDAT1);
+
+  for(; (words >= sizeof(mp3DataBuffer) / 2) && (record_size < record_limit); words -= sizeof(mp3DataBuffer) / 2) {
+#if MP3_RECORD_BLOCKS
+    if(record_queued == MP3_RECORD_BLOCKS) {
+      // the buffer is full, wait for the SdCard.
+      record_stats.stalls++;
+      if(!writeRecording(true)) return false;
+    }
+    uint8_t* p = &record_buffer[512 * record_head + record_fill];
+#else
+    uint8_t* p = mp3DataBuffer;
+#endif
+    for(uint8_t i = 0; i < sizeof(mp3DataBuffer); i += 2) {
+      uint16_t w = Mp3ReadRegister(SCI_HDAT0);
+      p[i] = w >> 8;
+      p[i + 1] = w;
+    }
+    record_size += sizeof(mp3DataBuffer);
+#if MP3_RECORD_BLOCKS
+    record_fill += sizeof(mp3DataBuffer);
+    if(record_fill == 512) {
+      record_fill = 0;
+      if(++record_head == MP3_RECORD_BLOCKS) record_head = 0;
+      if(++record_queued > record_stats.maxQueued) record_stats.maxQueued = record_queued;
+      if(!writeRecording(false)) return false;
+    }
+#else
+    if(track.write(p, sizeof(mp3DataBuffer)) != sizeof(mp3DataBuffer)) return false;
+    if(!(record_size % 512)) record_stats.blocks++;
+#endif
+  }
+  return true;
+}
+
+#if MP3_RECORD_BLOCKS
+//------------------------------------------------------------------------------
+/**
+ * \brief Write the queued blocks of the recording to the SdCard
+ *
+ * \param[in] wait for the SdCard to take at least one block, otherwise
+ * return as soon as the SdCard is found busy.
+ *
+ * The blocks are sent one at a time into the multi-block write, started by
+ * startRecording() on the pre-erased file, releasing the SPI for the VSdsp
+ * in between. Such that the SdCard's busy time after each block is spent
+ * reading the VSdsp, rather than waiting. Every MP3_RECORD_CHECKPOINT_BLOCKS
+ * the multi-block write is stopped, to update the WAV header with what has
+ * been recorded so far, then restarted.
+ *
+ * \return false if the recording could not be written, leaving the
+ * multi-block write to be stopped by stopRecordWrite().
+ */
+bool SFEMP3Shield::writeRecording(bool wait) {
+  SdSpiCard* card = sd.card();
+
+  while(record_queued) {
+    uint16_t t0 = millis();
+    bool busy = false;
+
+    while(card->isBusy()) {
+      if(!wait) return true;
+      if((uint16_t)(millis() - t0) > SD_WRITE_TIMEOUT) return false;
+      busy = true;
+    }
+    if(busy && (micros() - record_sent > record_stats.maxBusy)) {
+      record_stats.maxBusy = micros() - record_sent;
+    }
+
+    card->spiStart();
+    if(!card->writeData(&record_buffer[512 * ((record_head + MP3_RECORD_BLOCKS - record_queued) % MP3_RECORD_BLOCKS)])) return false;
+    card->spiStop();
+    record_sent = micros();
+    record_queued--;
+    record_stats.blocks++;
+    wait = false;
+
+    if(!(record_stats.blocks % MP3_RECORD_CHECKPOINT_BLOCKS) && (record_stats.blocks < record_limit / 512)) {
+      if(!stopRecordWrite() || !writeRecordHeader(&track, record_rate, record_stats.blocks * 512) || !track.sync()
+         || !card->writeStart(record_first + record_stats.blocks, record_limit / 512 - record_stats.blocks)) return false;
+      record_writing = true;
+      card->spiStop();
+      record_stats.checkpoints++;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Stop the multi-block write of the recording
+ *
+ * Sends the stop token of the multi-block write, as started by
+ * startRecording() or restarted by a checkpoint, if it is still open. Called
+ * on every exit from the write, including the failures of writeRecording(),
+ * before SdFat accesses the SdCard again.
+ *
+ * \return false if the SdCard did not take the stop token.
+ */
+bool SFEMP3Shield::stopRecordWrite() {
+
+  if(!record_writing) return true;
+  record_writing = false;
+  sd.card()->spiStart();
+  return sd.card()->writeStop();
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write the rest of the recording
+ *
+ * The part filled block is padded and written with the queued blocks, then
+ * the multi-block write is stopped.
+ *
+ * \return false if the recording could not be written.
+ */
+bool SFEMP3Shield::flushRecording() {
+#if MP3_RECORD_BLOCKS
+  if(record_fill) {
+    memset(&record_buffer[512 * record_head + record_fill], 0, 512 - record_fill);
+    record_fill = 0;
+    if(++record_head == MP3_RECORD_BLOCKS) record_head = 0;
+    record_queued++;
+  }
+  while(record_queued) {
+    if(!writeRecording(true)) return false;
+  }
+  return stopRecordWrite();
+#else
+  return true;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Service the recording
+ *
+ * To be called from the sketch's loop() while recording, often enough that
+ * the VSdsp's 2 KB buffer does not overflow. Which at 8000 Hz holds half a
+ * second of IMA ADPCM, allowing for the SdCard's occasional slow writes.
+ * The recording is stopped once its preallocated file is full.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t SFEMP3Shield::serviceRecording() {
+
+  if(playing_state != recording) return 1;
+
+  if(!readRecording()) {
+    stopRecording();
+    return 4;
+  }
+  if(record_size >= record_limit) return stopRecording();
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Stop the recording
+ *
+ * Moves the last of the VSdsp's encoded data to the file, which is truncated
+ * to its whole ADPCM blocks, described by the finished WAV header, and
+ * closed. Then resets the VSdsp out of recording with vs_init(), keeping the
+ * volume, which reloads the patches through the closed \c track.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \note Other settings of the VSdsp, such as bass and treble, return to their
+ * defaults.
+ */
+uint8_t SFEMP3Shield::stopRecording() {
+  uint8_t result = 0;
+  uint8_t left = VolL;
+  uint8_t right = VolR;
+  uint32_t size;
+
+  if(playing_state != recording) return 1;
+
+  if(!readRecording() || !flushRecording()) result = 4;
+#if MP3_RECORD_BLOCKS
+  // also after a failure, before the file is finished through SdFat.
+  if(!stopRecordWrite()) result = 4;
+#endif
+  playing_state = ready;
+
+  size = record_size - (record_size % RECORD_ADPCM_BLOCK);
+  if(!track.truncate(RECORD_HEADER_SIZE + size) || !writeRecordHeader(&track, record_rate, size)) result = 4;
+  if(!track.close()) result = 4;
+
+  vs_init();
+  setVolume(left, right);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Get the statistics of the SdCard writes of the recording
+ *
+ * \param[out] stats of the current or last recording.
+ *
+ * \note Only the number of blocks is counted when MP3_RECORD_BLOCKS is zero.
+ */
+void SFEMP3Shield::getRecordStats(record_stats_t* stats) {
+  *stats = record_stats;
+}
+
+// @}
+// Recording_Group
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// Stream_Group
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play PCM samples from a buffer filled by the sketch
+ *
+ * \param[in] buffer ring buffer, owned by the sketch, of the samples to play.
+ * \param[in] size of the buffer in bytes.
+ * \param[in] sampleRate in Hz.
+ * \param[in] channels 1 for mono or 2 for stereo, interleaved left first.
+ * \param[in] bits 8 for unsigned or 16 for signed little endian samples.
+ * \param[in] callback (optional) called by refill() to fill the buffer.
+ * \param[in] lowWater (optional) level in bytes below which the callback is called.
+ *
+ * Sends the VSdsp a WAV header of unknown length, then plays the samples
+ * put into the buffer. The samples are either written by the sketch with
+ * streamWrite(), or in place at streamSpace() and handed over with
+ * streamCommit(). Or else the callback is given the free space of the buffer
+ * to fill, returning the number of bytes it put there, whenever refill()
+ * finds fewer than \p lowWater bytes waiting. refill() sends the samples straight
+ * from the buffer, without copying them.
+ *
+ * The stream is played until stopTrack(). Should the buffer run empty the
+ * VSdsp simply runs out of samples until more are committed.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \warning The callback is called from within refill(), which is typically
+ * an interrupt, and must not access the SdCard or the VSdsp.
+ */
+uint8_t SFEMP3Shield::playStream(uint8_t* buffer, uint16_t size, uint16_t sampleRate, uint8_t channels,
+                                 uint8_t bits, stream_callback_t callback, uint16_t lowWater) {
+  uint8_t hdr[44];
+  uint8_t* p = hdr;
+  uint8_t frame = channels * (bits / 8);
+
+  if(isPlaying()) return 1;
+  if(!digitalRead(MP3_RESET)) return 3;
+  if(!buffer || (size < 2) || (channels < 1) || (channels > 2) || ((bits != 8) && (bits != 16))) return 4;
+
+  // a WAV header of the largest size, as the length is not known.
+  memcpy(p, "RIFF", 4);
+  p = putLittleEndian(p + 4, 0xFFFFFFFF, 4);
+  memcpy(p, "WAVEfmt ", 8);
+  p = putLittleEndian(p + 8, 16, 4);
+  p = putLittleEndian(p, 1, 2); // PCM
+  p = putLittleEndian(p, channels, 2);
+  p = putLittleEndian(p, sampleRate, 4);
+  p = putLittleEndian(p, (uint32_t) sampleRate * frame, 4);
+  p = putLittleEndian(p, frame, 2);
+  p = putLittleEndian(p, bits, 2);
+  memcpy(p, "data", 4);
+  putLittleEndian(p + 4, 0xFFFFFFFF, 4);
+
+  stream_buffer = buffer;
+  stream_size = size;
+  stream_head = 0;
+  stream_tail = 0;
+  stream_callback = callback;
+  stream_low = lowWater;
+  stream_starved = false;
+
+  Mp3WriteRegister(SCI_DECODE_TIME, 0); // Reset the Decode and bitrate from previous play back.
+  restartPosition(POSITION_UNKNOWN);
+
+  sendData(hdr, sizeof(hdr));
+
+  playing_state = playback;
+
+  refill();
+  enableRefill();
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Bytes waiting in the stream's buffer to be played
+ *
+ * \return the number of bytes committed and not yet sent to the VSdsp.
+ */
+uint16_t SFEMP3Shield::streamLevel() {
+  uint16_t tail;
+
+  if(!stream_buffer) return 0;
+
+  // refill() moves the tail, typically from an interrupt.
+  cli();
+  tail = stream_tail;
+  sei();
+
+  return (stream_head >= tail ? 0 : stream_size) + stream_head - tail;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Where to put the next samples of the stream
+ *
+ * \param[out] dst where the next samples are to be written in place.
+ *
+ * \return the number of bytes that may be written at \p dst, before calling
+ * streamCommit(). Zero if the buffer is full, or there is no stream.
+ */
+uint16_t SFEMP3Shield::streamSpace(uint8_t** dst) {
+  uint16_t tail;
+
+  if(!stream_buffer) return 0;
+
+  cli();
+  tail = stream_tail;
+  sei();
+
+  *dst = stream_buffer + stream_head;
+  // one byte is kept free, to tell a full buffer from an empty one.
+  if(tail > stream_head) return tail - stream_head - 1;
+  return stream_size - stream_head - (tail ? 0 : 1);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Hand samples written in place over to be played
+ *
+ * \param[in] n number of bytes written at the position from streamSpace().
+ *
+ * \note streamCommit(0) restarts a stream whose callback had run dry.
+ */
+void SFEMP3Shield::streamCommit(uint16_t n) {
+
+  if(!stream_buffer) return;
+
+  disableRefill();
+  stream_head += n;
+  if(stream_head >= stream_size) stream_head -= stream_size;
+
+  // the VSdsp may have run out waiting, with no DREQ edge to come.
+  if(playing_state == playback) {
+    refill();
+    enableRefill();
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Copy samples into the stream's buffer
+ *
+ * \param[in] src samples to be played.
+ * \param[in] n number of bytes of samples.
+ *
+ * \return the number of bytes taken, less than \p n if the buffer is full.
+ */
+uint16_t SFEMP3Shield::streamWrite(const uint8_t* src, uint16_t n) {
+  uint16_t done = 0;
+  uint8_t* dst;
+
+  while(done < n) {
+    uint16_t space = streamSpace(&dst);
+    if(!space) break;
+    if(space > n - done) space = n - done;
+    memcpy(dst, src + done, space);
+    streamCommit(space);
+    done += space;
+  }
+  return done;
+}
+
+// @}
+// Stream_Group
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// RealTimeMIDI_Group
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Enter the VSdsp's real-time MIDI mode
+ *
+ * Loads the \c rtmidi.053 plugin, which starts the VSdsp playing the MIDI
+ * messages sent on its data stream as they arrive, rather than MIDI files.
+ * The messages are then queued with midiNoteOn(), midiNoteOff(),
+ * midiProgramChange(), midiControlChange() and midiPitchBend(). And sent
+ * together by flushMIDI(), typically called once per pass of the sketch's
+ * loop().
+ *
+ * The VSdsp stays in real-time MIDI mode until stopMIDI().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * - \ref Error_Codes
+ * - \ref Plug_Ins
+ */
+uint8_t SFEMP3Shield::startMIDI() {
+  uint8_t result;
+
+  if(!digitalRead(MP3_RESET)) return 3;
+  if(isPlaying()) return 1;
+
+  result = VSLoadUserCode((char*)"rtmidi.053");
+  if(result) return result;
+
+  midi_head = 0;
+  midi_tail = 0;
+  midi_stamp = 0;
+  memset(&midi_stats, 0, sizeof(midi_stats));
+
+  playing_state = realtime_midi;
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Leave the VSdsp's real-time MIDI mode
+ *
+ * The plugin can only be left by resetting the VSdsp, after which vs_init()
+ * reloads the patches for normal play back. Any queued messages are dropped.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * - 0 indicates that real-time MIDI was stopped.
+ * - 1 indicates that the VSdsp was not in real-time MIDI mode.
+ * - 4 thru 6 are as from vs_init().
+ */
+uint8_t SFEMP3Shield::stopMIDI() {
+  uint8_t result;
+
+  if(playing_state != realtime_midi) return 1;
+
+  playing_state = ready;
+  result = vs_init();
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue a real-time MIDI message
+ *
+ * \param[in] status byte of the message, including its channel.
+ * \param[in] data1 first data byte.
+ * \param[in] data2 second data byte, if any.
+ * \param[in] size of the message, 2 or 3 bytes.
+ *
+ * The queue has a single producer, the sketch, and a single consumer,
+ * flushMIDI(). Where the bytes are placed before the head is advanced, so
+ * neither ever waits on the other.
+ *
+ * \return
+ * - 0 indicates the message was queued.
+ * - 1 indicates that the VSdsp is not in real-time MIDI mode.
+ * - 2 indicates the queue was full, see MP3_MIDI_QUEUE_SIZE.
+ */
+uint8_t SFEMP3Shield::queueMIDI(uint8_t status, uint8_t data1, uint8_t data2, uint8_t size) {
+  uint8_t head = midi_head;
+
+  if(playing_state != realtime_midi) return 1;
+
+  if(size > (uint8_t)((midi_tail - head - 1) & (MP3_MIDI_QUEUE_SIZE - 1))) {
+    midi_stats.overflows++;
+    return 2;
+  }
+
+  midi_queue[head] = status;
+  head = (head + 1) & (MP3_MIDI_QUEUE_SIZE - 1);
+  midi_queue[head] = data1 & 0x7F;
+  head = (head + 1) & (MP3_MIDI_QUEUE_SIZE - 1);
+  if(size > 2) {
+    midi_queue[head] = data2 & 0x7F;
+    head = (head + 1) & (MP3_MIDI_QUEUE_SIZE - 1);
+  }
+
+  // time the oldest waiting Note On, with a velocity, from here.
+  if(((status & 0xF0) == 0x90) && data2) {
+    cli();
+    if(!midi_stamp) midi_stamp = micros() | 1;
+    midi_head = head;
+    sei();
+  } else {
+    midi_head = head;
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue a Note On
+ *
+ * \param[in] channel 0 thru 15, where 9 is percussion.
+ * \param[in] note 0 thru 127, where 60 is middle C.
+ * \param[in] velocity 0 thru 127.
+ *
+ * \return as from queueMIDI().
+ */
+uint8_t SFEMP3Shield::midiNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {
+  return queueMIDI(0x90 | (channel & 0x0F), note, velocity, 3);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue a Note Off
+ *
+ * \param[in] channel 0 thru 15.
+ * \param[in] note 0 thru 127.
+ * \param[in] velocity 0 thru 127, of the release.
+ *
+ * \return as from queueMIDI().
+ */
+uint8_t SFEMP3Shield::midiNoteOff(uint8_t channel, uint8_t note, uint8_t velocity) {
+  return queueMIDI(0x80 | (channel & 0x0F), note, velocity, 3);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue a Program Change
+ *
+ * \param[in] channel 0 thru 15.
+ * \param[in] program 0 thru 127, the General MIDI instrument.
+ *
+ * \return as from queueMIDI().
+ */
+uint8_t SFEMP3Shield::midiProgramChange(uint8_t channel, uint8_t program) {
+  return queueMIDI(0xC0 | (channel & 0x0F), program, 0, 2);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue a Control Change
+ *
+ * \param[in] channel 0 thru 15.
+ * \param[in] control 0 thru 127, such as 7 for the channel's volume.
+ * \param[in] value 0 thru 127.
+ *
+ * \return as from queueMIDI().
+ */
+uint8_t SFEMP3Shield::midiControlChange(uint8_t channel, uint8_t control, uint8_t value) {
+  return queueMIDI(0xB0 | (channel & 0x0F), control, value, 3);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue a Pitch Bend
+ *
+ * \param[in] channel 0 thru 15.
+ * \param[in] bend -8192 thru 8191, where 0 is no bend.
+ *
+ * \return as from queueMIDI().
+ */
+uint8_t SFEMP3Shield::midiPitchBend(uint8_t channel, int16_t bend) {
+  uint16_t value = constrain(bend, -8192, 8191) + 8192;
+
+  return queueMIDI(0xE0 | (channel & 0x0F), value & 0x7F, value >> 7, 3);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Send the queued real-time MIDI messages
+ *
+ * Sends all the queued messages to the VSdsp in a single burst of its data
+ * stream, each MIDI byte padded to 16 bits as the plugin expects. Every
+ * message keeps its status byte, as \c rtmidi.053 only starts the VSdsp's
+ * real-time MIDI and its handling of running status is undocumented. Then
+ * updates the latency of the oldest Note On sent, see getMIDIStats().
+ *
+ * \return the number of messages sent.
+ */
+uint8_t SFEMP3Shield::flushMIDI() {
+  uint8_t head;
+  uint8_t tail = midi_tail;
+  uint8_t messages = 0;
+  uint8_t sent = 0;
+  uint32_t stamp;
+
+  if((playing_state != realtime_midi) || !digitalRead(MP3_RESET)) return 0;
+
+  // the stamp belongs to the messages up to this head.
+  cli();
+  stamp = midi_stamp;
+  midi_stamp = 0;
+  head = midi_head;
+  sei();
+
+  if(tail == head) return 0;
+
+  dcs_low(); //Select Data
+  while(tail != head) {
+    uint8_t b = midi_queue[tail];
+    tail = (tail + 1) & (MP3_MIDI_QUEUE_SIZE - 1);
+    if(b & 0x80) messages++;
+    // Every 16 words check if not ready for next buffer chunk.
+    if(!(sent % 16)) {
+      while(!digitalRead(MP3_DREQ));
+    }
+    SPI.transfer(0);
+    SPI.transfer(b);
+    sent++;
+  }
+  dcs_high(); //Deselect Data
+  midi_tail = tail;
+
+  midi_stats.messages += messages;
+  midi_stats.bursts++;
+  if(stamp) {
+    midi_stats.lastLatency = micros() - stamp;
+    if(midi_stats.lastLatency > midi_stats.maxLatency)
+      midi_stats.maxLatency = midi_stats.lastLatency;
+  }
+  return messages;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Get the statistics of the real-time MIDI messages
+ *
+ * \param[out] stats the counts and Note On latencies since startMIDI().
+ */
+void SFEMP3Shield::getMIDIStats(midi_stats_t* stats) {
+  *stats = midi_stats;
+}
+
+// @}
+// RealTimeMIDI_Group
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// Effect_Group
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play a sound effect from RAM over the current track
+ *
+ * \param[in] clip complete audio file, such as a short MP3 or WAV, in RAM.
+ * \param[in] size of the clip in bytes.
+ *
+ * Preempts the current track with the clip, returning to the track where it
+ * was once the clip has played. See startEffect().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \warning The clip must remain in RAM until it has played.
+ */
+uint8_t SFEMP3Shield::playEffect(const uint8_t* clip, uint16_t size) {
+  effect_data = clip;
+  effect_left = size;
+  return startEffect(EFFECT_RAM);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play a sound effect from PROGMEM over the current track
+ *
+ * \param[in] clip complete audio file, such as a short MP3 or WAV, in PROGMEM.
+ * \param[in] size of the clip in bytes.
+ *
+ * As playEffect(), reading the clip from flash.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t SFEMP3Shield::playEffect_P(const uint8_t* clip, uint16_t size) {
+  effect_data = clip;
+  effect_left = size;
+  return startEffect(EFFECT_PROGMEM);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play a sound effect from the SdCard over the current track
+ *
+ * \param[out] fileName pointer of a char array (aka string), contianing the filename
+ *
+ * As playEffect(), reading the clip from its own file, leaving the track open.
+ * An effect file being replaced ends, should the new file not be found.
+ *
+ * \note Requires MP3_EFFECT_FILE, otherwise returns 2.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t SFEMP3Shield::playEffectFile(char* fileName) {
+  if(!digitalRead(MP3_RESET)) return 3;
+  if((isPlaying() > 1) || stream_buffer) return 1;
+
+#if MP3_EFFECT_FILE
+  // an effect file being replaced is closed first, as its file is reused.
+  // Should the new one not open, the old one is then found at its end.
+  disableRefill();
+  closeEffect(effect_source);
+  if(!effect_file.open(fileName, O_READ)) {
+    enableRefill();
+    return 2;
+  }
+
+  return startEffect(EFFECT_FILE);
+#else
+  (void)fileName;
+  return 2;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Preempt the current track with a sound effect
+ *
+ * \param[in] source of the effect, being one of EFFECT_RAM, EFFECT_PROGMEM or
+ * EFFECT_FILE, already set up by the caller.
+ *
+ * Saves the position of the playing or paused MP3 track, along with its frame
+ * header as to find the frames again, and cancels the VSdsp's decoding
+ * without flushing, so the effect starts at once. refill() then plays the
+ * effect, and at its end re-enters the track at the next frame from the
+ * saved position, in its prior playing or paused state, without reopening it.
+ * Where no track was playing, the effect simply plays.
+ *
+ * An effect started while another is playing replaces it, keeping the track
+ * to return to.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * - 0 indicates the effect has started.
+ * - 1 indicates the VSdsp is busy recording, streaming or in real-time MIDI.
+ * - 3 indicates that the VSdsp is in reset.
+ * - 4 indicates the track is not an MP3, as detected by playMP3(), having no
+ * frames to re-enter at.
+ *
+ * \note The audio already buffered in the VSdsp when the track was preempted,
+ * under 2 KB, is skipped.
+ */
+uint8_t SFEMP3Shield::startEffect(uint8_t source) {
+
+  if(!digitalRead(MP3_RESET)) return 3;
+  if((isPlaying() > 1) || stream_buffer) {
+    closeEffect(source);
+    return 1;
+  }
+
+  disableRefill();
+  if(effect_source) {
+    // replacing an effect, keep the track to return to.
+    if(source != EFFECT_FILE) closeEffect(effect_source);
+  } else if(isPlaying()) {
+    if(track_format != format_mp3) {
+      closeEffect(source);
+      enableRefill();
+      return 4;
+    }
+    effect_resume = track.curPosition();
+    effect_state = playing_state;
+
+    // second byte of the first frame's header, its version and layer.
+    track.seekSet(start_of_music + 1);
+    effect_header = track.read();
+  } else {
+    effect_resume = EFFECT_NO_RESUME;
+  }
+
+  // not playback, so flush_cancel()'s register reads do not refill.
+  playing_state = loading;
+  flush_cancel(none); // fast cancel, as data is about to follow.
+
+  effect_source = source;
+  playing_state = playback;
+
+  refill();
+  enableRefill();
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Next bytes of the sound effect
+ *
+ * \param[out] src where the bytes are.
+ *
+ * \return the number of bytes at \p src, up to 32, zero at its end.
+ */
+uint8_t SFEMP3Shield::readEffect(uint8_t** src) {
+  int16_t n = sizeof(mp3DataBuffer);
+
+#if MP3_EFFECT_FILE
+  if(effect_source == EFFECT_FILE) {
+    n = effect_file.read(mp3DataBuffer, sizeof(mp3DataBuffer));
+    *src = mp3DataBuffer;
+    return n > 0 ? n : 0;
+  }
+#endif
+
+  if(effect_left < n) n = effect_left;
+  if(effect_source == EFFECT_RAM) {
+    *src = (uint8_t*) effect_data;
+  } else {
+    for(uint8_t y = 0 ; y < n ; y++) {
+      mp3DataBuffer[y] = pgm_read_byte_near(effect_data + y);
+    }
+    *src = mp3DataBuffer;
+  }
+  effect_data += n;
+  effect_left -= n;
+  return n;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Close the sound effect's file
+ *
+ * \param[in] source of the effect, closed only if EFFECT_FILE.
+ */
+void SFEMP3Shield::closeEffect(uint8_t source) {
+#if MP3_EFFECT_FILE
+  if(source == EFFECT_FILE) effect_file.close();
+#else
+  (void)source;
+#endif
+}
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Return from the sound effect to the track
+ *
+ * Called by serviceEffect() once refill() has sent the end of the effect.
+ * Which is let to play out before the VSdsp is cancelled. Then the track is
+ * positioned at the first frame header, matching the version and layer of its
+ * first frame, found after the saved position, and its prior state restored.
+ *
+ * \return true if the track is to continue playing.
+ */
+bool SFEMP3Shield::endEffect() {
+  uint8_t b = 0;
+  bool found = false;
+
+  playing_state = ready; // not playback, as flush_cancel() reads registers.
+  flush_cancel(post);
+
+  closeEffect(effect_source);
+  effect_source = EFFECT_NONE;
+  postEvent(event_effect_ended);
+
+  if(effect_resume == EFFECT_NO_RESUME) return false;
+
+  if(track.seekSet(effect_resume)) {
+    for(uint16_t i = 0 ; i < 4096 ; i++) {
+      int16_t c = track.read();
+      if(c < 0) break;
+      if((b == 0xFF) && ((c & 0xFE) == (effect_header & 0xFE))) {
+        c = track.read();
+        // a valid bitrate and sample rate, else a false sync.
+        if((c >= 0) && ((c & 0xF0) != 0xF0) && ((c & 0x0C) != 0x0C)) {
+          found = track.seekCur(-3);
+          break;
+        }
+      }
+      b = c;
+    }
+  }
+  effect_resume = EFFECT_NO_RESUME;
 
-  uint16_t MP3HDAT1 = Mp3ReadRegister(SCI_HDAT1);
-  Serial.print(F("0x"));
-  Serial.print(MP3HDAT1, HEX);
+  if(!found) {
+    // lost the track, as from its end.
+    track.close();
+    return false;
+  }
 
-  uint16_t MP3HDAT0 = Mp3ReadRegister(SCI_HDAT0);
-  Serial.print(F("\t0x"));
-  Serial.print(MP3HDAT0, HEX);
+  playing_state = effect_state;
+  return playing_state == playback;
+}
 
-  uint16_t MP3SCI_VOL = Mp3ReadRegister(SCI_VOL);
-  Serial.print(F("\t0x"));
-  Serial.print(MP3SCI_VOL, HEX);
+//------------------------------------------------------------------------------
+/**
+ * \brief Finish the end of a sound effect
+ *
+ * refill() only marks the end of the effect, with its refill disabled, as the
+ * VSdsp's flush and the search for the track's next frame are too long for an
+ * interrupt. Called by available(), getState() and stopTrack(), this then
+ * returns to the track with endEffect() and resumes its refill.
+ */
+void SFEMP3Shield::serviceEffect() {
 
-  uint16_t MP3Mode = Mp3ReadRegister(SCI_MODE);
-  Serial.print(F("\t0x"));
-  Serial.print(MP3Mode, HEX);
+  if(!effect_ended) return;
+  effect_ended = false;
 
-  uint16_t MP3Status = Mp3ReadRegister(SCI_STATUS);
-  Serial.print(F("\t0x"));
-  Serial.print(MP3Status, HEX);
+  if(endEffect()) {
+    refill();
+    if(playing_state == playback) enableRefill();
+  }
+}
 
-  uint16_t MP3Clock = Mp3ReadRegister(SCI_CLOCKF);
-  Serial.print(F("\t0x"));
-  Serial.print(MP3Clock, HEX);
+// @}
+// Effect_Group
 
-  uint16_t MP3para_version = Mp3ReadWRAM(para_version);
-  Serial.print(F("\t0x"));
-  Serial.print(MP3para_version, HEX);
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// Event_Group
 
-  uint16_t MP3ByteRate = Mp3ReadWRAM(para_byteRate);
-  Serial.print(F("\t\t"));
-  Serial.print(MP3ByteRate, HEX);
+//------------------------------------------------------------------------------
+/**
+ * \brief Post an event to the queue
+ *
+ * \param[in] event to be posted.
+ *
+ * Events are posted either by refill(), or by the sketch's side with refill()
+ * disabled. So there is only ever one writer of event_head, and the queue
+ * needs no locking. An event posted to a full queue is dropped.
+ */
+void SFEMP3Shield::postEvent(event_m event) {
+  uint8_t head = (event_head + 1) & (MP3_EVENT_QUEUE_SIZE - 1);
 
-  Serial.print(F("\t\t"));
-  Serial.print((MP3ByteRate>>7), DEC); // shift 7 is the same as *8/1024, and easier math.
+  if(head == event_tail) return; // full
 
-  uint16_t MP3playSpeed = Mp3ReadWRAM(para_playSpeed);
-  Serial.print(F("\t\t"));
-  Serial.print(MP3playSpeed, HEX);
+  event_queue[event_head] = event;
+  event_head = head;
+}
 
-  uint16_t MP3SCI_DECODE_TIME = Mp3ReadRegister(SCI_DECODE_TIME);
-  Serial.print(F("\t\t"));
-  Serial.print(MP3SCI_DECODE_TIME, DEC);
+//------------------------------------------------------------------------------
+/**
+ * \brief Get the next event
+ *
+ * Takes the oldest event from the queue, for sketches polling in loop()
+ * rather than using setEventCallback().
+ *
+ * \return the event, or event_none if there are none.
+ */
+event_m SFEMP3Shield::getEvent() {
+  uint8_t tail = event_tail;
+  event_m event;
 
-  Serial.print(F("\t\t"));
-  Serial.print(currentPosition(), DEC);
+  if(tail == event_head) return event_none;
 
-  Serial.println();
+  event = (event_m) event_queue[tail];
+  event_tail = (tail + 1) & (MP3_EVENT_QUEUE_SIZE - 1);
+  return event;
 }
 
 //------------------------------------------------------------------------------
 /**
- * \brief Read the Bit-Rate from the current track's filehandle.
- *
- * \param[out] fileName pointer of a char array (aka string), contianing the filename
- *
- * locate the MP3 header in the current file and from there determine the
- * Bit-Rate, using bitrate_table located in flash. And return the position
- * to the prior location.
+ * \brief Set the function to be called with each event
  *
- * \note the bitrate will be updated, as read back from the VS10xx when needed.
+ * \param[in] callback to be called, or 0 for none.
  *
- * \warning This feature only works on MP3 files.
- * It will \b LOCK-UP on other file formats, looking for the MP3 header.
+ * The callback is called by available() for each event queued since, in the
+ * order they happened. Such as to start the next track on event_track_ended.
+ * As it is not called from within refill(), the callback may use any of the
+ * member functions.
  */
-void SFEMP3Shield::getBitRateFromMP3File(char* fileName) {
-  //look for first MP3 frame (11 1's)
-  bitrate = 0;
-  uint8_t temp = 0;
-  uint8_t row_num =0;
-
-    for(uint16_t i = 0; i<65535; i++) {
-      if(track.read() == 0xFF) {
+void SFEMP3Shield::setEventCallback(event_callback_t callback) {
+  event_callback = callback;
+}
 
-        temp = track.read();
+// @}
+// Event_Group
 
-        if(((temp & 0b11100000) == 0b11100000) && ((temp & 0b00000110) != 0b00000000)) {
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// RefillStats_Group
 
-          //found the 11 1's
-          //parse version, layer and bitrate out and save bitrate
-          if(!(temp & 0b00001000)) { //!true if Version 1, !false version 2 and 2.5
-            row_num = 3;
-          }
-          else if((temp & 0b00000110) == 0b00000100) { //true if layer 2, false if layer 1 or 3
-            row_num += 1;
-          }
-          else if((temp & 0b00000110) == 0b00000010) { //true if layer 3, false if layer 2 or 1
-            row_num += 2;
-          } else {
-            continue; // Not found, need to skip the rest and continue looking.
-                      // \warning But this can lead to a dead end and file end of file.
-          }
+//------------------------------------------------------------------------------
+/**
+ * \brief Get the counters of refill and register performance
+ *
+ * \param[out] stats a snapshot of the counters since resetRefillStats().
+ * All zero unless MP3_REFILL_STATS is set.
+ */
+void SFEMP3Shield::getRefillStats(refill_stats_t* stats) {
+#if MP3_REFILL_STATS
+  // refill() may be counting, typically from an interrupt.
+  cli();
+  *stats = refill_stats;
+  sei();
+#else
+  memset(stats, 0, sizeof(refill_stats_t));
+#endif
+}
 
-          //parse bitrate code from next byte
-          temp = track.read();
-          temp = temp>>4;
+//------------------------------------------------------------------------------
+/**
+ * \brief Zero the counters of refill and register performance
+ */
+void SFEMP3Shield::resetRefillStats() {
+#if MP3_REFILL_STATS
+  cli();
+  memset(&refill_stats, 0, sizeof(refill_stats));
+  sei();
+#endif
+}
 
-          //lookup bitrate
-          bitrate = pgm_read_word_near ( &(bitrate_table[temp][row_num]) );
+#if MP3_REFILL_STATS
+//------------------------------------------------------------------------------
+/**
+ * \brief Count a duration into a histogram
+ *
+ * \param[in] histogram of REFILL_STATS_BUCKETS log2 buckets.
+ * \param[in] us duration in microseconds.
+ *
+ * The buckets stop counting at their maximum, rather than wrap.
+ */
+void SFEMP3Shield::countStat(uint16_t* histogram, uint32_t us) {
+  uint8_t bucket = 0;
 
-          //convert kbps to Bytes per mS
-          bitrate /= 8;
+  while(us && (bucket < REFILL_STATS_BUCKETS - 1)) {
+    us >>= 1;
+    bucket++;
+  }
+  if(histogram[bucket] != 0xFFFF) histogram[bucket]++;
+}
+#endif
 
-          //record file position
-          track.seekCur(-3);
-          start_of_music = track.curPosition();
+// @}
+// RefillStats_Group
 
-//          Serial.print(F("POS: "));
-//          Serial.println(start_of_music);
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// @{
+// Trace_Group
 
-//          Serial.print(F("Bitrate: "));
-//          Serial.println(bitrate);
+#if MP3_TRACE_RECORDS
+//------------------------------------------------------------------------------
+/**
+ * \brief Record a trace event
+ *
+ * \param[in] type of the event, one of TRACE_SCI_READ thru TRACE_STATE.
+ * \param[in] a first field of the event.
+ * \param[in] b second field of the event.
+ * \param[in] c third field of the event.
+ *
+ * Takes the next record of the ring, overwriting the oldest, with interrupts
+ * held off only as long as to advance the index. A change of playing_state
+ * since the last event is recorded first, as a TRACE_STATE event.
+ */
+void SFEMP3Shield::trace(uint8_t type, uint8_t a, uint16_t b, uint32_t c) {
+  trace_record_t* record;
 
-          //break out of for loop
-          break;
+  if(trace_paused) return;
 
-        }
-      }
-    }
+  if(playing_state != trace_state) {
+    uint8_t old = trace_state;
+    trace_state = playing_state;
+    trace(TRACE_STATE, trace_state, old, 0);
   }
 
+#if defined(__AVR__)
+  uint8_t sreg = SREG;
+  cli();
+#endif
+  uint16_t i = trace_next++ & (MP3_TRACE_RECORDS - 1);
+  if(i == MP3_TRACE_RECORDS - 1) trace_full = true;
+#if defined(__AVR__)
+  SREG = sreg;
+#endif
+  record = &trace_ring[i];
+
+  record->time = micros();
+  record->type = type;
+  record->a = a;
+  record->b = b;
+  record->c = c;
+}
+
+#if FAT_TRACE
 //------------------------------------------------------------------------------
 /**
- * \brief get the status of the VSdsp VU Meter
- *
- * \return responds with the current value of the SS_VU_ENABLE bit of the
- * SCI_STATUS register indicating if the VU meter is enabled.
+ * \brief Record SdFat's trace events
  *
- * See data patches data sheet VU meter for details.
- * \warning This feature is only available with patches that support VU meter.
+ * Set as SdFat's fatTraceHook by begin(), recording block reads as
+ * TRACE_SD_READ and block cache misses as TRACE_CACHE_MISS.
  */
-int8_t SFEMP3Shield::getVUmeter() {
-  if(Mp3ReadRegister(SCI_STATUS) & SS_VU_ENABLE) {
-    return 1;
+void SFEMP3Shield::traceFat(uint8_t type, uint32_t lbn, uint16_t count, uint32_t us) {
+  if(type == FAT_TRACE_READ) {
+    trace(TRACE_SD_READ, count, us > 0xFFFF ? 0xFFFF : us, lbn);
+  } else {
+    trace(TRACE_CACHE_MISS, count, 0, lbn);
   }
-  return 0;
- }
+}
+#endif
+#endif
 
 //------------------------------------------------------------------------------
 /**
- * \brief enable VSdsp VU Meter
+ * \brief Send the trace to Serial
  *
- * \param[in] enable when set will enable the VU meter
- *
- * Writes the SS_VU_ENABLE bit of the SCI_STATUS register to enable VU meter on
- * board to the VSdsp.
+ * Writes the trace in binary, as to be captured to a file and rendered as a
+ * timeline by \c tools/mp3trace.pl. Being the four bytes "MP3T", a byte of
+ * the record size, two bytes of the number of records, then the records from
+ * the oldest, all little endian. Recording is paused while writing.
  *
- * See data patches data sheet VU meter for details.
- * \warning This feature is only available with patches that support VU meter.
- * \n The VU meter takes about 0.2MHz of processing power with 48 kHz samplerate.
+ * Writes an empty trace unless MP3_TRACE_RECORDS is set.
  */
-int8_t SFEMP3Shield::setVUmeter(int8_t enable) {
-  uint16_t MP3Status = Mp3ReadRegister(SCI_STATUS);
-
-  if(enable) {
-    Mp3WriteRegister(SCI_STATUS, MP3Status | SS_VU_ENABLE);
-  } else {
-    Mp3WriteRegister(SCI_STATUS, MP3Status & ~SS_VU_ENABLE);
+void SFEMP3Shield::dumpTrace() {
+  uint16_t count = 0;
+
+  Serial.write((const uint8_t*) "MP3T", 4);
+#if MP3_TRACE_RECORDS
+  trace_paused = true;
+  uint16_t next = trace_next & (MP3_TRACE_RECORDS - 1);
+  count = trace_full ? MP3_TRACE_RECORDS : next;
+  Serial.write((uint8_t) sizeof(trace_record_t));
+  Serial.write((uint8_t) count);
+  Serial.write((uint8_t) (count >> 8));
+  for(uint16_t i = 0 ; i < count ; i++) {
+    // the oldest record is the next to be overwritten.
+    Serial.write((const uint8_t*) &trace_ring[(next - count + i) & (MP3_TRACE_RECORDS - 1)], sizeof(trace_record_t));
   }
-  return 1; // in future return if not available, if patch not applied.
- }
+  trace_paused = false;
+#else
+  Serial.write((uint8_t) 0);
+  Serial.write((uint8_t) count);
+  Serial.write((uint8_t) count);
+#endif
+}
 
 //------------------------------------------------------------------------------
 /**
- * \brief get current measured VU Meter
- *
- * Returns the calculated peak sample values from both channels in 3 dB
- * increaments through. Where the high byte represent the left channel,
- * and the low bytes the right channel.
- *
- * Values from 0 to 31 are valid for both channels.
- *
- * \warning This feature is only available with patches that support VU meter.
+ * \brief Empty the trace
  */
-int16_t SFEMP3Shield::getVUlevel() {
-  return Mp3ReadRegister(SCI_AICTRL3);
+void SFEMP3Shield::clearTrace() {
+#if MP3_TRACE_RECORDS
+  cli();
+  trace_next = 0;
+  trace_full = false;
+  sei();
+#endif
 }
 
 // @}
-// Audio_Information_Group
+// Trace_Group
 
 //------------------------------------------------------------------------------
 /**
@@ -1811,6 +5662,7 @@ void SFEMP3Shield::Mp3WriteRegister(uint8_t addressbyte, uint16_t data) {
  * to the VSdsp's registers. Where the value write is Big Endian (MSB first).
  */
 void SFEMP3Shield::Mp3WriteRegister(uint8_t addressbyte, uint8_t highbyte, uint8_t lowbyte) {
+  REFILL_STAT(uint32_t stat_start = micros());
 
   // skip if the chip is in reset.
   if(!digitalRead(MP3_RESET)) return;
@@ -1820,7 +5672,7 @@ void SFEMP3Shield::Mp3WriteRegister(uint8_t addressbyte, uint8_t highbyte, uint8
     disableRefill();
 
   //Wait for DREQ to go high indicating IC is available
-  while(!digitalRead(MP3_DREQ)) ;
+  while(!digitalRead(MP3_DREQ)) REFILL_STAT(refill_stats.dreqSpins++);
 
   cs_low(); //Select control
 
@@ -1829,8 +5681,9 @@ void SFEMP3Shield::Mp3WriteRegister(uint8_t addressbyte, uint8_t highbyte, uint8
   SPI.transfer(addressbyte);
   SPI.transfer(highbyte);
   SPI.transfer(lowbyte);
-  while(!digitalRead(MP3_DREQ)) ; //Wait for DREQ to go high indicating command is complete
+  while(!digitalRead(MP3_DREQ)) REFILL_STAT(refill_stats.dreqSpins++); //Wait for DREQ to go high indicating command is complete
   cs_high(); //Deselect Control
+  MP3_TRACE(trace(TRACE_SCI_WRITE, addressbyte, (highbyte << 8) | lowbyte, 0));
 
   //resume interrupt if playing.
   if(playing_state == playback) {
@@ -1841,6 +5694,8 @@ void SFEMP3Shield::Mp3WriteRegister(uint8_t addressbyte, uint8_t highbyte, uint8
     enableRefill();
   }
 
+  REFILL_STAT(stat_start = micros() - stat_start);
+  REFILL_STAT(if(stat_start > refill_stats.maxBlocking) refill_stats.maxBlocking = stat_start);
 }
 
 //------------------------------------------------------------------------------
@@ -1854,6 +5709,7 @@ void SFEMP3Shield::Mp3WriteRegister(uint8_t addressbyte, uint8_t highbyte, uint8
  * to the VSdsp's registers.
  */
 uint16_t SFEMP3Shield::Mp3ReadRegister (uint8_t addressbyte){
+  REFILL_STAT(uint32_t stat_start = micros());
 
   union twobyte resultvalue;
 
@@ -1864,7 +5720,7 @@ uint16_t SFEMP3Shield::Mp3ReadRegister (uint8_t addressbyte){
   if(playing_state == playback)
     disableRefill();
 
-  while(!digitalRead(MP3_DREQ)) ; //Wait for DREQ to go high indicating IC is available
+  while(!digitalRead(MP3_DREQ)) REFILL_STAT(refill_stats.dreqSpins++); //Wait for DREQ to go high indicating IC is available
 
   cs_low(); //Select control
   SPI.setClockDivider(spi_Read_Rate); // correct the clock speed as from cs_low()
@@ -1874,11 +5730,12 @@ uint16_t SFEMP3Shield::Mp3ReadRegister (uint8_t addressbyte){
   SPI.transfer(addressbyte);
 
   resultvalue.byte[1] = SPI.transfer(0xFF); //Read the first byte
-  while(!digitalRead(MP3_DREQ)) ; //Wait for DREQ to go high indicating command is complete
+  while(!digitalRead(MP3_DREQ)) REFILL_STAT(refill_stats.dreqSpins++); //Wait for DREQ to go high indicating command is complete
   resultvalue.byte[0] = SPI.transfer(0xFF); //Read the second byte
-  while(!digitalRead(MP3_DREQ)) ; //Wait for DREQ to go high indicating command is complete
+  while(!digitalRead(MP3_DREQ)) REFILL_STAT(refill_stats.dreqSpins++); //Wait for DREQ to go high indicating command is complete
 
   cs_high(); //Deselect Control
+  MP3_TRACE(trace(TRACE_SCI_READ, addressbyte, resultvalue.word, 0));
 
   //resume interrupt if playing.
   if(playing_state == playback) {
@@ -1888,6 +5745,9 @@ uint16_t SFEMP3Shield::Mp3ReadRegister (uint8_t addressbyte){
     //attach refill interrupt off DREQ line, pin 2
     enableRefill();
   }
+
+  REFILL_STAT(stat_start = micros() - stat_start);
+  REFILL_STAT(if(stat_start > refill_stats.maxBlocking) refill_stats.maxBlocking = stat_start);
   return resultvalue.word;
 }
 
@@ -1927,6 +5787,26 @@ uint16_t SFEMP3Shield::Mp3ReadWRAM (uint16_t addressbyte){
   return tmp1;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Read consecutive VS10xx WRAM Locations
+ *
+ * \param[in] addressbyte of the VSdsp's first WRAM location to be read
+ * \param[out] words read from the WRAM
+ * \param[in] count of words to be read
+ *
+ * Writes SCI_WRAMADDR once, then reads SCI_WRAM \p count times, as the VSdsp
+ * increments the address after each read. Such that the words of a 32 bit
+ * value are read together.
+ */
+void SFEMP3Shield::Mp3ReadWRAM(uint16_t addressbyte, uint16_t* words, uint8_t count){
+
+  Mp3WriteRegister(SCI_WRAMADDR, addressbyte);
+  for(uint8_t i = 0 ; i < count ; i++) {
+    words[i] = Mp3ReadRegister(SCI_WRAM);
+  }
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief Write a VS10xx WRAM Location
@@ -1949,6 +5829,8 @@ void SFEMP3Shield::Mp3WriteWRAM(uint16_t addressbyte, uint16_t data){
  *
  * Serves as a helper as to correspondingly run either the timer service or run
  * the refill() direclty, depending upon the configured means for refilling.
+ * And steps any fade of the volume, with serviceFade(). Then passes any events
+ * queued to the callback of setEventCallback().
  */
 void SFEMP3Shield::available() {
 #if defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_SimpleTimer
@@ -1956,6 +5838,16 @@ void SFEMP3Shield::available() {
 #elif defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_Polled
   refill();
 #endif
+  serviceEffect();
+  if(fade_owner) fade_owner->serviceFade();
+  if(scan_owner) scan_owner->serviceScan();
+
+  if(event_callback) {
+    event_m event;
+    while((event = getEvent()) != event_none) {
+      event_callback(event);
+    }
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -1971,8 +5863,17 @@ void SFEMP3Shield::available() {
  * When the filehandle's track indicates it is at the end of file. The track is
  * closed, the playing indicator is set to false, interrupts for refilling are
  * disabled and the VSdsp's data stream buffer is flushed appropiately.
+ *
+ * While playStream() is streaming, the bytes are sent directly from the
+ * sketch's buffer instead, stopping early when it runs empty. And while a
+ * sound effect preempts the track, the bytes are of the effect, where at its
+ * end serviceEffect() is left to return to the track.
  */
 void SFEMP3Shield::refill() {
+  REFILL_STAT(uint32_t stat_start = micros());
+  REFILL_STAT(uint16_t stat_chunks = 0);
+  MP3_TRACE(uint16_t trace_bytes = 0);
+  MP3_TRACE(trace(TRACE_DREQ, digitalRead(MP3_DREQ), 0, 0));
 
   //Serial.println(F("filling"));
 #if PERF_MON_PIN != -1
@@ -1985,19 +5886,73 @@ void SFEMP3Shield::refill() {
 #endif
 
   while(digitalRead(MP3_DREQ)) {
+    uint8_t* src = mp3DataBuffer;
+    uint8_t n = sizeof(mp3DataBuffer);
+
+    if(effect_source) {
+      n = readEffect(&src);
+      if(!n) {
+        // back to the track by serviceEffect(), out of the interrupt.
+        playing_state = ready;
+        effect_ended = true;
+        disableRefill();
+        break;
+      }
+    }
+    else if(stream_buffer) {
+      uint16_t level = (stream_head >= stream_tail ? 0 : stream_size) + stream_head - stream_tail;
+
+      if(stream_callback && (level < stream_low)) {
+        // contiguous free space, keeping one byte free.
+        uint16_t space = (stream_tail > stream_head) ? stream_tail - stream_head - 1 :
+                         stream_size - stream_head - (stream_tail ? 0 : 1);
+        uint16_t head = stream_head + stream_callback(stream_buffer + stream_head, space);
+        stream_head = (head >= stream_size) ? head - stream_size : head;
+        level = (stream_head >= stream_tail ? 0 : stream_size) + stream_head - stream_tail;
+      }
+
+      // send straight from the sketch's buffer, up to its wrap.
+      if(!level) {
+        if(!stream_starved) postEvent(event_underrun);
+        stream_starved = true;
+        break; // starved, streamCommit() will call again.
+      }
+      stream_starved = false;
+      if(level > stream_size - stream_tail) level = stream_size - stream_tail;
+      if(level < n) n = level;
+      src = stream_buffer + stream_tail;
+    }
+    else {
+#if TRACK_JUMPS
+      while(jump_next < jump_count) {
+        // past the headers replayed by primeTrack(), on to the seeked frames.
+        uint32_t pos = track.curPosition();
+        if(pos < jump_from[jump_next]) {
+          if(jump_from[jump_next] - pos < n) n = jump_from[jump_next] - pos;
+          break;
+        }
+        track.seekSet(jump_to[jump_next++]);
+      }
+#endif
+      REFILL_STAT(uint32_t stat_read = micros());
+      int got = track.read(mp3DataBuffer, n); //Go out to SD card and try reading 32 new bytes of the song
+      REFILL_STAT(countStat(refill_stats.readHistogram, micros() - stat_read));
 
-    if(!track.read(mp3DataBuffer, sizeof(mp3DataBuffer))) { //Go out to SD card and try reading 32 new bytes of the song
-      track.close(); //Close out this track
-      playing_state = ready;
+      if(got <= 0) {
+        track.close(); //Close out this track
+        playing_state = ready;
 
-      //cancel external interrupt
-      disableRefill();
+        //cancel external interrupt
+        disableRefill();
 
-      flush_cancel(post); //possible mode of "none" for faster response.
+        flush_cancel(post); //possible mode of "none" for faster response.
+        postEvent(event_track_ended);
 
-      //Oh no! There is no data left to read!
-      //Time to exit
-      break;
+        //Oh no! There is no data left to read!
+        //Time to exit
+        break;
+      }
+      n = got; // short at the end of the track.
     }
 
 
@@ -2006,23 +5961,63 @@ void SFEMP3Shield::refill() {
     cli(); // allow transfer to occur with out interruption.
 #endif
     dcs_low(); //Select Data
-    for(uint8_t y = 0 ; y < sizeof(mp3DataBuffer) ; y++) {
+    for(uint8_t y = 0 ; y < n ; y++) {
       //while(!digitalRead(MP3_DREQ)); // wait until DREQ is or goes high // turns out it is not needed.
-      SPI.transfer(mp3DataBuffer[y]); // Send SPI byte
+      SPI.transfer(src[y]); // Send SPI byte
     }
 
     dcs_high(); //Deselect Data
+    if(stream_buffer) {
+      stream_tail = (stream_tail + n == stream_size) ? 0 : stream_tail + n;
+    }
+    REFILL_STAT(refill_stats.bytes += n);
+    REFILL_STAT(stat_chunks++);
+    MP3_TRACE(trace_bytes += n);
     //We've just dumped 32 bytes into VS1053 so our SD read buffer is empty. go get more data
 #if !defined(USE_MP3_REFILL_MEANS) || USE_MP3_REFILL_MEANS == USE_MP3_INTx
     sei();
 #endif
   }
 
+  MP3_TRACE(if(trace_bytes) trace(TRACE_SDI, 0, trace_bytes, 0));
+
+#if MP3_REFILL_STATS
+  uint32_t stat_time = micros() - stat_start;
+  refill_stats.calls++;
+  refill_stats.chunks += stat_chunks;
+  if(stat_chunks > refill_stats.maxChunks) refill_stats.maxChunks = stat_chunks;
+  if(stat_time > refill_stats.maxRefill) refill_stats.maxRefill = stat_time;
+  countStat(refill_stats.refillHistogram, stat_time);
+#endif
+
 #if PERF_MON_PIN != -1
   digitalWrite(PERF_MON_PIN,HIGH);
 #endif
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Send bytes to the VSdsp's data stream
+ *
+ * \param[in] data to be sent.
+ * \param[in] size of the data in bytes.
+ *
+ * Waiting for DREQ every 32 bytes. For short headers ahead of refill(), which
+ * is to be disabled.
+ */
+void SFEMP3Shield::sendData(const uint8_t* data, uint16_t size) {
+
+  dcs_low(); //Select Data
+  for(uint16_t y = 0 ; y < size ; y++) {
+    // Every 32 check if not ready for next buffer chunk.
+    if ( !(y % 32) ) {
+      while(!digitalRead(MP3_DREQ));
+    }
+    SPI.transfer(data[y]);
+  }
+  dcs_high(); //Deselect Data
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief Play hardcoded MIDI file
@@ -2035,7 +6030,7 @@ void SFEMP3Shield::refill() {
  */
 void SFEMP3Shield::SendSingleMIDInote() {
 
-  if(!digitalRead(MP3_RESET))
+  if(!digitalRead(MP3_RESET) || (playing_state == realtime_midi))
     return;
 
   //cancel and store current state to restore after
@@ -2161,6 +6156,7 @@ void SFEMP3Shield::flush_cancel(flush_m mode) {
         }
         dcs_high(); //Deselect Data
       }
+      postEvent(event_cancel_complete);
       return;
     }
   }
@@ -2173,6 +6169,32 @@ void SFEMP3Shield::flush_cancel(flush_m mode) {
 }
 
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Prepare the VSdsp for a jump of the data stream
+ *
+ * As per the datasheet's fast forward and rewind, for the formats whose frames
+ * carry their own sync, such as MP3, ADTS AAC and WMA. para_resync is set such
+ * that the VSdsp searches the data following the jump for its next frame,
+ * rather than taking it as a broken stream. And the frame cut short by the
+ * jump is ended with a buffer of endFillByte. So the data before the jump in
+ * the VSdsp's stream buffer still plays, with no cancel, mute or delay.
+ *
+ * \note As resync is set, the track must still end with flush_cancel().
+ */
+void SFEMP3Shield::jumpResync() {
+  uint8_t endFillByte = (uint8_t) (Mp3ReadWRAM(para_endFillByte) & 0xFF);
+
+  Mp3WriteWRAM(para_resync, 32767); // resync for as long as it takes.
+
+  dcs_low(); //Select Data
+  while(!digitalRead(MP3_DREQ)); // wait until DREQ is or goes high
+  for(uint8_t y = 0 ; y < sizeof(mp3DataBuffer) ; y++) {
+    SPI.transfer(endFillByte); // Send SPI byte
+  }
+  dcs_high(); //Deselect Data
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief Initially load ADMixer patch and configure line/mic mode
@@ -2284,23 +6306,11 @@ char* strip_nonalpha_inplace(char *s) {
  * \brief is the filename music
  *
  * \param[in] filename inspects the end of the filename to be of the extension types
- *            that VS10xx can decode.
+ *            that VS10xx can decode, which is not modified.
  *
  * \return boolean true indicating that it is music
  */
-bool isFnMusic(char* filename) {
-  int8_t len = strlen(filename);
-  bool result;
-  if (  strstr(strlwr(filename + (len - 4)), ".mp3")
-     || strstr(strlwr(filename + (len - 4)), ".aac")
-     || strstr(strlwr(filename + (len - 4)), ".wma")
-     || strstr(strlwr(filename + (len - 4)), ".wav")
-     || strstr(strlwr(filename + (len - 4)), ".fla")
-     || strstr(strlwr(filename + (len - 4)), ".mid")
-    ) {
-    result = true;
-  } else {
-    result = false;
-  }
-  return result;
+bool isFnMusic(const char* filename) {
+
+  return formatFromFilename(filename) != format_unknown;
 }
\ No newline at end of file
@@ -40,6 +40,8 @@ enum state_m {
   paused_playback,
   testing_memory,
   testing_sinewave,
+  recording,
+  realtime_midi,
   }; //enum state_m
 
 /** \brief How to flush the VSdsp's buffer
@@ -80,6 +82,208 @@ enum flush_m {
   none
   }; //enum flush_m
 
+/** \brief Audio format of a file or stream
+ *
+ * Used to describe the encoding of a track, such as recorded into the
+ * track_index_t of the on-card music library index.
+ */
+enum audio_format_m {
+  format_unknown,
+  format_mp3,
+  format_aac,
+  format_wma,
+  format_wav,
+  format_flac,
+  format_midi,
+  format_ogg
+  }; //enum audio_format_m
+
+/**
+ * \brief Bytes from the start of a file needed to detect its audio_format_m
+ *
+ * As inspected by the content based detection of SFEMP3Shield::playMP3(),
+ * from the first block being read for playback anyway.
+ */
+#define FORMAT_SNIFF_SIZE 12
+
+/**
+ * \brief Largest "fmt " chunk of a WAV file to be seeked exactly
+ *
+ * Enough for PCM and IMA ADPCM. As kept to rebuild the header sent by
+ * SFEMP3Shield::skipTo() ahead of the seeked to samples.
+ */
+#define WAV_FMT_SIZE 20
+
+/**
+ * \brief Most bisection steps of a FLAC or Ogg seek
+ *
+ * Each step scans for the next frame or page, bounding the SdCard reads of
+ * SFEMP3Shield::skipTo(), as reported by SFEMP3Shield::getSeekReads().
+ */
+#define SEEK_BISECT_STEPS 24
+
+/**
+ * \brief Most bytes scanned for a FLAC frame or Ogg page, per bisection step
+ */
+#define SEEK_SCAN_BYTES 16384
+
+/**
+ * \brief Most jumps of the track queued by SFEMP3Shield::primeTrack()
+ *
+ * As to replay the headers of an Ogg or MP4 track ahead of the seeked frames,
+ * feeding an MP4 track's trailing moov box ahead of its mdat box. None without
+ * MP3_SEEK_FLAC or MP3_SEEK_MP4.
+ */
+#if MP3_SEEK_FLAC || MP3_SEEK_MP4
+#define TRACK_JUMPS 4
+#else
+#define TRACK_JUMPS 0
+#endif
+
+/** \brief Events of the SFEMP3Shield device
+ *
+ * Queued as they happen, including from within SFEMP3Shield::refill(). And
+ * taken with SFEMP3Shield::getEvent() or passed to the callback of
+ * SFEMP3Shield::setEventCallback() by SFEMP3Shield::available().
+ */
+enum event_m {
+  event_none,
+  event_track_ended,
+  event_underrun,
+  event_seek_complete,
+  event_cancel_complete,
+  event_plugin_loaded,
+  event_effect_ended
+  }; //enum event_m
+
+/**
+ * \brief Receiver of the events of SFEMP3Shield::setEventCallback().
+ */
+typedef void (*event_callback_t)(event_m);
+
+/**
+ * \brief Number of log2 buckets of the histograms of refill_stats_t.
+ */
+#define REFILL_STATS_BUCKETS 16
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Counters of the refill and register performance.
+ *
+ * Filled in by SFEMP3Shield::getRefillStats(), when MP3_REFILL_STATS is set.
+ * Histogram bucket n counts durations of 2^(n-1) up to 2^n microseconds,
+ * bucket 0 those under a microsecond and the last everything longer.
+ */
+struct refill_stats_t {
+
+/** \brief bytes sent to the VSdsp's data stream by refill().*/
+  uint32_t bytes;
+
+/** \brief calls of refill().*/
+  uint32_t calls;
+
+/** \brief 32 byte chunks sent, over all calls of refill().*/
+  uint32_t chunks;
+
+/** \brief most chunks sent by one call of refill().*/
+  uint16_t maxChunks;
+
+/** \brief polls of DREQ while the register functions waited on the VSdsp.*/
+  uint32_t dreqSpins;
+
+/** \brief longest call of refill(), in microseconds.*/
+  uint32_t maxRefill;
+
+/** \brief longest the sketch was blocked in a register function, in microseconds.*/
+  uint32_t maxBlocking;
+
+/** \brief durations of refill(), in log2 buckets of microseconds.*/
+  uint16_t refillHistogram[REFILL_STATS_BUCKETS];
+
+/** \brief durations of the SdCard reads of refill(), in log2 buckets of microseconds.*/
+  uint16_t readHistogram[REFILL_STATS_BUCKETS];
+};
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Types of the trace records, with the meaning of their fields.
+ */
+#define TRACE_SCI_READ   1 ///< a register, b value read.
+#define TRACE_SCI_WRITE  2 ///< a register, b value written.
+#define TRACE_SDI        3 ///< b bytes sent by one refill().
+#define TRACE_DREQ       4 ///< a DREQ, as refill() is called.
+#define TRACE_SD_READ    5 ///< a blocks, b microseconds, c first block read.
+#define TRACE_CACHE_MISS 6 ///< a cache option, c block missed.
+#define TRACE_STATE      7 ///< a new playing_state, b old.
+
+/**
+ * \brief A record of the trace of SFEMP3Shield::dumpTrace().
+ */
+struct trace_record_t {
+
+/** \brief micros() of the event.*/
+  uint32_t time;
+
+/** \brief one of TRACE_SCI_READ thru TRACE_STATE.*/
+  uint8_t type;
+
+/** \brief first field, as of the type.*/
+  uint8_t a;
+
+/** \brief second field, as of the type.*/
+  uint16_t b;
+
+/** \brief third field, as of the type.*/
+  uint32_t c;
+};
+
+//------------------------------------------------------------------------------
+/**
+ * \brief A snapshot of the VSdsp's audio information
+ *
+ * Filled in by SFEMP3Shield::getAudioInfo(audio_info_t*), with the
+ * registers read together. Decoded by SFEMP3Shield::audioFormat(),
+ * SFEMP3Shield::audioSampleRate() and SFEMP3Shield::audioChannels().
+ */
+struct audio_info_t {
+
+/** \brief SCI_HDAT0, the header of the stream.*/
+  uint16_t hdat0;
+
+/** \brief SCI_HDAT1, the header of the stream, or format.*/
+  uint16_t hdat1;
+
+/** \brief SCI_AUDATA, the sample rate and channels.*/
+  uint16_t audata;
+
+/** \brief SCI_VOL, the volume.*/
+  uint16_t volume;
+
+/** \brief SCI_MODE.*/
+  uint16_t mode;
+
+/** \brief SCI_STATUS.*/
+  uint16_t status;
+
+/** \brief SCI_CLOCKF.*/
+  uint16_t clockf;
+
+/** \brief para_version, of the VSdsp's extra parameters.*/
+  uint16_t version;
+
+/** \brief para_byteRate, in bytes per second.*/
+  uint16_t byteRate;
+
+/** \brief para_playSpeed.*/
+  uint16_t playSpeed;
+
+/** \brief SCI_DECODE_TIME, in seconds.*/
+  uint16_t decodeTime;
+
+/** \brief the track's file position, in bytes.*/
+  uint32_t position;
+};
+
 //------------------------------------------------------------------------------
 /** \name External_Variable_Group
  *  External Variables accessed by other files.
@@ -577,7 +781,7 @@ extern SdFat sd;
  * \brief A macro of the WRAM para_positionMsec_0 register's address (R/W)
  *
  * para_positionMsec_0 is a Read/Write Extra Parameter in X memory, accessed indirectly
- * with the SCI_WRAMADDR and SCI_WRAM. Corresponding to the high 16 bit value of positionMsec
+ * with the SCI_WRAMADDR and SCI_WRAM. Corresponding to the low 16 bit value of positionMsec
  *
  * positionMsec is a field that gives the current play position in a file in milliseconds, regardless
  * of rewind and fast forward operations. The value is only available in codecs that can determine
@@ -609,6 +813,9 @@ extern SdFat sd;
  * The resync field is set to 32767 after a reset to make resynchronization the default action, but
  * it can be cleared after reset to restore the old action. When resync is set, every file decode
  * should always end as described in Chapter 9.5.1.
+ *
+ * Set by SFEMP3Shield::jumpResync() ahead of the jumps of SFEMP3Shield::skip()
+ * and SFEMP3Shield::skipTo().
  */
 #define para_resync         0x1E29
 
@@ -657,6 +864,189 @@ extern SdFat sd;
  *  /@}
  */
 
+//------------------------------------------------------------------------------
+/**
+ * \brief A record of the on-card music library index.
+ *
+ * SFEMP3Shield::buildTrackIndex() writes one of these fixed size records per
+ * audio file into MP3_INDEX_FILENAME, sorted by name. Four records fit into
+ * each 512 byte block of the SdCard, so that any record may be fetched with a
+ * single block read, without the need of opening the audio file itself.
+ *
+ * \note The first record slot of the file is used by the header of the index.
+ */
+struct track_index_t {
+
+/** \brief long filename cut to 39 characters, or short filename, zero terminated, sorted on with dirIndex.*/
+  char     name[40];
+
+/** \brief ID3 Title of the track, zero terminated, if present.*/
+  char     title[32];
+
+/** \brief ID3 Artist of the track, zero terminated, if present.*/
+  char     artist[32];
+
+/** \brief first cluster of the file on the volume.*/
+  uint32_t firstCluster;
+
+/** \brief size of the file in bytes.*/
+  uint32_t fileSize;
+
+/** \brief estimated duration of the track in milliseconds.*/
+  uint32_t duration;
+
+/** \brief index of the file's entry within its directory.*/
+  uint16_t dirIndex;
+
+/** \brief directory entry's modify date, used for incremental rebuilds.*/
+  uint16_t modifyDate;
+
+/** \brief directory entry's modify time, used for incremental rebuilds.*/
+  uint16_t modifyTime;
+
+/** \brief bit-rate of the track in kbits per second, or zero if unknown.*/
+  uint16_t bitrate;
+
+/** \brief one of audio_format_m.*/
+  uint8_t  format;
+
+/** \brief padding to keep the records block aligned.*/
+  uint8_t  reserved[3];
+};
+
+//------------------------------------------------------------------------------
+/**
+ * \brief A slot of the cache of trackNNN.mp3 directory entries.
+ *
+ * Used by SFEMP3Shield::playTrack() to open a track straight from its
+ * directory entry, without searching the directory by name.
+ */
+struct track_cache_t {
+
+/** \brief number of the track, or TRACK_CACHE_EMPTY if unused.*/
+  uint16_t number;
+
+/** \brief index of the track's entry within the current working directory.*/
+  uint16_t dirIndex;
+};
+
+/**
+ * \brief Marks an unused slot of track_cache_t.
+ */
+#define TRACK_CACHE_EMPTY 0xFFFF
+
+//------------------------------------------------------------------------------
+/**
+ * \brief A point of the seek index of an MP4 track.
+ *
+ * Sampled from the chunk offsets by SFEMP3Shield::playMP3(), such that
+ * SFEMP3Shield::skipTo() starts from the nearest chunk of the index, rather
+ * than walking the sample tables from the first chunk.
+ */
+struct seek_point_t {
+
+/** \brief number of the first sample of the chunk.*/
+  uint32_t sample;
+
+/** \brief file position of the chunk.*/
+  uint32_t offset;
+};
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Statistics of the SdCard writes of a recording.
+ *
+ * Filled in by SFEMP3Shield::getRecordStats(), for judging whether the
+ * MP3_RECORD_BLOCKS buffer covers the SdCard's slowest writes.
+ */
+struct record_stats_t {
+
+/** \brief blocks written to the SdCard.*/
+  uint32_t blocks;
+
+/** \brief longest the SdCard stayed busy after a block, in microseconds.*/
+  uint32_t maxBusy;
+
+/** \brief times the buffer was full and the next block had to wait for the SdCard.*/
+  uint16_t stalls;
+
+/** \brief checkpoints of the WAV header written.*/
+  uint16_t checkpoints;
+
+/** \brief most full blocks waiting to be written.*/
+  uint8_t  maxQueued;
+};
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Supplier of the samples of SFEMP3Shield::playStream().
+ *
+ * Given where and how many bytes may be written into the stream's buffer,
+ * returns how many bytes of samples it put there. Called from within
+ * SFEMP3Shield::refill(), typically an interrupt.
+ */
+typedef uint16_t (*stream_callback_t)(uint8_t*, uint16_t);
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Statistics of the real-time MIDI messages.
+ *
+ * Filled in by SFEMP3Shield::getMIDIStats(). Latencies are measured from the
+ * queuing of the oldest waiting Note On to the end of the burst sending it.
+ */
+struct midi_stats_t {
+
+/** \brief messages sent to the VSdsp.*/
+  uint32_t messages;
+
+/** \brief bursts of messages sent to the VSdsp.*/
+  uint32_t bursts;
+
+/** \brief latency of the last Note On sent, in microseconds.*/
+  uint32_t lastLatency;
+
+/** \brief longest latency of a Note On, in microseconds.*/
+  uint32_t maxLatency;
+
+/** \brief messages refused as the queue was full.*/
+  uint16_t overflows;
+};
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Sources of a sound effect, as held by SFEMP3Shield::effect_source.
+ */
+#define EFFECT_NONE    0
+#define EFFECT_RAM     1
+#define EFFECT_PROGMEM 2
+#define EFFECT_FILE    3
+
+/**
+ * \brief Value of SFEMP3Shield::effect_resume for no track to return to.
+ */
+#define EFFECT_NO_RESUME 0xFFFFFFFF
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Actions at the end of a fade, as held by SFEMP3Shield::fade_action.
+ */
+#define FADE_NONE 0
+#define FADE_STOP 1
+#define FADE_NEXT 2
+
+/**
+ * \brief Attenuation of a fade in -1/2dB steps, as to be silent.
+ */
+#define FADE_SILENT 0xFE
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Sources of the millisecond position, as held by SFEMP3Shield::pos_mode.
+ */
+#define POSITION_UNKNOWN     0
+#define POSITION_MSEC        1
+#define POSITION_DECODE_TIME 2
+
 //------------------------------------------------------------------------------
 /**
  * \class SFEMP3Shield
@@ -680,6 +1070,8 @@ class SFEMP3Shield {
     void setBassAmplitude(uint8_t);
     void setPlaySpeed(uint16_t);
     uint16_t getPlaySpeed();
+    uint8_t scanTrack(int8_t);
+    int8_t getScanSpeed();
     uint16_t getVolume();
     uint8_t getEarSpeaker();
     state_m getState();
@@ -688,8 +1080,10 @@ class SFEMP3Shield {
     void setMonoMode(uint16_t );
     void setDifferentialOutput(uint16_t);
     uint8_t getDifferentialOutput();
-    uint8_t playTrack(uint8_t, uint32_t timecode = 0);
+    uint8_t playTrack(uint16_t, uint32_t timecode = 0);
     uint8_t playMP3(char*, uint32_t timecode = 0);
+    uint8_t playDirIndex(uint16_t, uint32_t timecode = 0);
+    uint8_t playIndexedTrack(uint16_t, uint32_t timecode = 0);
     void trackTitle(char*);
     void trackArtist(char*);
     void trackAlbum(char*);
@@ -698,6 +1092,13 @@ class SFEMP3Shield {
     uint8_t skip(int32_t);
     uint8_t skipTo(uint32_t);
     uint32_t currentPosition();
+    uint32_t getPositionMsec();
+    static event_m getEvent();
+    void setEventCallback(event_callback_t);
+    void getRefillStats(refill_stats_t*);
+    void resetRefillStats();
+    void dumpTrace();
+    void clearTrace();
     void setBitRate(uint16_t);
     void pauseDataStream();
     void resumeDataStream();
@@ -706,6 +1107,12 @@ class SFEMP3Shield {
     uint8_t resumeMusic(uint32_t);
     static void available();
     void getAudioInfo();
+    void getAudioInfo(audio_info_t*);
+    uint8_t getTrackFormat();
+    uint16_t getSeekReads();
+    static audio_format_m audioFormat(const audio_info_t*);
+    static uint16_t audioSampleRate(const audio_info_t*);
+    static uint8_t audioChannels(const audio_info_t*);
     uint8_t enableTestSineWave(uint8_t);
     uint8_t disableTestSineWave();
     uint16_t memoryTest();
@@ -715,11 +1122,159 @@ class SFEMP3Shield {
     int8_t setVUmeter(int8_t);
     int16_t getVUlevel();
     void SendSingleMIDInote();
+    uint8_t buildTrackIndex();
+    uint16_t getTrackIndexCount();
+    uint8_t getIndexedTrack(uint16_t, track_index_t*);
+    int32_t findIndexedTrack(const char*, track_index_t*);
+    uint8_t startRecording(char*, uint32_t, uint16_t sampleRate = 8000, uint8_t lineIn = 0);
+    uint8_t serviceRecording();
+    uint8_t stopRecording();
+    void getRecordStats(record_stats_t*);
+    uint8_t playStream(uint8_t*, uint16_t, uint16_t, uint8_t channels = 1, uint8_t bits = 16,
+                       stream_callback_t callback = 0, uint16_t lowWater = 0);
+    uint16_t streamLevel();
+    uint16_t streamSpace(uint8_t**);
+    void streamCommit(uint16_t);
+    uint16_t streamWrite(const uint8_t*, uint16_t);
+    uint8_t startMIDI();
+    uint8_t stopMIDI();
+    uint8_t midiNoteOn(uint8_t, uint8_t, uint8_t velocity = 127);
+    uint8_t midiNoteOff(uint8_t, uint8_t, uint8_t velocity = 0);
+    uint8_t midiProgramChange(uint8_t, uint8_t);
+    uint8_t midiControlChange(uint8_t, uint8_t, uint8_t);
+    uint8_t midiPitchBend(uint8_t, int16_t);
+    uint8_t flushMIDI();
+    void getMIDIStats(midi_stats_t*);
+    uint8_t playEffect(const uint8_t*, uint16_t);
+    uint8_t playEffect_P(const uint8_t*, uint16_t);
+    uint8_t playEffectFile(char*);
+    void setFadeTime(uint16_t);
+    void fadeIn(uint16_t);
+    void fadeOut(uint16_t, bool stop = false);
+    uint8_t fadeToMP3(char*, uint16_t);
+    bool isFading();
 
   private:
     static SdFile track;
+#if USE_FAT_EXTENT_MAP
+    static FatExtent track_extent[MP3_EXTENT_MAP_SIZE];
+#endif
+#if USE_FAT_READ_AHEAD && MP3_READ_AHEAD_BLOCKS
+    static uint8_t track_window[512 * MP3_READ_AHEAD_BLOCKS];
+#endif
+#if USE_FAT_NAME_HASH && MP3_NAME_HASH_SIZE
+    static FatNameHash name_hash[MP3_NAME_HASH_SIZE];
+#endif
+#if MP3_TRACK_INDEX
+    static SdFile index_file;
+    static uint16_t index_count;
+    static uint32_t index_dir;
+    bool openTrackIndex();
+#endif
+#if MP3_TRACK_CACHE_SIZE
+    static track_cache_t track_cache[MP3_TRACK_CACHE_SIZE];
+    static uint32_t track_cache_dir;
+    void scanTrackCache();
+    bool openCachedTrack(uint16_t, const char*);
+#endif
+    uint8_t playOpenTrack(uint32_t);
+#if MP3_RECORD_BLOCKS
+    static uint8_t record_buffer[512 * MP3_RECORD_BLOCKS];
+    static uint16_t record_fill;
+    static uint8_t record_head;
+    static uint8_t record_queued;
+    static uint32_t record_first;
+    static uint32_t record_sent;
+    static bool record_writing;
+    bool writeRecording(bool);
+    static bool stopRecordWrite();
+#endif
+    static record_stats_t record_stats;
+    static uint32_t record_size;
+    static uint32_t record_limit;
+    static uint16_t record_rate;
+    bool readRecording();
+    bool flushRecording();
+    static uint8_t* stream_buffer;
+    static uint16_t stream_size;
+    static volatile uint16_t stream_head;
+    static volatile uint16_t stream_tail;
+    static stream_callback_t stream_callback;
+    static uint16_t stream_low;
+    static uint8_t midi_queue[MP3_MIDI_QUEUE_SIZE];
+    static volatile uint8_t midi_head;
+    static volatile uint8_t midi_tail;
+    static volatile uint32_t midi_stamp;
+    static midi_stats_t midi_stats;
+    uint8_t queueMIDI(uint8_t, uint8_t, uint8_t, uint8_t);
+#if MP3_EFFECT_FILE
+    static SdFile effect_file;
+#endif
+    static uint8_t effect_source;
+    static const uint8_t* effect_data;
+    static uint16_t effect_left;
+    static uint32_t effect_resume;
+    static state_m effect_state;
+    static uint8_t effect_header;
+    static bool effect_ended;
+    uint8_t startEffect(uint8_t);
+    static uint8_t readEffect(uint8_t**);
+    static void closeEffect(uint8_t);
+    static bool endEffect();
+    static void serviceEffect();
+    static SFEMP3Shield* fade_owner;
+    static uint8_t fade_level;
+    static uint8_t fade_from;
+    static uint8_t fade_to;
+    static uint8_t fade_action;
+    static uint16_t fade_time;
+    static uint32_t fade_start;
+    static uint16_t fade_in;
+    static char fade_next[13];
+    void writeFade(uint8_t);
+    void startFade(uint8_t, uint16_t, uint8_t);
+    static uint8_t fadeRamp();
+    void serviceFade();
+    static uint32_t pos_base;
+    static uint32_t pos_stamp;
+    static uint32_t pos_read;
+    static uint16_t pos_secs;
+    static uint8_t pos_mode;
+    static bool pos_valid;
+    static uint16_t play_speed;
+    static void restartPosition(uint8_t);
+    static SFEMP3Shield* scan_owner;
+    static int8_t scan_speed;
+    static uint16_t scan_play_speed;
+    static uint32_t scan_pos;
+    static uint32_t scan_stamp;
+    void serviceScan();
+    void endScan();
+    void scanAhead(uint16_t);
+    static volatile uint8_t event_queue[MP3_EVENT_QUEUE_SIZE];
+    static volatile uint8_t event_head;
+    static volatile uint8_t event_tail;
+    static event_callback_t event_callback;
+    static bool stream_starved;
+    static void postEvent(event_m);
+#if MP3_TRACE_RECORDS
+    static trace_record_t trace_ring[MP3_TRACE_RECORDS];
+    static volatile uint16_t trace_next;
+    static volatile bool trace_full;
+    static volatile bool trace_paused;
+    static uint8_t trace_state;
+    static void trace(uint8_t, uint8_t, uint16_t, uint32_t);
+#if FAT_TRACE
+    static void traceFat(uint8_t, uint32_t, uint16_t, uint32_t);
+#endif
+#endif
+#if MP3_REFILL_STATS
+    static refill_stats_t refill_stats;
+    static void countStat(uint16_t*, uint32_t);
+#endif
     static void refill();
     static void flush_cancel(flush_m);
+    static void jumpResync();
     static void spiInit();
     static void cs_low();
     static void cs_high();
@@ -729,11 +1284,37 @@ class SFEMP3Shield {
     static void Mp3WriteRegister(uint8_t, uint16_t);
     static uint16_t Mp3ReadRegister (uint8_t);
     static uint16_t Mp3ReadWRAM(uint16_t);
+    static void Mp3ReadWRAM(uint16_t, uint16_t*, uint8_t);
     static void Mp3WriteWRAM(uint16_t, uint16_t);
     void getTrackInfo(uint8_t, char*);
     static void enableRefill();
     static void disableRefill();
-    void getBitRateFromMP3File(char*);
+    void getBitRateFromMP3File();
+    uint32_t seekOffset(uint32_t);
+#if MP3_SEEK_WAV
+    bool parseWav();
+    void primeWav(uint32_t);
+#endif
+    void primeTrack(uint32_t, uint32_t);
+    uint8_t seekRead(uint32_t, uint8_t*, uint8_t);
+#if MP3_SEEK_FLAC
+    bool parseFlac();
+    bool parseOgg();
+    uint32_t seekTable(uint32_t);
+    uint32_t seekBisect(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+    uint32_t seekSync(uint32_t, uint32_t, uint32_t*, uint32_t*);
+#endif
+#if MP3_SEEK_MP4
+    bool parseMp4();
+    uint32_t findBox(uint32_t, uint32_t, const char*, uint32_t*, uint32_t*);
+    uint32_t seekMp4(uint32_t);
+    uint32_t chunkSamples(uint32_t);
+    uint32_t chunkOffset(uint32_t);
+#endif
+#if TRACK_JUMPS
+    static void queueJump(uint32_t, uint32_t);
+#endif
+    static void sendData(const uint8_t*, uint16_t);
     uint8_t VSLoadUserCode(char*);
 
     //Create the variables to be used by SdFat Library
@@ -754,6 +1335,109 @@ class SFEMP3Shield {
 /** \brief contains a filehandles offset to the begining of the current file.*/
     uint32_t start_of_music;
 
+/** \brief one of audio_format_m, as detected from the current track's content.*/
+    uint8_t track_format;
+
+#if MP3_SEEK_WAV
+/** \brief bytes per second of the current WAV track.*/
+    uint32_t wav_byteRate;
+
+/** \brief bytes of the current WAV track's "data" chunk.*/
+    uint32_t wav_size;
+
+/** \brief bytes per sample frame or ADPCM block of the current WAV track, zero if not seekable exactly.*/
+    uint16_t wav_align;
+
+/** \brief bytes of the current WAV track's "fmt " chunk kept in wav_fmt.*/
+    uint8_t wav_fmt_size;
+
+/** \brief the current WAV track's "fmt " chunk, as to rebuild its header.*/
+    uint8_t wav_fmt[WAV_FMT_SIZE];
+#endif
+
+/** \brief true if the current track is seeked exactly and re-primed with primeTrack().*/
+    bool seek_exact;
+
+#if MP3_SEEK_FLAC || MP3_SEEK_MP4
+/** \brief samples per second of the current FLAC, Ogg or MP4 track.*/
+    uint32_t seek_rate;
+#endif
+
+#if MP3_SEEK_FLAC
+/** \brief samples per frame of a fixed block size FLAC track, else zero.*/
+    uint16_t flac_block;
+
+/** \brief seek points of the current FLAC track's SEEKTABLE, at flac_table.*/
+    uint16_t flac_points;
+
+/** \brief file position of the current FLAC track's SEEKTABLE.*/
+    uint32_t flac_table;
+#endif
+
+/** \brief block reads of the last seek, see getSeekReads().*/
+    uint16_t seek_reads;
+
+/** \brief block last read by seekRead(), as to count the reads.*/
+    uint32_t seek_block;
+
+#if MP3_SEEK_MP4
+/** \brief file position of the current MP4 track's moov box.*/
+    uint32_t mp4_moov;
+
+/** \brief file position following the current MP4 track's moov box.*/
+    uint32_t mp4_moov_end;
+
+/** \brief file position of the current MP4 track's mdat box, whose samples are at start_of_music.*/
+    uint32_t mp4_mdat;
+
+/** \brief file position following the current MP4 track's mdat box.*/
+    uint32_t mp4_mdat_end;
+
+/** \brief file position of the entries of the sound track's "stts" box, of sample durations.*/
+    uint32_t mp4_stts;
+    uint32_t mp4_stts_count;
+
+/** \brief file position of the entries of the sound track's "stsc" box, of samples per chunk.*/
+    uint32_t mp4_stsc;
+    uint32_t mp4_stsc_count;
+
+/** \brief file position of the entries of the sound track's "stsz" box, of sample sizes.*/
+    uint32_t mp4_stsz;
+
+/** \brief size of every sample, or zero if each is given by the "stsz" entries.*/
+    uint32_t mp4_sample_size;
+
+/** \brief file position of the entries of the sound track's "stco" or "co64" box, of chunk offsets.*/
+    uint32_t mp4_stco;
+
+/** \brief bytes of each chunk offset, 8 if of a "co64" box.*/
+    uint8_t mp4_stco_size;
+
+/** \brief number of chunks of the sound track.*/
+    uint32_t mp4_chunks;
+
+/** \brief chunks between the points of seek_index.*/
+    uint32_t seek_stride;
+
+/** \brief points of seek_index in use.*/
+    uint16_t seek_points;
+
+/** \brief the current MP4 track's first sample of every seek_stride'th chunk.*/
+    static seek_point_t seek_index[MP3_SEEK_INDEX_SIZE];
+#endif
+
+#if TRACK_JUMPS
+/** \brief file positions at which refill() jumps to those of jump_to, in turn.*/
+    static uint32_t jump_from[TRACK_JUMPS];
+
+/** \brief file positions to which refill() jumps, at those of jump_from.*/
+    static uint32_t jump_to[TRACK_JUMPS];
+#endif
+
+/** \brief jumps queued by queueJump(), of which jump_next are taken.*/
+    static uint8_t jump_count;
+    static uint8_t jump_next;
+
 /** \brief contains a local value of the VSdsp's master volume left channels*/
     uint8_t VolL;
 
@@ -794,7 +1478,7 @@ union sci_bass_m {
  * Global Functions
  */
 char* strip_nonalpha_inplace(char *s);
-bool isFnMusic(char*);
+bool isFnMusic(const char*);
 
 //------------------------------------------------------------------------------
 /*
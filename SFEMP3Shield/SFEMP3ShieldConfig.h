@@ -205,6 +205,38 @@ Support for Arduino Leonardo is afflicted by having the SPI pins not routing the
  */
 #define PERF_MON_PIN          -1 //  example of A5
 
+/**
+ * \def MP3_REFILL_STATS
+ * \brief A macro to enable counters of refill and register performance
+ *
+ * When set to 1, SFEMP3Shield::refill() and the register functions count the
+ * bytes sent, DREQ waits and durations into a refill_stats_t, as read with
+ * SFEMP3Shield::getRefillStats(). For measuring in the field without a scope.
+ *
+ * Set value to 0 to compile the counters out entirely.
+ */
+#define MP3_REFILL_STATS       0
+
+/**
+ * \def MP3_TRACE_RECORDS
+ * \brief A macro used to specify the number of records in the trace ring.
+ *
+ * When nonzero, SCI reads and writes, calls of refill() with the bytes they
+ * send, changes of state and, with SdFat's FAT_TRACE, SdCard block reads and
+ * cache misses are recorded with their time into a ring of this many 12 byte
+ * records. As sent by SFEMP3Shield::dumpTrace() and rendered by
+ * tools/mp3trace.pl.
+ *
+ * Zero by default, as the ring and its recording cost RAM and time in refill().
+ * Typically 32 on an AVR with RAM to spare, or 256 on a 32-bit processor.
+ *
+ * \note Must be a power of 2.
+ */
+#define MP3_TRACE_RECORDS      0
+#if MP3_TRACE_RECORDS & (MP3_TRACE_RECORDS - 1)
+#error MP3_TRACE_RECORDS must be a power of 2
+#endif
+
 #include <pins_arduino.h>
 
 #if defined(__BIOFEEDBACK_MEGA__)
@@ -410,6 +442,347 @@ Support for Arduino Leonardo is afflicted by having the SPI pins not routing the
  */
 #define MIDI_INTENSITY         127 // Full scale.
 
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_TRACK_INDEX
+ * \brief A macro used to enable the on-card music library index.
+ *
+ * SFEMP3Shield::buildTrackIndex() and the queries of its index keep the index
+ * open in a second SdFile in RAM. When zero, SFEMP3Shield::buildTrackIndex()
+ * returns 2 and the queries find no index.
+ *
+ * \note Processors with 8K of RAM or less default to zero.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_TRACK_INDEX 0
+#else
+  #define MP3_TRACK_INDEX 1
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_INDEX_FILENAME
+ * \brief A macro used to specify the filename of the on-card music library index.
+ *
+ * Where SFEMP3Shield::buildTrackIndex() writes the sorted index of the audio
+ * files found in the current working directory, to be queried by
+ * SFEMP3Shield::getIndexedTrack() and SFEMP3Shield::findIndexedTrack().
+ *
+ * \note The index is created in the same directory it describes.
+ */
+#define MP3_INDEX_FILENAME     "mp3index.dat"
+
+/**
+ * \def MP3_INDEX_TMPNAME
+ * \brief A macro used to specify the filename of the index while being rebuilt.
+ *
+ * SFEMP3Shield::buildTrackIndex() collects and sorts the records into this file
+ * and then renames it to MP3_INDEX_FILENAME, so that a power loss during the
+ * rebuild leaves the prior index intact. The header is written last, such that
+ * should power be lost between removing the prior index and the rename, the
+ * new one is still found under this name.
+ */
+#define MP3_INDEX_TMPNAME      "mp3index.tmp"
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_TRACK_CACHE_SIZE
+ * \brief A macro used to specify the number of track numbers remembered by playTrack().
+ *
+ * SFEMP3Shield::playTrack() scans the current working directory once for the
+ * trackNNN.mp3 files and remembers the directory entry index of each, such that
+ * later track changes open the file directly from its directory entry, rather
+ * than searching the directory by name again. Each slot costs 4 bytes of RAM.
+ * Tracks are held by their number modulo this size, where a track that does not
+ * fit is simply found by name as before. When zero every track is found by
+ * name.
+ *
+ * \note Processors with 8K of RAM or less default to zero.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_TRACK_CACHE_SIZE 0
+#else
+  #define MP3_TRACK_CACHE_SIZE 64
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_EXTENT_MAP_SIZE
+ * \brief A macro used to specify the number of extents of the track's cluster chain remembered.
+ *
+ * The playing track records its runs of contiguous clusters as they are read,
+ * see SdFat's FatFile::setExtentMap(). Such that SFEMP3Shield::skip() and
+ * SFEMP3Shield::skipTo() backwards, or to any part already played, need not
+ * follow the FAT chain from the start of the file. Each extent costs 8 bytes
+ * of RAM. An unfragmented file needs only one.
+ *
+ * \note Requires USE_FAT_EXTENT_MAP of SdFatConfig.h, otherwise is ignored.
+ */
+#if defined(RAMEND) && (RAMEND < 0x1000)
+  #define MP3_EXTENT_MAP_SIZE 4
+#else
+  #define MP3_EXTENT_MAP_SIZE 32
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_SEEK_WAV
+ * \brief A macro used to enable the exact seek of WAV tracks.
+ *
+ * SFEMP3Shield::playMP3() keeps the "fmt " chunk of a WAV track, as to replay
+ * it ahead of the seeked sample frames. When zero, WAV tracks are seeked at the
+ * VSdsp's byte rate, as MP3.
+ *
+ * \note Processors with 8K of RAM or less default to zero.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_SEEK_WAV 0
+#else
+  #define MP3_SEEK_WAV 1
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_SEEK_FLAC
+ * \brief A macro used to enable the exact seek of FLAC and Ogg tracks.
+ *
+ * SFEMP3Shield::playMP3() keeps the sample rate and SEEKTABLE of a FLAC track,
+ * or the sample rate of an Ogg Vorbis track, as to find the frame or page of a
+ * seek. When zero, these tracks are seeked at the VSdsp's byte rate, as MP3.
+ *
+ * \note Processors with 8K of RAM or less default to zero.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_SEEK_FLAC 0
+#else
+  #define MP3_SEEK_FLAC 1
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_SEEK_MP4
+ * \brief A macro used to enable the exact seek of MP4 (M4A) tracks.
+ *
+ * SFEMP3Shield::playMP3() keeps the positions of an MP4 track's sample tables,
+ * along with the seek index of MP3_SEEK_INDEX_SIZE, and feeds a moov box that
+ * trails the samples first. When zero, MP4 tracks are seeked at the VSdsp's
+ * byte rate, as MP3, and need their moov box ahead of the samples.
+ *
+ * \note Processors with 8K of RAM or less default to zero.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_SEEK_MP4 0
+#else
+  #define MP3_SEEK_MP4 1
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_SEEK_INDEX_SIZE
+ * \brief A macro used to specify the number of points of the seek index of an MP4 track.
+ *
+ * SFEMP3Shield::playMP3() of an MP4 (M4A) track samples its chunk offsets into
+ * at most this many points, evenly spaced in chunks, as to start each seek
+ * from the nearest point rather than from the first chunk. Each point costs 8
+ * bytes of RAM. Fewer points only lengthen the walk of the sample tables from
+ * the point to the seeked chunk.
+ *
+ * \note Requires MP3_SEEK_MP4, otherwise is ignored.
+ */
+#if defined(RAMEND) && (RAMEND < 0x1000)
+  #define MP3_SEEK_INDEX_SIZE 8
+#elif defined(__AVR__)
+  #define MP3_SEEK_INDEX_SIZE 32
+#else
+  #define MP3_SEEK_INDEX_SIZE 128
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_READ_AHEAD_BLOCKS
+ * \brief A macro used to specify the number of 512 byte blocks read ahead of the playing track.
+ *
+ * The refill() reads the track 32 bytes at a time. With read ahead, see
+ * SdFat's FatFile::setReadAhead(), the SdCard is sent one multi-block read per
+ * this many blocks, rather than one single block read per block. Each block
+ * costs 512 bytes of RAM, hence it is disabled (zero) on small RAM processors.
+ *
+ * \note Requires USE_FAT_READ_AHEAD of SdFatConfig.h, otherwise is ignored.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_READ_AHEAD_BLOCKS 0
+#elif defined(__AVR__)
+  #define MP3_READ_AHEAD_BLOCKS 2
+#else
+  #define MP3_READ_AHEAD_BLOCKS 4
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_NAME_HASH_SIZE
+ * \brief A macro used to specify the number of names of the working directory hashed.
+ *
+ * The first SFEMP3Shield::playMP3() within a directory hashes the names of its
+ * files, see SdFat's FatFile::setNameHash(). Such that later tracks are opened
+ * by reading only the directory block holding their entry, rather than
+ * searching the directory from the start. Each name costs 4 bytes of RAM.
+ * Names that do not fit are simply found by searching as before.
+ *
+ * \note Requires USE_FAT_NAME_HASH of SdFatConfig.h, otherwise is ignored.
+ */
+#if defined(RAMEND) && (RAMEND < 0x1000)
+  #define MP3_NAME_HASH_SIZE 0
+#elif defined(__AVR__)
+  #define MP3_NAME_HASH_SIZE 64
+#else
+  #define MP3_NAME_HASH_SIZE 256
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_RECORD_BLOCKS
+ * \brief A macro used to specify the number of 512 byte blocks of recording buffered before writing.
+ *
+ * SFEMP3Shield::serviceRecording() gathers the VSdsp's encoded data into a
+ * buffer of this many blocks. Each filled block is sent into a multi-block
+ * write of the preallocated and pre-erased file, whenever the SdCard is not
+ * busy, such that the buffer rides out the SdCard's slow writes. Each block
+ * costs 512 bytes of RAM. When zero, the data is written 32 bytes at a time
+ * through SdFat's block cache.
+ *
+ * \note Must be zero or at least 2.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_RECORD_BLOCKS 0
+#elif defined(__AVR__)
+  #define MP3_RECORD_BLOCKS 2
+#else
+  #define MP3_RECORD_BLOCKS 8
+#endif
+#if MP3_RECORD_BLOCKS == 1
+#error MP3_RECORD_BLOCKS must be zero or at least 2
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_RECORD_CHECKPOINT_BLOCKS
+ * \brief A macro used to specify how many blocks are recorded between updates of the WAV header.
+ *
+ * While recording with MP3_RECORD_BLOCKS, the WAV header of the preallocated
+ * file describes it as full until SFEMP3Shield::stopRecording(). Every this
+ * many blocks the multi-block write is briefly stopped to rewrite the header
+ * with the length recorded so far. Such that a recording cut short by a loss
+ * of power plays up to its last checkpoint. 1024 blocks is about two minutes
+ * at 8000 Hz.
+ */
+#define MP3_RECORD_CHECKPOINT_BLOCKS 1024
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_RECORD_GAIN
+ * \brief A macro used to specify the input gain of recording.
+ *
+ * Written to SCI_AICTRL1 by SFEMP3Shield::startRecording(), where 1024 is a
+ * gain of 1 and 0 selects automatic gain control.
+ */
+#define MP3_RECORD_GAIN 0
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_MIDI_QUEUE_SIZE
+ * \brief A macro used to specify the bytes of real-time MIDI messages queued before sending.
+ *
+ * SFEMP3Shield::midiNoteOn() and friends queue their messages, of two or three
+ * bytes each, for SFEMP3Shield::flushMIDI() to send to the VSdsp in a single
+ * burst. A full queue refuses further messages until flushed.
+ *
+ * \note Must be a power of 2, no larger than 256.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_MIDI_QUEUE_SIZE 16
+#elif defined(__AVR__)
+  #define MP3_MIDI_QUEUE_SIZE 32
+#else
+  #define MP3_MIDI_QUEUE_SIZE 128
+#endif
+#if (MP3_MIDI_QUEUE_SIZE & (MP3_MIDI_QUEUE_SIZE - 1)) || (MP3_MIDI_QUEUE_SIZE > 256)
+#error MP3_MIDI_QUEUE_SIZE must be a power of 2, no larger than 256
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_EFFECT_FILE
+ * \brief A macro used to enable SFEMP3Shield::playEffectFile().
+ *
+ * Sound effects played from their own file need a second SdFile in RAM, held
+ * open beside the track. When zero only the effects from RAM or PROGMEM are
+ * played, and SFEMP3Shield::playEffectFile() returns 2.
+ *
+ * \note Processors with 8K of RAM or less default to zero.
+ */
+#if defined(RAMEND) && (RAMEND < 0x2000)
+  #define MP3_EFFECT_FILE 0
+#else
+  #define MP3_EFFECT_FILE 1
+#endif
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_FADE_MS
+ * \brief A macro used to specify the default fade in of tracks as they start.
+ *
+ * In milliseconds, where 0 starts tracks at full volume. May be changed with
+ * SFEMP3Shield::setFadeTime(). The fade is stepped by SFEMP3Shield::available(),
+ * which must be polled.
+ */
+#define MP3_FADE_MS 0
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_SCAN_AHEAD_MS
+ * \brief A macro used to specify the milliseconds of the track read ahead while scanning forward.
+ *
+ * SFEMP3Shield::scanTrack() sizes the track's read ahead to this much of the
+ * track at the byte rate multiplied by the scan speed. Beyond
+ * MP3_READ_AHEAD_BLOCKS, the MP3_RECORD_BLOCKS buffer is borrowed, as it is
+ * idle while playing.
+ */
+#define MP3_SCAN_AHEAD_MS 100
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_SCAN_SNIPPET_MS
+ * \brief A macro used to specify the milliseconds of each snippet played while scanning backward.
+ *
+ * SFEMP3Shield::scanTrack() rewinds by playing snippets of this length forward,
+ * each this length times the speed before the last. Short enough to follow the
+ * scan, long enough for the snippets to be recognized.
+ */
+#define MP3_SCAN_SNIPPET_MS 250
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_POSITION_REFRESH_MS
+ * \brief A macro used to specify how often SFEMP3Shield::getPositionMsec() reads the VSdsp.
+ *
+ * In milliseconds. Between reads the position is interpolated from the clock.
+ */
+#define MP3_POSITION_REFRESH_MS 1000
+
+//------------------------------------------------------------------------------
+/**
+ * \def MP3_EVENT_QUEUE_SIZE
+ * \brief A macro used to specify the number of events queued for SFEMP3Shield::getEvent().
+ *
+ * One less than this may be waiting, further events are dropped until taken.
+ *
+ * \note Must be a power of 2.
+ */
+#define MP3_EVENT_QUEUE_SIZE 8
+#if MP3_EVENT_QUEUE_SIZE & (MP3_EVENT_QUEUE_SIZE - 1)
+#error MP3_EVENT_QUEUE_SIZE must be a power of 2
+#endif
+
 
 
 
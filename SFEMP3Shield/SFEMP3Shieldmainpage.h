@@ -229,7 +229,7 @@ The following error codes return from the SFEMP3Shield::begin() member function.
 \deprecated Error codes 1,2,3 due to use of \c sd.begin() as global, starting version 1.1.0
 
 \subsection playfunc Playing functions:
-The following error codes return from the SFEMP3Shield::playTrack() or SFEMP3Shield::playMP3() member functions.
+The following error codes return from the SFEMP3Shield::playTrack(), SFEMP3Shield::playMP3(), SFEMP3Shield::playDirIndex() or SFEMP3Shield::playIndexedTrack() member functions.
 <pre>
 0 OK
 1 Already playing track
@@ -245,6 +245,56 @@ The following error codes return from the SFEMP3Shield::skipTo()member function.
 2 Failed to skip to new file location
 </pre>
 
+\subsection trackindexfunc Track Index functions:
+The following error codes return from the SFEMP3Shield::buildTrackIndex() or SFEMP3Shield::getIndexedTrack() member functions.
+<pre>
+0 OK
+1 Already playing track
+2 Failed to create MP3_INDEX_TMPNAME
+3 No valid index of the current working directory
+4 Failed to read or write the index
+5 Track number is beyond the end of the index
+</pre>
+
+\subsection recordfunc Recording functions:
+The following error codes return from the SFEMP3Shield::startRecording(), SFEMP3Shield::serviceRecording() or SFEMP3Shield::stopRecording() member functions.
+<pre>
+0 OK
+1 Already playing or recording track, or not recording for service and stop
+2 Failed to create the contiguous file
+3 indicates that the VSdsp is in reset.
+4 Failed to write the recording
+5 Sample rate is not from 8000 to 48000 Hz
+</pre>
+
+\subsection streamfunc Streaming functions:
+The following error codes return from the SFEMP3Shield::playStream() member function.
+<pre>
+0 OK
+1 Already playing or recording track
+3 indicates that the VSdsp is in reset.
+4 Invalid buffer, channels or bits per sample
+</pre>
+
+\subsection midifunc Real-time MIDI functions:
+The following error codes return from the SFEMP3Shield::startMIDI() member function, and SFEMP3Shield::midiNoteOn() and the other message functions.
+<pre>
+0 OK
+1 Already playing or recording track, or not in real-time MIDI mode for messages
+2 Could not find rtmidi.053, or the queue of messages is full
+3 indicates that the VSdsp is in reset.
+</pre>
+
+\subsection effectfunc Sound effect functions:
+The following error codes return from the SFEMP3Shield::playEffect(), SFEMP3Shield::playEffect_P() or SFEMP3Shield::playEffectFile() member functions.
+<pre>
+0 OK
+1 Busy recording, streaming or in real-time MIDI mode
+2 Failed to open the effect's file
+3 indicates that the VSdsp is in reset.
+4 The track is not an MP3, having no frames to re-enter at
+</pre>
+
 \section comment Support
 The code has been written with plenty of appropiate comments, describing key components, features and reasonings in Doxygen markdown style as to autogenerate this html suppoting document. Which is loaded into the repositories' gh-page branch to be displayed on the projects's GitHub Page.
 
@@ -51,13 +51,15 @@ bool FatFile::addDirCluster() {
     goto fail;
   }
   block = m_vol->clusterFirstBlock(m_curCluster);
-  pc = m_vol->cacheFetchData(block, FatCache::CACHE_RESERVE_FOR_WRITE);
+  pc = m_vol->cacheFetchData(block, FatCache::CACHE_RESERVE_FOR_WRITE
+                             | FatCache::CACHE_STATUS_DIR);
   if (!pc) {
     DBG_FAIL_MACRO;
     goto fail;
   }
   memset(pc, 0, 512);
   // zero rest of clusters
+  m_vol->cacheInvalidate(block + 1, m_vol->blocksPerCluster() - 1);
   for (uint8_t i = 1; i < m_vol->blocksPerCluster(); i++) {
     if (!m_vol->writeBlock(block + i, pc->data)) {
       DBG_FAIL_MACRO;
@@ -76,7 +78,7 @@ fail:
 // return pointer to cached entry or null for failure
 dir_t* FatFile::cacheDirEntry(uint8_t action) {
   cache_t* pc;
-  pc = m_vol->cacheFetchData(m_dirBlock, action);
+  pc = m_vol->cacheFetchData(m_dirBlock, action | FatCache::CACHE_STATUS_DIR);
   if (!pc) {
     DBG_FAIL_MACRO;
     goto fail;
@@ -219,6 +221,49 @@ uint32_t FatFile::dirSize() {
   } while (fg);
   return 512UL*n;
 }
+#if USE_FAT_EXTENT_MAP
+//------------------------------------------------------------------------------
+void FatFile::extentAdd(uint32_t fileCluster, uint32_t cluster) {
+  // Only the cluster following the recorded prefix extends the map.
+  if (!m_extent || fileCluster != m_extentEnd) {
+    return;
+  }
+  if (m_extentCount) {
+    FatExtent* last = &m_extent[m_extentCount - 1];
+    if (cluster == last->cluster + (fileCluster - last->fileCluster)) {
+      // contiguous with the last run
+      m_extentEnd++;
+      return;
+    }
+  }
+  if (m_extentCount < m_extentMax) {
+    m_extent[m_extentCount].fileCluster = fileCluster;
+    m_extent[m_extentCount].cluster = cluster;
+    m_extentCount++;
+    m_extentEnd++;
+  }
+}
+//------------------------------------------------------------------------------
+bool FatFile::extentLookup(uint32_t fileCluster, uint32_t* cluster) {
+  uint8_t lo = 0;
+  uint8_t hi;
+  if (!m_extent || fileCluster >= m_extentEnd) {
+    return false;
+  }
+  // Find the last run starting at or before fileCluster.
+  hi = m_extentCount - 1;
+  while (lo < hi) {
+    uint8_t mid = lo + (hi - lo + 1)/2;
+    if (m_extent[mid].fileCluster <= fileCluster) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  *cluster = m_extent[lo].cluster + (fileCluster - m_extent[lo].fileCluster);
+  return true;
+}
+#endif  // USE_FAT_EXTENT_MAP
 //------------------------------------------------------------------------------
 int16_t FatFile::fgets(char* str, int16_t num, char* delim) {
   char ch;
@@ -345,7 +390,8 @@ bool FatFile::mkdir(FatFile* parent, fname_t* fname) {
 
   // cache block for '.'  and '..'
   block = m_vol->clusterFirstBlock(m_firstCluster);
-  pc = m_vol->cacheFetchData(block, FatCache::CACHE_FOR_WRITE);
+  pc = m_vol->cacheFetchData(block, FatCache::CACHE_FOR_WRITE
+                             | FatCache::CACHE_STATUS_DIR);
   if (!pc) {
     DBG_FAIL_MACRO;
     goto fail;
@@ -650,6 +696,25 @@ fail:
 }
 #endif  // DOXYGEN_SHOULD_SKIP_THIS
 //------------------------------------------------------------------------------
+bool FatFile::openDir(FatFile* dirFile) {
+  if (isOpen() || !dirFile->isDir()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (dirFile->isRoot()) {
+    return openRoot(dirFile->m_vol);
+  }
+  memset(this, 0, sizeof(FatFile));
+  m_attr = FILE_ATTR_SUBDIR;
+  m_flags = O_READ;
+  m_vol = dirFile->m_vol;
+  m_firstCluster = dirFile->m_firstCluster;
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 bool FatFile::openRoot(FatVolume* vol) {
   // error if file is already open
   if (isOpen()) {
@@ -695,6 +760,9 @@ int FatFile::peek() {
 //------------------------------------------------------------------------------
 int FatFile::read(void* buf, size_t nbyte) {
   int8_t fg;
+#if USE_FAT_READ_AHEAD
+  bool sequential;
+#endif  // USE_FAT_READ_AHEAD
   uint8_t blockOfCluster = 0;
   uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
   uint16_t offset;
@@ -720,6 +788,10 @@ int FatFile::read(void* buf, size_t nbyte) {
     }
   }
   toRead = nbyte;
+#if USE_FAT_READ_AHEAD
+  // streaming if this read continues where the last one ended
+  sequential = m_curPosition == m_raPosition;
+#endif  // USE_FAT_READ_AHEAD
   while (toRead) {
     size_t n;
     offset = m_curPosition & 0X1FF;  // offset in block
@@ -729,10 +801,11 @@ int FatFile::read(void* buf, size_t nbyte) {
       blockOfCluster = m_vol->blockOfCluster(m_curPosition);
       if (offset == 0 && blockOfCluster == 0) {
         // start of new cluster
+        uint32_t fileCluster = m_curPosition >> (m_vol->clusterSizeShift() + 9);
         if (m_curPosition == 0) {
           // use first cluster in file
           m_curCluster = isRoot32() ? m_vol->rootDirStart() : m_firstCluster;
-        } else {
+        } else if (!extentLookup(fileCluster, &m_curCluster)) {
           // get next cluster from FAT
           fg = m_vol->fatGet(m_curCluster, &m_curCluster);
           if (fg < 0) {
@@ -747,17 +820,31 @@ int FatFile::read(void* buf, size_t nbyte) {
             goto fail;
           }
         }
+        extentAdd(fileCluster, m_curCluster);
       }
       block = m_vol->clusterFirstBlock(m_curCluster) + blockOfCluster;
     }
-    if (offset != 0 || toRead < 512 || block == m_vol->cacheBlockNumber()) {
+#if USE_FAT_READ_AHEAD
+    if (m_raBuf && ((block - m_raBlock) < m_raCount
+                    || (sequential && (offset != 0 || toRead < 512)
+                        && readAhead(block, blockOfCluster)))) {
+      // copy from the read-ahead window
+      n = 512 - offset;
+      if (n > toRead) {
+        n = toRead;
+      }
+      memcpy(dst, m_raBuf + 512*(block - m_raBlock) + offset, n);
+    } else
+#endif  // USE_FAT_READ_AHEAD
+    if (offset != 0 || toRead < 512 || m_vol->cacheContains(block)) {
       // amount to be read from current block
       n = 512 - offset;
       if (n > toRead) {
         n = toRead;
       }
       // read block to cache and copy data to caller
-      pc = m_vol->cacheFetchData(block, FatCache::CACHE_FOR_READ);
+      pc = m_vol->cacheFetchData(block, isDir() ? FatCache::CACHE_STATUS_DIR
+                                                : FatCache::CACHE_FOR_READ);
       if (!pc) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -766,7 +853,7 @@ int FatFile::read(void* buf, size_t nbyte) {
       memcpy(dst, src, n);
 #if USE_MULTI_BLOCK_IO
     } else if (toRead >= 1024) {
-      uint8_t nb = toRead >> 9;
+      size_t nb = toRead >> 9;
       if (!isRootFixed()) {
         uint8_t mb = m_vol->blocksPerCluster() - blockOfCluster;
         if (mb < nb) {
@@ -774,13 +861,10 @@ int FatFile::read(void* buf, size_t nbyte) {
         }
       }
       n = 512*nb;
-      if (block <= m_vol->cacheBlockNumber()
-          && block < (m_vol->cacheBlockNumber() + nb)) {
-        // flush cache if a block is in the cache
-        if (!m_vol->cacheSyncData()) {
-          DBG_FAIL_MACRO;
-          goto fail;
-        }
+      // flush any of the blocks in the cache
+      if (!m_vol->cacheSyncData(block, nb)) {
+        DBG_FAIL_MACRO;
+        goto fail;
       }
       if (!m_vol->readBlocks(block, dst, nb)) {
         DBG_FAIL_MACRO;
@@ -799,12 +883,54 @@ int FatFile::read(void* buf, size_t nbyte) {
     m_curPosition += n;
     toRead -= n;
   }
+#if USE_FAT_READ_AHEAD
+  m_raPosition = m_curPosition;
+#endif  // USE_FAT_READ_AHEAD
   return nbyte - toRead;
 
 fail:
   m_error |= READ_ERROR;
   return -1;
 }
+#if USE_FAT_READ_AHEAD
+//------------------------------------------------------------------------------
+// Fill the read-ahead window starting with block, which is at the current
+// position, extending across physically contiguous clusters.
+bool FatFile::readAhead(uint32_t block, uint8_t blockOfCluster) {
+  uint32_t cluster = m_curCluster;
+  uint32_t next;
+  // blocks left in file, counting block
+  uint32_t nFile = (m_fileSize - (m_curPosition & ~0X1FFUL) + 511) >> 9;
+  uint32_t nb = m_vol->blocksPerCluster() - blockOfCluster;
+  while (nb < m_raMax && nb < nFile
+         && m_vol->fatGet(cluster, &next) > 0 && next == (cluster + 1)) {
+    cluster = next;
+    nb += m_vol->blocksPerCluster();
+  }
+  if (nb > m_raMax) {
+    nb = m_raMax;
+  }
+  if (nb > nFile) {
+    nb = nFile;
+  }
+  m_raCount = 0;
+  // flush any of the blocks in the cache
+  if (!m_vol->cacheSyncData(block, nb)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!m_vol->readBlocks(block, m_raBuf, nb)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_raBlock = block;
+  m_raCount = nb;
+  return true;
+
+fail:
+  return false;
+}
+#endif  // USE_FAT_READ_AHEAD
 //------------------------------------------------------------------------------
 int8_t FatFile::readDir(dir_t* dir) {
   int16_t n;
@@ -1128,18 +1254,29 @@ bool FatFile::seekSet(uint32_t pos) {
   nCur = (m_curPosition - 1) >> (m_vol->clusterSizeShift() + 9);
   nNew = (pos - 1) >> (m_vol->clusterSizeShift() + 9);
 
+  if (extentLookup(nNew, &m_curCluster)) {
+    goto done;
+  }
   if (nNew < nCur || m_curPosition == 0) {
     // must follow chain from first cluster
     m_curCluster = isRoot32() ? m_vol->rootDirStart() : m_firstCluster;
-  } else {
-    // advance from curPosition
-    nNew -= nCur;
-  }
-  while (nNew--) {
+    nCur = 0;
+    extentAdd(nCur, m_curCluster);
+  }
+#if USE_FAT_EXTENT_MAP
+  if (m_extentEnd > nCur + 1) {
+    // advance from the end of the extent map
+    nCur = m_extentEnd - 1;
+    extentLookup(nCur, &m_curCluster);
+  }
+#endif  // USE_FAT_EXTENT_MAP
+  // advance from curPosition
+  while (nCur < nNew) {
     if (m_vol->fatGet(m_curCluster, &m_curCluster) <= 0) {
       DBG_FAIL_MACRO;
       goto fail;
     }
+    extentAdd(++nCur, m_curCluster);
   }
 
 done:
@@ -1150,6 +1287,40 @@ fail:
   m_curCluster = tmp;
   return false;
 }
+#if USE_FAT_EXTENT_MAP
+//------------------------------------------------------------------------------
+bool FatFile::setExtentMap(FatExtent* map, uint8_t count) {
+  if (!isFile()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_extent = count ? map : 0;
+  m_extentMax = count;
+  m_extentCount = 0;
+  m_extentEnd = 0;
+  return true;
+
+fail:
+  return false;
+}
+#endif  // USE_FAT_EXTENT_MAP
+#if USE_FAT_READ_AHEAD
+//------------------------------------------------------------------------------
+bool FatFile::setReadAhead(uint8_t* buf, uint8_t count) {
+  if (!isFile() || (m_flags & O_WRITE)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_raBuf = count ? buf : 0;
+  m_raMax = count;
+  m_raCount = 0;
+  m_raPosition = m_curPosition;
+  return true;
+
+fail:
+  return false;
+}
+#endif  // USE_FAT_READ_AHEAD
 //------------------------------------------------------------------------------
 void FatFile::setpos(FatPos_t* pos) {
   m_curPosition = pos->position;
@@ -1331,6 +1502,20 @@ bool FatFile::truncate(uint32_t length) {
     }
   }
   m_fileSize = length;
+#if USE_FAT_EXTENT_MAP
+  // forget freed clusters
+  if (m_extentEnd) {
+    uint32_t nKeep = length ?
+                     ((length - 1) >> (m_vol->clusterSizeShift() + 9)) + 1 : 0;
+    if (m_extentEnd > nKeep) {
+      m_extentEnd = nKeep;
+    }
+    while (m_extentCount &&
+           m_extent[m_extentCount - 1].fileCluster >= m_extentEnd) {
+      m_extentCount--;
+    }
+  }
+#endif  // USE_FAT_EXTENT_MAP
 
   // need to update directory entry
   m_flags |= F_FILE_DIR_DIRTY;
@@ -1401,6 +1586,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
           m_curCluster = m_firstCluster;
         }
       }
+      extentAdd(m_curPosition >> (m_vol->clusterSizeShift() + 9), m_curCluster);
     }
     // block for data write
     uint32_t block = m_vol->clusterFirstBlock(m_curCluster) + blockOfCluster;
@@ -1430,7 +1616,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
       memcpy(dst, src, n);
       if (512 == (n + blockOffset)) {
         // Force write if block is full - improves large writes.
-        if (!m_vol->cacheSyncData()) {
+        if (!m_vol->cacheSyncData(block, 1)) {
           DBG_FAIL_MACRO;
           goto fail;
         }
@@ -1439,16 +1625,13 @@ int FatFile::write(const void* buf, size_t nbyte) {
     } else if (nToWrite >= 1024) {
       // use multiple block write command
       uint8_t maxBlocks = m_vol->blocksPerCluster() - blockOfCluster;
-      uint8_t nBlock = nToWrite >> 9;
+      size_t nBlock = nToWrite >> 9;
       if (nBlock > maxBlocks) {
         nBlock = maxBlocks;
       }
       n = 512*nBlock;
-      if (block <= m_vol->cacheBlockNumber()
-          && block < (m_vol->cacheBlockNumber() + nBlock)) {
-        // invalidate cache if block is in cache
-        m_vol->cacheInvalidate();
-      }
+      // invalidate any of the blocks in the cache
+      m_vol->cacheInvalidate(block, nBlock);
       if (!m_vol->writeBlocks(block, src, nBlock)) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -1457,9 +1640,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
     } else {
       // use single block write command
       n = 512;
-      if (m_vol->cacheBlockNumber() == block) {
-        m_vol->cacheInvalidate();
-      }
+      m_vol->cacheInvalidate(block, 1);
       if (!m_vol->writeBlock(block, src)) {
         DBG_FAIL_MACRO;
         goto fail;
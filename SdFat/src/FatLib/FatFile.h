@@ -67,6 +67,30 @@ struct FatPos_t {
   FatPos_t() : position(0), cluster(0) {}
 };
 //------------------------------------------------------------------------------
+/**
+ * \struct FatExtent
+ * \brief A run of contiguous clusters in a file's cluster chain.
+ *
+ * The run ends where the next extent in the map begins.
+ */
+struct FatExtent {
+  /** index within the file of the first cluster of the run */
+  uint32_t fileCluster;
+  /** volume cluster number of the first cluster of the run */
+  uint32_t cluster;
+};
+//------------------------------------------------------------------------------
+/**
+ * \struct FatNameHash
+ * \brief Hash of a name in a directory and the index of its first entry.
+ */
+struct FatNameHash {
+  /** hash of the lower case name */
+  uint16_t hash;
+  /** index of the first directory entry, long name or short, for the name */
+  uint16_t index;
+};
+//------------------------------------------------------------------------------
 /** Expression for path name separator. */
 #define isDirSeparator(c) ((c) == '/')
 //------------------------------------------------------------------------------
@@ -572,6 +596,17 @@ class FatFile {
    * \return true for success or false for failure.
    */
   bool openNext(FatFile* dirFile, uint8_t oflag = O_READ);
+  /** Open a second, read only, handle of a directory.
+   *
+   * \param[in] dirFile An open directory.
+   *
+   * The new handle has its own position.  Reading it, as with openNext(),
+   * leaves the position of \a dirFile untouched.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool openDir(FatFile* dirFile);
   /** Open a volume's root directory.
    *
    * \param[in] vol The FAT volume containing the root directory to be opened.
@@ -891,6 +926,91 @@ class FatFile {
    * the value false is returned for failure.
    */
   bool truncate(uint32_t length);
+#if USE_FAT_EXTENT_MAP || defined(DOXYGEN)
+  /** Record the file's cluster chain in a caller supplied extent map.
+   *
+   * The map is filled lazily, as read(), write() and seekSet() walk the
+   * cluster chain, with one element per run of contiguous clusters.  Once
+   * a cluster is recorded, seekSet() finds it with a binary search of the
+   * map rather than by following the chain from the first cluster.
+   *
+   * The map never grows beyond \a count elements.  When full, only the
+   * prefix of the file already recorded is mapped, and seeks beyond it
+   * follow the chain from the last mapped cluster.
+   *
+   * \note The map is forgotten when the file is closed, so must be set
+   * again after each open.  It must remain valid while the file is open.
+   *
+   * \param[in] map Array to hold the extents, or NULL to stop using a map.
+   * \param[in] count Number of elements in \a map.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool setExtentMap(FatExtent* map, uint8_t count);
+  /** \return Number of extents recorded in the map. */
+  uint8_t extentCount() const {
+    return m_extentCount;
+  }
+  /** \return Number of clusters, from the start of the file, recorded in
+   * the extent map.
+   */
+  uint32_t extentMapped() const {
+    return m_extentEnd;
+  }
+#endif  // USE_FAT_EXTENT_MAP
+#if USE_FAT_NAME_HASH || defined(DOXYGEN)
+  /** Index the names in a directory with a caller supplied hash table.
+   *
+   * The directory is scanned once, recording the hash of each name and
+   * the index of its first entry.  Opening a file by name in the directory
+   * then reads only the entries of names with a matching hash, usually a
+   * single directory block, instead of searching from the start.  Names
+   * not found in the table are searched for as usual and added if there
+   * is room, as are files created through this directory file.
+   *
+   * Entries are always checked against the directory, so entries made stale
+   * by other file objects, such as by remove(), cost only a normal search.
+   *
+   * \note Only used for long file name lookups, see USE_LONG_FILE_NAMES.
+   * The table is forgotten when the directory is closed, so must be set
+   * again after each open.  It must remain valid while the directory is
+   * open.
+   *
+   * \param[in] table Array to hold the hashes, or NULL to stop using a table.
+   * \param[in] count Number of elements in \a table.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool setNameHash(FatNameHash* table, uint16_t count);
+  /** \return Number of names recorded in the hash table. */
+  uint16_t nameHashCount() const {
+    return m_nameHashCount;
+  }
+#endif  // USE_FAT_NAME_HASH
+#if USE_FAT_READ_AHEAD || defined(DOXYGEN)
+  /** Stream sequential reads through a caller supplied window of blocks.
+   *
+   * Once reads are found to continue where the prior read ended, a read
+   * that does not cover a whole block fills the window with a single
+   * multi-block read.  The window extends into following clusters while
+   * they are physically contiguous, up to the end of the file.  Following
+   * reads are then copied from the window.  Seeks are allowed, a read
+   * after a seek is served as usual until streaming resumes.
+   *
+   * \note Only for files opened read-only.  The window is forgotten when
+   * the file is closed, so must be set again after each open.  Changes to
+   * the file by other file objects may not be seen while in the window.
+   *
+   * \param[in] buf Window of 512*\a count bytes, or NULL to stop read-ahead.
+   * \param[in] count Number of blocks in the window.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool setReadAhead(uint8_t* buf, uint8_t count);
+#endif  // USE_FAT_READ_AHEAD
   /** \return FatVolume that contains this file. */
   FatVolume* volume() const {
     return m_vol;
@@ -965,12 +1085,33 @@ class FatFile {
   bool openCluster(FatFile* file);
   static bool parsePathName(const char* str, fname_t* fname, const char** ptr);
   bool mkdir(FatFile* parent, fname_t* fname);
+#if USE_FAT_NAME_HASH
+  void nameHashAdd(uint16_t hash, uint16_t index);
+  bool nameHashNext(uint16_t hash, uint16_t* slot, uint16_t* index);
+#endif  // USE_FAT_NAME_HASH
   bool open(FatFile* dirFile, fname_t* fname, uint8_t oflag);
   bool openCachedEntry(FatFile* dirFile, uint16_t cacheIndex, uint8_t oflag,
                        uint8_t lfnOrd);
+#if USE_FAT_READ_AHEAD
+  bool readAhead(uint32_t block, uint8_t blockOfCluster);
+#endif  // USE_FAT_READ_AHEAD
   bool readLBN(uint32_t* lbn);
   dir_t* readDirCache(bool skipReadOk = false);
   bool setDirSize();
+#if USE_FAT_EXTENT_MAP
+  void extentAdd(uint32_t fileCluster, uint32_t cluster);
+  bool extentLookup(uint32_t fileCluster, uint32_t* cluster);
+#else  // USE_FAT_EXTENT_MAP
+  void extentAdd(uint32_t fileCluster, uint32_t cluster) {
+    (void)fileCluster;
+    (void)cluster;
+  }
+  bool extentLookup(uint32_t fileCluster, uint32_t* cluster) {
+    (void)fileCluster;
+    (void)cluster;
+    return false;
+  }
+#endif  // USE_FAT_EXTENT_MAP
 
   // bits defined in m_flags
   // should be 0X0F
@@ -997,5 +1138,23 @@ class FatFile {
   uint32_t   m_dirBlock;         // block for this files directory entry
   uint32_t   m_fileSize;         // file size in bytes
   uint32_t   m_firstCluster;     // first cluster of file
+#if USE_FAT_EXTENT_MAP
+  FatExtent* m_extent;           // caller supplied extent map or NULL
+  uint8_t    m_extentMax;        // number of elements in m_extent
+  uint8_t    m_extentCount;      // number of extents recorded
+  uint32_t   m_extentEnd;        // number of file clusters recorded
+#endif  // USE_FAT_EXTENT_MAP
+#if USE_FAT_NAME_HASH
+  FatNameHash* m_nameHash;       // caller supplied name hash table or NULL
+  uint16_t   m_nameHashMax;      // number of elements in m_nameHash
+  uint16_t   m_nameHashCount;    // number of names recorded
+#endif  // USE_FAT_NAME_HASH
+#if USE_FAT_READ_AHEAD
+  uint8_t*   m_raBuf;            // caller supplied read-ahead window or NULL
+  uint8_t    m_raMax;            // number of blocks in m_raBuf
+  uint8_t    m_raCount;          // number of valid blocks in m_raBuf
+  uint32_t   m_raBlock;          // first block held in m_raBuf
+  uint32_t   m_raPosition;       // file position following the last read
+#endif  // USE_FAT_READ_AHEAD
 };
 #endif  // FatFile_h
@@ -81,6 +81,42 @@ static bool lfnGetName(ldir_t *ldir, char* name, size_t n) {
   return true;
 }
 //------------------------------------------------------------------------------
+#if USE_FAT_NAME_HASH
+// Hash term for the lower case character at index k of a name.  Terms are
+// summed, so the parts of a long name may be hashed in any order.
+static uint16_t lfnHashChar(uint8_t c, uint16_t k) {
+  uint16_t x = static_cast<uint8_t>(lfnToLower(c)) << 8 | (k & 0XFF);
+  x ^= x >> 7;
+  x *= 0X2C1B;
+  x ^= x >> 9;
+  x *= 0X9E37;
+  return x ^ (x >> 8);
+}
+//------------------------------------------------------------------------------
+static uint16_t lfnHash(const char* name, size_t n) {
+  uint16_t hash = 0;
+  for (size_t k = 0; k < n; k++) {
+    hash += lfnHashChar(name[k], k);
+  }
+  return hash;
+}
+//------------------------------------------------------------------------------
+// Hash of a short name as it would be opened, "NAME.EXT".
+static uint16_t lfnHashSfn(const uint8_t* sfn) {
+  uint16_t hash = 0;
+  uint16_t k = 0;
+  for (uint8_t i = 0; i < 11; i++) {
+    if (i == 8 && sfn[8] != ' ') {
+      hash += lfnHashChar('.', k++);
+    }
+    if (sfn[i] != ' ') {
+      hash += lfnHashChar(sfn[i], k++);
+    }
+  }
+  return hash;
+}
+#endif  // USE_FAT_NAME_HASH
+//------------------------------------------------------------------------------
 inline bool lfnLegalChar(char c) {
   if (c == '/' || c == '\\' || c == '"' || c == '*' ||
       c == ':' || c == '<' || c == '>' || c == '?' || c == '|') {
@@ -285,6 +321,28 @@ bool FatFile::parsePathName(const char* path,
   return true;
 }
 //------------------------------------------------------------------------------
+#if USE_FAT_NAME_HASH
+void FatFile::nameHashAdd(uint16_t hash, uint16_t index) {
+  if (m_nameHashCount < m_nameHashMax) {
+    m_nameHash[m_nameHashCount].hash = hash;
+    m_nameHash[m_nameHashCount].index = index;
+    m_nameHashCount++;
+  }
+}
+//------------------------------------------------------------------------------
+bool FatFile::nameHashNext(uint16_t hash, uint16_t* slot, uint16_t* index) {
+  for (uint16_t i = *slot; i < m_nameHashCount; i++) {
+    if (m_nameHash[i].hash == hash) {
+      *slot = i + 1;
+      *index = m_nameHash[i].index;
+      return true;
+    }
+  }
+  *slot = m_nameHashCount;
+  return false;
+}
+#endif  // USE_FAT_NAME_HASH
+//------------------------------------------------------------------------------
 bool FatFile::open(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
   bool fnameFound = false;
   uint8_t lfnOrd = 0;
@@ -297,6 +355,12 @@ bool FatFile::open(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
   dir_t* dir;
   ldir_t* ldir;
   size_t len = fname->len;
+#if USE_FAT_NAME_HASH
+  bool probing;
+  uint16_t hash;
+  uint16_t hashSlot = 0;
+  uint16_t probeEnd = 0;
+#endif  // USE_FAT_NAME_HASH
 
   if (!dirFile->isDir() || isOpen()) {
     DBG_FAIL_MACRO;
@@ -305,10 +369,38 @@ bool FatFile::open(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
   // Number of directory entries needed.
   freeNeed = fname->flags & FNAME_FLAG_NEED_LFN ? 1 + (len + 12)/13 : 1;
 
+#if USE_FAT_NAME_HASH
+  hash = lfnHash(fname->lfn, len);
+
+probe:
+  // Try names with a matching hash before searching from the start.
+  lfnOrd = 0;
+  freeFound = 0;
+  fnameFound = false;
+  probing = dirFile->nameHashNext(hash, &hashSlot, &curIndex);
+  if (probing) {
+    // A match ends within the long name entries plus the short name entry.
+    probeEnd = curIndex + 2 + (len + 12)/13;
+    if (!dirFile->seekSet(32UL*curIndex)) {
+      goto probe;
+    }
+  } else {
+    dirFile->rewind();
+  }
+#else  // USE_FAT_NAME_HASH
   dirFile->rewind();
+#endif  // USE_FAT_NAME_HASH
   while (1) {
     curIndex = dirFile->m_curPosition/32;
+#if USE_FAT_NAME_HASH
+    if (probing && curIndex >= probeEnd) {
+      goto probe;
+    }
+    // The block at a probe's seek position may not be in the cache.
+    dir = dirFile->readDirCache(!probing);
+#else  // USE_FAT_NAME_HASH
     dir = dirFile->readDirCache(true);
+#endif  // USE_FAT_NAME_HASH
     if (!dir) {
       if (dirFile->getError()) {
         DBG_FAIL_MACRO;
@@ -396,6 +488,12 @@ found:
   goto open;
 
 create:
+#if USE_FAT_NAME_HASH
+  if (probing) {
+    // Not this entry, try the next match.
+    goto probe;
+  }
+#endif  // USE_FAT_NAME_HASH
   // don't create unless O_CREAT and O_WRITE
   if (!(oflag & O_CREAT) || !(oflag & O_WRITE)) {
     DBG_FAIL_MACRO;
@@ -484,6 +582,12 @@ create:
   dirFile->m_vol->cacheDirty();
 
 open:
+#if USE_FAT_NAME_HASH
+  if (!probing) {
+    // Found or created by search, remember where.
+    dirFile->nameHashAdd(hash, curIndex - lfnOrd);
+  }
+#endif  // USE_FAT_NAME_HASH
   // open entry in cache.
   if (!openCachedEntry(dirFile, curIndex, oflag, lfnOrd)) {
     DBG_FAIL_MACRO;
@@ -625,6 +729,88 @@ fail:
   return false;
 }
 //------------------------------------------------------------------------------
+#if USE_FAT_NAME_HASH
+bool FatFile::setNameHash(FatNameHash* table, uint16_t count) {
+  uint8_t ord = 0;
+  uint8_t chksum = 0;
+  uint16_t hash = 0;
+  uint16_t index = 0;
+  uint16_t curIndex;
+  FatPos_t pos;
+  dir_t* dir;
+  ldir_t* ldir;
+
+  if (!isDir()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_nameHash = count ? table : 0;
+  m_nameHashMax = m_nameHash ? count : 0;
+  m_nameHashCount = 0;
+
+  getpos(&pos);
+  rewind();
+  while (m_nameHashCount < m_nameHashMax) {
+    curIndex = m_curPosition/32;
+    dir = readDirCache(true);
+    if (!dir) {
+      if (getError()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // At EOF
+      break;
+    }
+    if (dir->name[0] == DIR_NAME_FREE) {
+      break;
+    }
+    if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == '.') {
+      ord = 0;
+    } else if (DIR_IS_LONG_NAME(dir)) {
+      ldir = reinterpret_cast<ldir_t*>(dir);
+      if (ldir->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        ord = ldir->ord & 0X1F;
+        chksum = ldir->chksum;
+        hash = 0;
+        index = curIndex;
+      } else if (ord > 1 && ldir->ord == ord - 1 && ldir->chksum == chksum) {
+        ord--;
+      } else {
+        ord = 0;
+      }
+      if (ord) {
+        uint16_t k = 13*(ord - 1);
+        for (uint8_t i = 0; i < 13; i++) {
+          uint16_t u = lfnGetChar(ldir, i);
+          if (u == 0) {
+            break;
+          }
+          hash += lfnHashChar(u, k++);
+        }
+      }
+    } else if (DIR_IS_FILE_OR_SUBDIR(dir)) {
+      if (ord != 1 || lfnChecksum(dir->name) != chksum) {
+        // No long name, use the short name.
+        hash = lfnHashSfn(dir->name);
+        index = curIndex;
+      }
+      nameHashAdd(hash, index);
+      ord = 0;
+    } else {
+      ord = 0;
+    }
+  }
+  setpos(&pos);
+  return true;
+
+fail:
+  m_nameHash = 0;
+  m_nameHashMax = 0;
+  m_nameHashCount = 0;
+  return false;
+}
+#endif  // USE_FAT_NAME_HASH
+//------------------------------------------------------------------------------
 bool FatFile::lfnUniqueSfn(fname_t* fname) {
   const uint8_t FIRST_HASH_SEQ = 2;  // min value is 2
   uint8_t pos = fname->seqPos;;
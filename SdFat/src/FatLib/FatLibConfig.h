@@ -66,6 +66,42 @@
 #endif  // __arm__
 #endif  // USE_SEPARATE_FAT_CACHE
 //------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_ENTRIES to the number of 512 byte blocks held by the
+ * volume's block cache.  With more than one entry the least recently used
+ * block is replaced, where file data blocks are replaced before directory
+ * blocks and directory blocks before FAT blocks.  USE_SEPARATE_FAT_CACHE is
+ * then not needed and is ignored.  Each entry costs 512 bytes of RAM, so only
+ * ARM defaults to more than one.
+ */
+#ifndef FAT_CACHE_ENTRIES
+#ifdef __arm__
+#define FAT_CACHE_ENTRIES 4
+#else  // __arm__
+#define FAT_CACHE_ENTRIES 1
+#endif  // __arm__
+#endif  // FAT_CACHE_ENTRIES
+#if FAT_CACHE_ENTRIES > 1
+#undef USE_SEPARATE_FAT_CACHE
+#define USE_SEPARATE_FAT_CACHE 0
+#endif  // FAT_CACHE_ENTRIES
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_STATS nonzero to count block cache hits and misses, see
+ * FatVolume::cacheHits() and FatVolume::cacheMisses().
+ */
+#ifndef FAT_CACHE_STATS
+#define FAT_CACHE_STATS 0
+#endif  // FAT_CACHE_STATS
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_TRACE nonzero to pass block reads, with their latency, and block
+ * cache misses to the function set in fatTraceHook.
+ */
+#ifndef FAT_TRACE
+#define FAT_TRACE 0
+#endif  // FAT_TRACE
+//------------------------------------------------------------------------------
 /**
  * Set USE_MULTI_BLOCK_IO non-zero to use multi-block SD read/write.
  *
@@ -79,6 +115,19 @@
 #endif  // RAMEND
 #endif  // USE_MULTI_BLOCK_IO
 //------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_READ_AHEAD nonzero to allow a read-only file to stream small
+ * sequential reads through a caller supplied window of blocks, see
+ * FatFile::setReadAhead().  Each window is filled with one multi-block read,
+ * spanning physically contiguous clusters.  Requires USE_MULTI_BLOCK_IO.
+ */
+#ifndef USE_FAT_READ_AHEAD
+#define USE_FAT_READ_AHEAD USE_MULTI_BLOCK_IO
+#endif  // USE_FAT_READ_AHEAD
+#if USE_FAT_READ_AHEAD && !USE_MULTI_BLOCK_IO
+#error USE_FAT_READ_AHEAD requires USE_MULTI_BLOCK_IO
+#endif  // USE_FAT_READ_AHEAD && !USE_MULTI_BLOCK_IO
+//------------------------------------------------------------------------------
 /** 
  * Set MAINTAIN_FREE_CLUSTER_COUNT nonzero to keep the count of free clusters
  * updated.  This will increase the speed of the freeClusterCount() call
@@ -88,6 +137,59 @@
 #define MAINTAIN_FREE_CLUSTER_COUNT 0
 #endif  // MAINTAIN_FREE_CLUSTER_COUNT
 //------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_FSINFO nonzero to trust the free cluster count and next free
+ * cluster hint of a FAT32 volume's FSINFO sector when the volume is mounted,
+ * rather than scanning the FAT for freeClusterCount().  Both are written
+ * back by the next sync after clusters are allocated or freed.  Requires
+ * MAINTAIN_FREE_CLUSTER_COUNT.
+ */
+#ifndef USE_FAT_FSINFO
+#define USE_FAT_FSINFO 0
+#endif  // USE_FAT_FSINFO
+#if USE_FAT_FSINFO && !MAINTAIN_FREE_CLUSTER_COUNT
+#error USE_FAT_FSINFO requires MAINTAIN_FREE_CLUSTER_COUNT
+#endif  // USE_FAT_FSINFO && !MAINTAIN_FREE_CLUSTER_COUNT
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_FREE_MAP nonzero to allow a volume to summarize its FAT in a
+ * caller supplied map, see FatVolume::setFreeMap().  Each group of FAT
+ * blocks is recorded as full, partly free or empty when first scanned, with
+ * multi-block reads if a buffer is supplied.  Cluster allocation then skips
+ * full groups and allocContiguous() claims empty groups without reading them.
+ */
+#ifndef USE_FAT_FREE_MAP
+#define USE_FAT_FREE_MAP USE_MULTI_BLOCK_IO
+#endif  // USE_FAT_FREE_MAP
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_EXTENT_MAP nonzero to allow a file to record its cluster chain
+ * as runs of contiguous clusters in a caller supplied array, see
+ * FatFile::setExtentMap().  Seeks within the recorded part of the file then
+ * need no FAT reads.  Adds eight bytes of RAM to each file object.
+ */
+#ifndef USE_FAT_EXTENT_MAP
+#define USE_FAT_EXTENT_MAP 1
+#endif  // USE_FAT_EXTENT_MAP
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_NAME_HASH nonzero to allow a directory to index its names in
+ * a caller supplied hash table, see FatFile::setNameHash().  Opening a file
+ * by long or short name then reads only the directory entries of names with
+ * a matching hash.  Requires USE_LONG_FILE_NAMES.  Adds up to eight bytes
+ * of RAM to each file object.
+ *
+ * The table is not cleared when names are created, removed or renamed.
+ * Each probe compares the name with the directory entries it points to,
+ * so a stale entry costs only a normal search.
+ */
+#ifndef USE_FAT_NAME_HASH
+#define USE_FAT_NAME_HASH USE_LONG_FILE_NAMES
+#endif  // USE_FAT_NAME_HASH
+#if USE_FAT_NAME_HASH && !USE_LONG_FILE_NAMES
+#error USE_FAT_NAME_HASH requires USE_LONG_FILE_NAMES
+#endif  // USE_FAT_NAME_HASH && !USE_LONG_FILE_NAMES
+//------------------------------------------------------------------------------
 /**
  * Set DESTRUCTOR_CLOSES_FILE non-zero to close a file in its destructor.
  *
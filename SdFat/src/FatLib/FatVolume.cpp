@@ -19,45 +19,94 @@
  */
 #include <string.h>
 #include "FatVolume.h"
+#if FAT_TRACE
+void (*fatTraceHook)(uint8_t, uint32_t, uint16_t, uint32_t) = 0;
+#endif  // FAT_TRACE
 //------------------------------------------------------------------------------
 cache_t* FatCache::read(uint32_t lbn, uint8_t option) {
-  if (m_lbn != lbn) {
-    if (!sync()) {
+  uint8_t i;
+  for (i = 0; i < FAT_CACHE_ENTRIES; i++) {
+    if (m_lbn[i] == lbn) {
+#if FAT_CACHE_STATS
+      m_hits++;
+#endif  // FAT_CACHE_STATS
+      goto done;
+    }
+  }
+#if FAT_TRACE
+  if (fatTraceHook) {
+    fatTraceHook(FAT_TRACE_CACHE_MISS, lbn, option, 0);
+  }
+#endif  // FAT_TRACE
+  i = victim();
+  if (!syncEntry(i)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // entry is stale until the new block is read
+  m_status[i] = 0;
+  m_lbn[i] = 0XFFFFFFFF;
+  if (!(option & CACHE_OPTION_NO_READ)) {
+    if (!m_vol->readBlock(lbn, m_block[i].data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
-    if (!(option & CACHE_OPTION_NO_READ)) {
-      if (!m_vol->readBlock(lbn, m_block.data)) {
-        DBG_FAIL_MACRO;
-        goto fail;
-      }
-    }
-    m_status = 0;
-    m_lbn = lbn;
   }
-  m_status |= option & CACHE_STATUS_MASK;
-  return &m_block;
+  m_lbn[i] = lbn;
+#if FAT_CACHE_STATS
+  m_misses++;
+#endif  // FAT_CACHE_STATS
 
-fail:
+done:
+  m_status[i] |= option & CACHE_STATUS_MASK;
+  // FAT access does not move the current block
+  if (!(option & CACHE_STATUS_MIRROR_FAT)) {
+    m_cur = i;
+  }
+#if FAT_CACHE_ENTRIES > 1
+  m_used[i] = ++m_tick;
+#endif  // FAT_CACHE_ENTRIES > 1
+  return &m_block[i];
 
+fail:
   return 0;
 }
 //------------------------------------------------------------------------------
 bool FatCache::sync() {
-  if (m_status & CACHE_STATUS_DIRTY) {
-    if (!m_vol->writeBlock(m_lbn, m_block.data)) {
+  for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+    if (!syncEntry(i)) {
+      DBG_FAIL_MACRO;
+      return false;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+bool FatCache::sync(uint32_t lbn, uint32_t count) {
+  for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+    if ((m_lbn[i] - lbn) < count && !syncEntry(i)) {
+      DBG_FAIL_MACRO;
+      return false;
+    }
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+bool FatCache::syncEntry(uint8_t i) {
+  if (m_status[i] & CACHE_STATUS_DIRTY) {
+    if (!m_vol->writeBlock(m_lbn[i], m_block[i].data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
     // mirror second FAT
-    if (m_status & CACHE_STATUS_MIRROR_FAT) {
-      uint32_t lbn = m_lbn + m_vol->blocksPerFat();
-      if (!m_vol->writeBlock(lbn, m_block.data)) {
+    if (m_status[i] & CACHE_STATUS_MIRROR_FAT) {
+      uint32_t lbn = m_lbn[i] + m_vol->blocksPerFat();
+      if (!m_vol->writeBlock(lbn, m_block[i].data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
     }
-    m_status &= ~CACHE_STATUS_DIRTY;
+    m_status[i] &= ~CACHE_STATUS_DIRTY;
   }
   return true;
 
@@ -65,15 +114,68 @@ fail:
   return false;
 }
 //------------------------------------------------------------------------------
+// Select the entry to be replaced.  Never the current block, so pointers
+// to it remain valid across FAT access.  Otherwise an unused entry, else
+// the least recently used of the lowest priority: data, directory, FAT.
+uint8_t FatCache::victim() {
+#if FAT_CACHE_ENTRIES > 1
+  uint8_t best = m_cur ? 0 : 1;
+  uint8_t bestRank = 0XFF;
+  uint16_t bestAge = 0;
+  for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+    if (i == m_cur) {
+      continue;
+    }
+    if (m_lbn[i] == 0XFFFFFFFF) {
+      return i;
+    }
+    uint8_t rank = m_status[i] & CACHE_STATUS_MIRROR_FAT ? 2 :
+                   m_status[i] & CACHE_STATUS_DIR ? 1 : 0;
+    uint16_t age = m_tick - m_used[i];
+    if (rank < bestRank || (rank == bestRank && age > bestAge)) {
+      best = i;
+      bestRank = rank;
+      bestAge = age;
+    }
+  }
+  return best;
+#else  // FAT_CACHE_ENTRIES > 1
+  return 0;
+#endif  // FAT_CACHE_ENTRIES > 1
+}
+//------------------------------------------------------------------------------
 bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
   uint32_t find = current ? current : m_allocSearchStart;
   uint32_t start = find;
+#if USE_FAT_FREE_MAP
+  uint32_t mask = (1UL << m_freeMapShift) - 1;
+  bool wholeGroup = false;
+#endif  // USE_FAT_FREE_MAP
   while (1) {
     find++;
     // If at end of FAT go to beginning of FAT.
     if (find > m_lastCluster) {
       find = 2;
     }
+#if USE_FAT_FREE_MAP
+    if (freeMapGet(find) == FREE_MAP_FULL) {
+      // Skip to the last cluster of a full group.
+      uint32_t last = find | mask;
+      if (last > m_lastCluster) {
+        last = m_lastCluster;
+      }
+      if ((start - find) <= (last - find)) {
+        // Can't find space, search start is in the group.
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      find = last;
+      continue;
+    }
+    if (m_freeMap && (find & mask) == 0) {
+      wholeGroup = true;
+    }
+#endif  // USE_FAT_FREE_MAP
     uint32_t f;
     int8_t fg = fatGet(find, &f);
     if (fg < 0) {
@@ -83,6 +185,13 @@ bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
     if (fg && f == 0) {
       break;
     }
+#if USE_FAT_FREE_MAP
+    if (wholeGroup && ((find & mask) == mask || find == m_lastCluster)) {
+      // Searched all of the group.
+      freeMapSet(find >> m_freeMapShift, FREE_MAP_FULL);
+      wholeGroup = false;
+    }
+#endif  // USE_FAT_FREE_MAP
     if (find == start) {
       // Can't find space checked all clusters.
       DBG_FAIL_MACRO;
@@ -105,6 +214,7 @@ bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
     m_allocSearchStart = find;
   }
   updateFreeClusterCount(-1);
+  freeMapAlloc(find, find);
   *next = find;
   return true;
 
@@ -130,6 +240,35 @@ bool FatVolume::allocContiguous(uint32_t count, uint32_t* firstCluster) {
     if (endCluster > m_lastCluster) {
       bgnCluster = endCluster = 2;
     }
+#if USE_FAT_FREE_MAP
+    uint8_t state = freeMapGet(endCluster);
+    if (state == FREE_MAP_FULL || state == FREE_MAP_EMPTY) {
+      // Take or skip the rest of the group without reading the FAT.
+      uint32_t last = endCluster | ((1UL << m_freeMapShift) - 1);
+      if (last > m_lastCluster) {
+        last = m_lastCluster;
+      }
+      bool wrapped = (startCluster - endCluster) <= (last - endCluster);
+      if (wrapped) {
+        last = startCluster;
+      }
+      if (state == FREE_MAP_FULL) {
+        bgnCluster = last + 1;
+        setStart = false;
+      } else if ((last - bgnCluster + 1) >= count) {
+        // done - found space
+        endCluster = bgnCluster + count - 1;
+        break;
+      }
+      if (wrapped) {
+        // Can't find space if all clusters checked.
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      endCluster = last + 1;
+      continue;
+    }
+#endif  // USE_FAT_FREE_MAP
     uint32_t f;
     int8_t fg = fatGet(endCluster, &f);
     if (fg < 0) {
@@ -175,6 +314,7 @@ bool FatVolume::allocContiguous(uint32_t count, uint32_t* firstCluster) {
   }
   // Maintain count of free clusters.
   updateFreeClusterCount(-count);
+  freeMapAlloc(bgnCluster, bgnCluster + count - 1);
 
   // return first cluster number to caller
   *firstCluster = bgnCluster;
@@ -343,6 +483,7 @@ bool FatVolume::freeChain(uint32_t cluster) {
     }
     // Add one to count of free clusters.
     updateFreeClusterCount(1);
+    freeMapFree(cluster);
 
     if (cluster < m_allocSearchStart) {
       m_allocSearchStart = cluster;
@@ -367,6 +508,19 @@ int32_t FatVolume::freeClusterCount() {
   uint32_t todo = m_lastCluster + 1;
   uint16_t n;
 
+#if USE_FAT_FREE_MAP
+  if (m_freeMap) {
+    // Rescan every group, refreshing the map.
+    for (uint32_t g = 0; g <= (m_lastCluster >> m_freeMapShift); g++) {
+      int32_t nf = freeMapScan(g);
+      if (nf < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      free += nf;
+    }
+  } else
+#endif  // USE_FAT_FREE_MAP
   if (FAT12_SUPPORT && fatType() == 12) {
     for (unsigned i = 2; i < todo; i++) {
       uint32_t c;
@@ -412,12 +566,162 @@ int32_t FatVolume::freeClusterCount() {
     goto fail;
   }
   setFreeClusterCount(free);
+#if USE_FAT_FSINFO
+  m_fsInfoDirty = true;
+#endif  // USE_FAT_FSINFO
+  return free;
+
+fail:
+  return -1;
+}
+//------------------------------------------------------------------------------
+#if USE_FAT_FREE_MAP
+// Update the map for clusters first through last allocated.
+void FatVolume::freeMapAlloc(uint32_t first, uint32_t last) {
+  if (!m_freeMap) {
+    return;
+  }
+  uint32_t mask = (1UL << m_freeMapShift) - 1;
+  while (first <= last) {
+    uint32_t group = first >> m_freeMapShift;
+    uint32_t lo = first & ~mask;
+    uint32_t hi = first | mask;
+    if (lo < 2) {
+      lo = 2;
+    }
+    if (hi > m_lastCluster) {
+      hi = m_lastCluster;
+    }
+    if (first == lo && last >= hi) {
+      freeMapSet(group, FREE_MAP_FULL);
+    } else if (freeMapState(group) == FREE_MAP_EMPTY) {
+      freeMapSet(group, FREE_MAP_PARTIAL);
+    }
+    if (hi >= last) {
+      break;
+    }
+    first = hi + 1;
+  }
+}
+//------------------------------------------------------------------------------
+// Update the map for a freed cluster.
+void FatVolume::freeMapFree(uint32_t cluster) {
+  uint32_t group = cluster >> m_freeMapShift;
+  if (m_freeMap && freeMapState(group) == FREE_MAP_FULL) {
+    freeMapSet(group, FREE_MAP_PARTIAL);
+  }
+}
+//------------------------------------------------------------------------------
+// State of the group holding a cluster, scanning the group if not known.
+uint8_t FatVolume::freeMapGet(uint32_t cluster) {
+  if (!m_freeMap) {
+    return FREE_MAP_PARTIAL;
+  }
+  uint32_t group = cluster >> m_freeMapShift;
+  uint8_t state = freeMapState(group);
+  if (state == FREE_MAP_UNKNOWN) {
+    if (freeMapScan(group) < 0) {
+      // Let the caller read the FAT as usual.
+      return FREE_MAP_PARTIAL;
+    }
+    state = freeMapState(group);
+  }
+  return state;
+}
+//------------------------------------------------------------------------------
+// Count the free clusters of a group and record its state in the map.
+int32_t FatVolume::freeMapScan(uint32_t group) {
+  uint8_t entryShift = fatType() == 16 ? 1 : 2;
+  uint32_t cluster = group << m_freeMapShift;
+  uint32_t end = cluster + (1UL << m_freeMapShift);
+  uint32_t lbn = m_fatStartBlock + (cluster >> (9 - entryShift));
+  uint32_t total;
+  uint32_t free = 0;
+  uint8_t entrySize = 1 << entryShift;
+
+  if (end > m_lastCluster + 1) {
+    end = m_lastCluster + 1;
+  }
+  total = end - (cluster < 2 ? 2 : cluster);
+  while (cluster < end) {
+    uint32_t nb = 1;
+    const uint8_t* src;
+#if USE_MULTI_BLOCK_IO
+    if (m_freeMapBuf) {
+      nb = ((end - cluster - 1) >> (9 - entryShift)) + 1;
+      if (nb > m_freeMapBufBlocks) {
+        nb = m_freeMapBufBlocks;
+      }
+      // The cache may hold newer copies of these FAT blocks.
+      if (!cacheSyncFat(lbn, nb) || !readBlocks(lbn, m_freeMapBuf, nb)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      src = m_freeMapBuf;
+    } else {
+#else  // USE_MULTI_BLOCK_IO
+    {
+#endif  // USE_MULTI_BLOCK_IO
+      cache_t* pc = cacheFetchFat(lbn, FatCache::CACHE_FOR_READ);
+      if (!pc) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      src = pc->data;
+    }
+    lbn += nb;
+    for (uint32_t i = nb << (9 - entryShift); i && cluster < end;
+         i--, cluster++, src += entrySize) {
+      if (cluster < 2) {
+        continue;
+      }
+      uint8_t k = 0;
+      while (k < entrySize && src[k] == 0) {
+        k++;
+      }
+      if (k == entrySize) {
+        free++;
+      }
+    }
+  }
+  freeMapSet(group, free == 0 ? FREE_MAP_FULL :
+             free == total ? FREE_MAP_EMPTY : FREE_MAP_PARTIAL);
   return free;
 
 fail:
   return -1;
 }
 //------------------------------------------------------------------------------
+void FatVolume::freeMapSet(uint32_t group, uint8_t state) {
+  uint8_t shift = 2*(group & 3);
+  m_freeMap[group >> 2] = (m_freeMap[group >> 2] & ~(3 << shift))
+                          | (state << shift);
+}
+#endif  // USE_FAT_FREE_MAP
+//------------------------------------------------------------------------------
+#if USE_FAT_FSINFO
+// Write the free count and next free hint to FSINFO if changed.
+bool FatVolume::fsInfoSync() {
+  cache_t* pc;
+  if (!m_fsInfoDirty || !m_fsInfoBlock) {
+    return true;
+  }
+  pc = cacheFetchData(m_fsInfoBlock, FatCache::CACHE_FOR_WRITE);
+  if (!pc) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  pc->fsinfo.freeCount = m_freeClusterCount;
+  pc->fsinfo.nextFree = m_allocSearchStart < m_lastCluster ?
+                        m_allocSearchStart + 1 : 0XFFFFFFFF;
+  m_fsInfoDirty = false;
+  return true;
+
+fail:
+  return false;
+}
+#endif  // USE_FAT_FSINFO
+//------------------------------------------------------------------------------
 bool FatVolume::init(uint8_t part) {
   uint32_t clusterCount;
   uint32_t totalBlocks;
@@ -427,6 +731,15 @@ bool FatVolume::init(uint8_t part) {
   uint8_t tmp;
   m_fatType = 0;
   m_allocSearchStart = 1;
+#if USE_FAT_FREE_MAP
+  m_freeMap = 0;
+  m_freeMapBuf = 0;
+  m_freeMapShift = 0;
+#endif  // USE_FAT_FREE_MAP
+#if USE_FAT_FSINFO
+  m_fsInfoDirty = false;
+  m_fsInfoBlock = 0;
+#endif  // USE_FAT_FSINFO
   m_cache.init(this);
 #if USE_SEPARATE_FAT_CACHE
   m_fatCache.init(this);
@@ -511,12 +824,64 @@ bool FatVolume::init(uint8_t part) {
   } else {
     m_rootDirStart = fbs->fat32RootCluster;
     m_fatType = 32;
+#if USE_FAT_FSINFO
+    if (fbs->fat32FSInfo == 0 || fbs->fat32FSInfo == 0XFFFF) {
+      // No FSINFO sector.
+      return true;
+    }
+    m_fsInfoBlock = volumeStartBlock + fbs->fat32FSInfo;
+    pc = cacheFetchData(m_fsInfoBlock, FatCache::CACHE_FOR_READ);
+    if (!pc) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (pc->fsinfo.leadSignature != FSINFO_LEAD_SIG ||
+        pc->fsinfo.structSignature != FSINFO_STRUCT_SIG) {
+      // Not valid, don't write it.
+      m_fsInfoBlock = 0;
+      return true;
+    }
+    // Trust the free count and next free hint if in range.
+    if (pc->fsinfo.freeCount <= clusterCount) {
+      setFreeClusterCount(pc->fsinfo.freeCount);
+    }
+    if (pc->fsinfo.nextFree >= 2 && pc->fsinfo.nextFree <= m_lastCluster) {
+      m_allocSearchStart = pc->fsinfo.nextFree - 1;
+    }
+#endif  // USE_FAT_FSINFO
+  }
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+#if USE_FAT_FREE_MAP
+bool FatVolume::setFreeMap(uint8_t* map, size_t size,
+                           uint8_t* buf, uint8_t count) {
+  if (fatType() != 16 && fatType() != 32) {
+    DBG_FAIL_MACRO;
+    goto fail;
   }
+  m_freeMap = 0;
+  if (!map || !size) {
+    return true;
+  }
+  // Smallest group of whole FAT blocks that fits the map.
+  m_freeMapShift = fatType() == 16 ? 8 : 7;
+  while (((m_lastCluster >> m_freeMapShift) + 4)/4 > size) {
+    m_freeMapShift++;
+  }
+  memset(map, 0, ((m_lastCluster >> m_freeMapShift) + 4)/4);
+  m_freeMap = map;
+  m_freeMapBuf = count ? buf : 0;
+  m_freeMapBufBlocks = count;
   return true;
 
 fail:
   return false;
 }
+#endif  // USE_FAT_FREE_MAP
 //------------------------------------------------------------------------------
 bool FatVolume::wipe(print_t* pr) {
   cache_t* cache;
@@ -526,6 +891,11 @@ bool FatVolume::wipe(print_t* pr) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+  setFreeClusterCount(-1);
+#if USE_FAT_FSINFO
+  // Mark the FSINFO free count unknown.
+  m_fsInfoDirty = true;
+#endif  // USE_FAT_FSINFO
   cache = cacheClear();
   if (!cache) {
     DBG_FAIL_MACRO;
@@ -59,6 +59,19 @@ class CharWriter {
 typedef CharWriter print_t;
 #endif  // ENABLE_ARDUINO_FEATURES
 //------------------------------------------------------------------------------
+#if FAT_TRACE || defined(DOXYGEN)
+/** Trace event type for blocks read: lbn, block count and microseconds. */
+const uint8_t FAT_TRACE_READ = 1;
+/** Trace event type for a block cache miss: lbn and cache option. */
+const uint8_t FAT_TRACE_CACHE_MISS = 2;
+/**
+ * Function called, if not NULL, for each trace event.
+ * Arguments are the event type, lbn, count or option, and microseconds.
+ */
+extern void (*fatTraceHook)(uint8_t type, uint32_t lbn,
+                            uint16_t count, uint32_t micros);
+#endif  // FAT_TRACE
+//------------------------------------------------------------------------------
 // Forward declaration of FatVolume.
 class FatVolume;
 //------------------------------------------------------------------------------
@@ -87,6 +100,9 @@ union cache_t {
 /**
  * \class FatCache
  * \brief Block cache.
+ *
+ * Holds FAT_CACHE_ENTRIES blocks.  The block most recently fetched for data
+ * or directory access is the current block, returned by block() and lbn().
  */
 class FatCache {
  public:
@@ -94,9 +110,11 @@ class FatCache {
   static const uint8_t CACHE_STATUS_DIRTY = 1;
   /** Cashed block is FAT entry and must be mirrored in second FAT. */
   static const uint8_t CACHE_STATUS_MIRROR_FAT = 2;
+  /** Cached block holds directory entries, kept in preference to data. */
+  static const uint8_t CACHE_STATUS_DIR = 8;
   /** Cache block status bits */
   static const uint8_t CACHE_STATUS_MASK
-    = CACHE_STATUS_DIRTY | CACHE_STATUS_MIRROR_FAT;
+    = CACHE_STATUS_DIRTY | CACHE_STATUS_MIRROR_FAT | CACHE_STATUS_DIR;
   /** Sync existing block but do not read new block. */
   static const uint8_t CACHE_OPTION_NO_READ = 4;
   /** Cache block for read. */
@@ -108,11 +126,21 @@ class FatCache {
     = CACHE_STATUS_DIRTY | CACHE_OPTION_NO_READ;
   /** \return Cache block address. */
   cache_t* block() {
-    return &m_block;
+    return &m_block[m_cur];
+  }
+  /** \param[in] lbn Logical block number.
+   * \return true if the block is in the cache. */
+  bool contains(uint32_t lbn) {
+    for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+      if (m_lbn[i] == lbn) {
+        return true;
+      }
+    }
+    return false;
   }
   /** Set current block dirty. */
   void dirty() {
-    m_status |= CACHE_STATUS_DIRTY;
+    m_status[m_cur] |= CACHE_STATUS_DIRTY;
   }
   /** Initialize the cache.
    * \param[in] vol FatVolume that owns this FatCache.
@@ -120,35 +148,92 @@ class FatCache {
   void init(FatVolume *vol) {
     m_vol = vol;
     invalidate();
+#if FAT_CACHE_STATS
+    resetStats();
+#endif  // FAT_CACHE_STATS
   }
-  /** Invalidate current cache block. */
+  /** Invalidate all cache blocks. */
   void invalidate() {
-    m_status = 0;
-    m_lbn = 0XFFFFFFFF;
+    for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+      m_status[i] = 0;
+      m_lbn[i] = 0XFFFFFFFF;
+#if FAT_CACHE_ENTRIES > 1
+      m_used[i] = 0;
+#endif  // FAT_CACHE_ENTRIES > 1
+    }
+    m_cur = 0;
+#if FAT_CACHE_ENTRIES > 1
+    m_tick = 0;
+#endif  // FAT_CACHE_ENTRIES > 1
+  }
+  /** Invalidate cache blocks in a range, without writing them.
+   * \param[in] lbn First block of the range.
+   * \param[in] count Number of blocks in the range.
+   */
+  void invalidate(uint32_t lbn, uint32_t count) {
+    for (uint8_t i = 0; i < FAT_CACHE_ENTRIES; i++) {
+      if ((m_lbn[i] - lbn) < count) {
+        m_status[i] = 0;
+        m_lbn[i] = 0XFFFFFFFF;
+      }
+    }
   }
   /** \return dirty status */
   bool isDirty() {
-    return m_status & CACHE_STATUS_DIRTY;
+    return m_status[m_cur] & CACHE_STATUS_DIRTY;
   }
   /** \return Logical block number for cached block. */
   uint32_t lbn() {
-    return m_lbn;
+    return m_lbn[m_cur];
   }
   /** Read a block into the cache.
    * \param[in] lbn Block to read.
    * \param[in] option mode for cached block.
    * \return Address of cached block. */
   cache_t* read(uint32_t lbn, uint8_t option);
-  /** Write current block if dirty.
+  /** Write all dirty blocks.
    * \return true for success else false.
    */
   bool sync();
+  /** Write dirty blocks in a range.
+   * \param[in] lbn First block of the range.
+   * \param[in] count Number of blocks in the range.
+   * \return true for success else false.
+   */
+  bool sync(uint32_t lbn, uint32_t count);
+#if FAT_CACHE_STATS || defined(DOXYGEN)
+  /** \return Number of reads satisfied by the cache. */
+  uint32_t hits() const {
+    return m_hits;
+  }
+  /** \return Number of reads that required a block to be read or reserved. */
+  uint32_t misses() const {
+    return m_misses;
+  }
+  /** Zero the hit and miss counts. */
+  void resetStats() {
+    m_hits = 0;
+    m_misses = 0;
+  }
+#endif  // FAT_CACHE_STATS
 
  private:
-  uint8_t m_status;
+  bool syncEntry(uint8_t i);
+  uint8_t victim();
+
+  uint8_t m_cur;
+  uint8_t m_status[FAT_CACHE_ENTRIES];
+#if FAT_CACHE_ENTRIES > 1
+  uint16_t m_tick;
+  uint16_t m_used[FAT_CACHE_ENTRIES];
+#endif  // FAT_CACHE_ENTRIES > 1
+#if FAT_CACHE_STATS
+  uint32_t m_hits;
+  uint32_t m_misses;
+#endif  // FAT_CACHE_STATS
   FatVolume* m_vol;
-  uint32_t m_lbn;
-  cache_t m_block;
+  uint32_t m_lbn[FAT_CACHE_ENTRIES];
+  cache_t m_block[FAT_CACHE_ENTRIES];
 };
 //==============================================================================
 /**
@@ -179,6 +264,31 @@ class FatVolume {
     m_cache.invalidate();
     return m_cache.block();
   }
+#if FAT_CACHE_STATS || defined(DOXYGEN)
+  /** \return Number of block reads satisfied by the cache. */
+  uint32_t cacheHits() {
+#if USE_SEPARATE_FAT_CACHE
+    return m_cache.hits() + m_fatCache.hits();
+#else  // USE_SEPARATE_FAT_CACHE
+    return m_cache.hits();
+#endif  // USE_SEPARATE_FAT_CACHE
+  }
+  /** \return Number of block reads that missed the cache. */
+  uint32_t cacheMisses() {
+#if USE_SEPARATE_FAT_CACHE
+    return m_cache.misses() + m_fatCache.misses();
+#else  // USE_SEPARATE_FAT_CACHE
+    return m_cache.misses();
+#endif  // USE_SEPARATE_FAT_CACHE
+  }
+  /** Zero the cache hit and miss counts. */
+  void cacheResetStats() {
+    m_cache.resetStats();
+#if USE_SEPARATE_FAT_CACHE
+    m_fatCache.resetStats();
+#endif  // USE_SEPARATE_FAT_CACHE
+  }
+#endif  // FAT_CACHE_STATS
   /** \return The total number of clusters in the volume. */
   uint32_t clusterCount() const {
     return m_lastCluster - 1;
@@ -228,6 +338,42 @@ class FatVolume {
    * the value false is returned for failure.
    */
   bool init(uint8_t part);
+#if USE_FAT_FREE_MAP || defined(DOXYGEN)
+  /** Summarize the FAT in a caller supplied map of free space.
+   *
+   * The clusters of the volume are divided into groups of whole FAT blocks,
+   * as few as fit two bits each in \a size bytes.  A group is recorded as
+   * full, partly free or empty the first time cluster allocation reaches
+   * it, or for all groups by freeClusterCount().  Allocation then skips
+   * full groups, and allocContiguous() takes empty groups without reading
+   * their FAT blocks.
+   *
+   * With \a buf, the FAT blocks of a group are scanned with multi-block
+   * reads of up to \a count blocks, otherwise one block at a time through
+   * the cache.
+   *
+   * \note FAT16 and FAT32 volumes only.  The map is forgotten when the
+   * volume is initialized, so must be set after each begin().  It must
+   * remain valid while in use.  Changes to the FAT made other than through
+   * this volume object are not seen.
+   *
+   * \param[in] map Array of \a size bytes, or NULL to stop using a map.
+   * \param[in] size Size of \a map in bytes.
+   * \param[in] buf Buffer of 512*\a count bytes for FAT reads, or NULL.
+   * \param[in] count Number of blocks in \a buf.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool setFreeMap(uint8_t* map, size_t size,
+                  uint8_t* buf = 0, uint8_t count = 0);
+  /** \return Number of clusters summarized by each two bit entry of the
+   * free map, or zero if there is no map.
+   */
+  uint32_t freeMapGroupSize() const {
+    return m_freeMap ? 1UL << m_freeMapShift : 0;
+  }
+#endif  // USE_FAT_FREE_MAP
   /** \return The number of entries in the root directory for FAT16 volumes. */
   uint16_t rootDirEntryCount() const {
     return m_rootDirEntryCount;
@@ -274,10 +420,33 @@ class FatVolume {
   uint32_t m_fatStartBlock;        // Start block for first FAT.
   uint32_t m_lastCluster;          // Last cluster number in FAT.
   uint32_t m_rootDirStart;         // Start block for FAT16, cluster for FAT32.
+#if USE_FAT_FREE_MAP
+  static const uint8_t FREE_MAP_UNKNOWN = 0;  // group not yet scanned
+  static const uint8_t FREE_MAP_FULL = 1;     // no free clusters in group
+  static const uint8_t FREE_MAP_PARTIAL = 2;  // some clusters may be free
+  static const uint8_t FREE_MAP_EMPTY = 3;    // all clusters in group free
+  uint8_t* m_freeMap;              // Caller supplied map, 2 bits per group.
+  uint8_t* m_freeMapBuf;           // Caller supplied FAT read buffer or NULL.
+  uint8_t  m_freeMapBufBlocks;     // Number of blocks in m_freeMapBuf.
+  uint8_t  m_freeMapShift;         // Group size in clusters shift.
+#endif  // USE_FAT_FREE_MAP
+#if USE_FAT_FSINFO
+  bool     m_fsInfoDirty;          // Free count changed since FSINFO written.
+  uint32_t m_fsInfoBlock;          // FSINFO block or zero if none.
+#endif  // USE_FAT_FSINFO
 //------------------------------------------------------------------------------
   // block I/O functions.
   bool readBlock(uint32_t block, uint8_t* dst) {
+#if FAT_TRACE
+    uint32_t m = micros();
+    bool rtn = m_blockDev->readBlock(block, dst);
+    if (fatTraceHook) {
+      fatTraceHook(FAT_TRACE_READ, block, 1, micros() - m);
+    }
+    return rtn;
+#else  // FAT_TRACE
     return m_blockDev->readBlock(block, dst);
+#endif  // FAT_TRACE
   }
   bool syncBlocks() {
     return m_blockDev->syncBlocks();
@@ -287,7 +456,16 @@ class FatVolume {
   }
 #if USE_MULTI_BLOCK_IO
   bool readBlocks(uint32_t block, uint8_t* dst, size_t nb) {
+#if FAT_TRACE
+    uint32_t m = micros();
+    bool rtn = m_blockDev->readBlocks(block, dst, nb);
+    if (fatTraceHook) {
+      fatTraceHook(FAT_TRACE_READ, block, nb, micros() - m);
+    }
+    return rtn;
+#else  // FAT_TRACE
     return m_blockDev->readBlocks(block, dst, nb);
+#endif  // FAT_TRACE
   }
   bool writeBlocks(uint32_t block, const uint8_t* src, size_t nb) {
     return m_blockDev->writeBlocks(block, src, nb);
@@ -301,6 +479,9 @@ class FatVolume {
   void updateFreeClusterCount(int32_t change) {
     if (m_freeClusterCount >= 0) {
       m_freeClusterCount += change;
+#if USE_FAT_FSINFO
+      m_fsInfoDirty = true;
+#endif  // USE_FAT_FSINFO
     }
   }
 #else  // MAINTAIN_FREE_CLUSTER_COUNT
@@ -311,6 +492,13 @@ class FatVolume {
     (void)change;
   }
 #endif  // MAINTAIN_FREE_CLUSTER_COUNT
+#if USE_FAT_FSINFO
+  bool fsInfoSync();
+#else  // USE_FAT_FSINFO
+  bool fsInfoSync() {
+    return true;
+  }
+#endif  // USE_FAT_FSINFO
 
 // block caches
   FatCache m_cache;
@@ -321,7 +509,10 @@ class FatVolume {
                            options | FatCache::CACHE_STATUS_MIRROR_FAT);
   }
   bool cacheSync() {
-    return m_cache.sync() && m_fatCache.sync() && syncBlocks();
+    return fsInfoSync() && m_cache.sync() && m_fatCache.sync() && syncBlocks();
+  }
+  bool cacheSyncFat(uint32_t blockNumber, uint32_t count) {
+    return m_fatCache.sync(blockNumber, count);
   }
 #else  //
   cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options) {
@@ -329,7 +520,10 @@ class FatVolume {
                           options | FatCache::CACHE_STATUS_MIRROR_FAT);
   }
   bool cacheSync() {
-    return m_cache.sync() && syncBlocks();
+    return fsInfoSync() && m_cache.sync() && syncBlocks();
+  }
+  bool cacheSyncFat(uint32_t blockNumber, uint32_t count) {
+    return m_cache.sync(blockNumber, count);
   }
 #endif  // USE_SEPARATE_FAT_CACHE
   cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options) {
@@ -338,9 +532,18 @@ class FatVolume {
   void cacheInvalidate() {
     m_cache.invalidate();
   }
+  void cacheInvalidate(uint32_t blockNumber, uint32_t count) {
+    m_cache.invalidate(blockNumber, count);
+  }
+  bool cacheContains(uint32_t blockNumber) {
+    return m_cache.contains(blockNumber);
+  }
   bool cacheSyncData() {
     return m_cache.sync();
   }
+  bool cacheSyncData(uint32_t blockNumber, uint32_t count) {
+    return m_cache.sync(blockNumber, count);
+  }
   cache_t *cacheAddress() {
     return m_cache.block();
   }
@@ -363,6 +566,24 @@ class FatVolume {
     return fatPut(cluster, 0x0FFFFFFF);
   }
   bool freeChain(uint32_t cluster);
+#if USE_FAT_FREE_MAP
+  void freeMapAlloc(uint32_t first, uint32_t last);
+  void freeMapFree(uint32_t cluster);
+  uint8_t freeMapGet(uint32_t cluster);
+  int32_t freeMapScan(uint32_t group);
+  void freeMapSet(uint32_t group, uint8_t state);
+  uint8_t freeMapState(uint32_t group) const {
+    return (m_freeMap[group >> 2] >> (2*(group & 3))) & 3;
+  }
+#else  // USE_FAT_FREE_MAP
+  void freeMapAlloc(uint32_t first, uint32_t last) {
+    (void)first;
+    (void)last;
+  }
+  void freeMapFree(uint32_t cluster) {
+    (void)cluster;
+  }
+#endif  // USE_FAT_FREE_MAP
   bool isEOC(uint32_t cluster) const {
     return cluster > m_lastCluster;
   }
@@ -79,6 +79,36 @@
  */
 #define MAINTAIN_FREE_CLUSTER_COUNT 0
 //------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_FSINFO nonzero to trust the free cluster count and next free
+ * cluster hint of a FAT32 volume's FSINFO sector when the volume is mounted,
+ * rather than scanning the FAT for freeClusterCount().  Both are written
+ * back by the next sync after clusters are allocated or freed.  Requires
+ * MAINTAIN_FREE_CLUSTER_COUNT.
+ */
+#define USE_FAT_FSINFO 0
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_EXTENT_MAP nonzero to allow a file to record its cluster chain
+ * as runs of contiguous clusters in a caller supplied array, see
+ * FatFile::setExtentMap().  Seeks within the recorded part of the file then
+ * need no FAT reads.  Adds eight bytes of RAM to each file object.
+ */
+#define USE_FAT_EXTENT_MAP 1
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_NAME_HASH nonzero to allow a directory to index its names in
+ * a caller supplied hash table, see FatFile::setNameHash().  Opening a file
+ * by long or short name then reads only the directory entries of names with
+ * a matching hash.  Requires USE_LONG_FILE_NAMES.  Adds up to eight bytes
+ * of RAM to each file object.
+ *
+ * The table is not cleared when names are created, removed or renamed.
+ * Each probe compares the name with the directory entries it points to,
+ * so a stale entry costs only a normal search.
+ */
+#define USE_FAT_NAME_HASH USE_LONG_FILE_NAMES
+//------------------------------------------------------------------------------
 /**
  * To enable SD card CRC checking set USE_SD_CRC nonzero.
  *
@@ -87,6 +117,10 @@
  *
  * Set USE_SD_CRC to 2 to used a larger table driven CRC-CCITT function.  This
  * function is faster for AVR but may be slower for ARM and other processors.
+ *
+ * Set USE_SD_CRC to 3 or 4 to use slice-by-4 or slice-by-8 table driven
+ * CRC-CCITT functions that take four or eight bytes per step.  These are
+ * for 32-bit processors and use 1536 or 3584 bytes of flash more than 2.
  */
 #define USE_SD_CRC 0
 //------------------------------------------------------------------------------
@@ -146,6 +180,32 @@
 #define USE_SEPARATE_FAT_CACHE 0
 #endif  // __arm__
 //------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_ENTRIES to the number of 512 byte blocks held by the
+ * volume's block cache.  With more than one entry the least recently used
+ * block is replaced, where file data blocks are replaced before directory
+ * blocks and directory blocks before FAT blocks.  USE_SEPARATE_FAT_CACHE is
+ * then not needed and is ignored.  Each entry costs 512 bytes of RAM, so only
+ * ARM defaults to more than one.
+ */
+#ifdef __arm__
+#define FAT_CACHE_ENTRIES 4
+#else  // __arm__
+#define FAT_CACHE_ENTRIES 1
+#endif  // __arm__
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_STATS nonzero to count block cache hits and misses, see
+ * FatVolume::cacheHits() and FatVolume::cacheMisses().
+ */
+#define FAT_CACHE_STATS 0
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_TRACE nonzero to pass block reads, with their latency, and block
+ * cache misses to the function set in fatTraceHook.
+ */
+#define FAT_TRACE 0
+//------------------------------------------------------------------------------
 /**
  * Set USE_MULTI_BLOCK_IO nonzero to use multi-block SD read/write.
  *
@@ -156,6 +216,23 @@
 #else  // RAMEND
 #define USE_MULTI_BLOCK_IO 1
 #endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_READ_AHEAD nonzero to allow a read-only file to stream small
+ * sequential reads through a caller supplied window of blocks, see
+ * FatFile::setReadAhead().  Each window is filled with one multi-block read,
+ * spanning physically contiguous clusters.  Requires USE_MULTI_BLOCK_IO.
+ */
+#define USE_FAT_READ_AHEAD USE_MULTI_BLOCK_IO
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_FREE_MAP nonzero to allow a volume to summarize its FAT in a
+ * caller supplied map, see FatVolume::setFreeMap().  Each group of FAT
+ * blocks is recorded as full, partly free or empty when first scanned, with
+ * multi-block reads if a buffer is supplied.  Cluster allocation then skips
+ * full groups and allocContiguous() claims empty groups without reading them.
+ */
+#define USE_FAT_FREE_MAP USE_MULTI_BLOCK_IO
 //-----------------------------------------------------------------------------
 /** Enable SDIO driver if available. */
 #if defined(__MK64FX512__) || defined(__MK66FX1M0__)
@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for the parts of Arduino.h used by FatLib, so that
+ * fatbench.cpp can build FatLib with a desktop compiler.
+ */
+#ifndef Arduino_h
+#define Arduino_h
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+inline uint32_t micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000UL + ts.tv_nsec/1000;
+}
+#endif  // Arduino_h
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for SdFat's BlockDriver.h.  fatbench.cpp supplies its own
+ * block device, so no SD card driver is needed.
+ */
+#ifndef BlockDriver_h
+#define BlockDriver_h
+#include "BaseBlockDriver.h"
+typedef BaseBlockDriver BlockDriver;
+#endif  // BlockDriver_h
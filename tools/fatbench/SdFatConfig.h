@@ -0,0 +1,20 @@
+/*
+ * Host configuration for fatbench.cpp.  Takes the library's SdFatConfig.h
+ * and lets the compiler command line choose the options being compared:
+ *
+ *  -DBENCH_CACHE_ENTRIES=n  FAT_CACHE_ENTRIES
+ *
+ * Cache statistics are always counted.
+ */
+#ifndef BenchConfig_h
+#define BenchConfig_h
+#include "../../SdFat/src/SdFatConfig.h"
+
+#ifdef BENCH_CACHE_ENTRIES
+#undef FAT_CACHE_ENTRIES
+#define FAT_CACHE_ENTRIES BENCH_CACHE_ENTRIES
+#endif  // BENCH_CACHE_ENTRIES
+
+#undef FAT_CACHE_STATS
+#define FAT_CACHE_STATS 1
+#endif  // BenchConfig_h
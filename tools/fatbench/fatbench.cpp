@@ -0,0 +1,310 @@
+/*
+ * fatbench - host benchmark of FatLib's block traffic.
+ *
+ * Formats a 4 GB FAT32 volume with 32 KB clusters in RAM, fills a folder
+ * with tracks, then replays the shield's access pattern and reports the
+ * blocks read from and written to the "card".  Block counts, not host
+ * time, are what matter on the target, where each block read costs about
+ * a millisecond of SPI transfer.
+ *
+ *  cache  Plays tracks in 32 byte reads, the size refill() uses, while
+ *         reading the ID3v1 tag of the playing track and opening the next
+ *         track by name, as a sketch showing track info does.  Compare
+ *         builds with 1, 2, 4 and 8 cache entries.
+ *
+ *  open   Creates 2000 empty tracks in one folder and opens each by name,
+ *         first by searching the folder, then with a name hash table set
+ *         by FatFile::setNameHash().
+ *
+ * Build and run from the repository root, for example:
+ *
+ *  for n in 1 2 4 8; do
+ *    g++ -O2 -DBENCH_CACHE_ENTRIES=$n -Itools/fatbench -ISdFat/src/FatLib \
+ *        tools/fatbench/fatbench.cpp SdFat/src/FatLib/Fat*.cpp \
+ *        SdFat/src/FatLib/FmtNumber.cpp -o fatbench && ./fatbench cache
+ *  done
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include "FatFileSystem.h"
+//------------------------------------------------------------------------------
+// Block device held in RAM.  Blocks never written read as zero, so a large
+// volume only costs the blocks the benchmark touches.
+class RamCard : public BaseBlockDriver {
+ public:
+  RamCard() : reads(0), writes(0) {}
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    reads++;
+    return get(block, dst);
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t nb) {
+    for (size_t i = 0; i < nb; i++) {
+      if (!readBlock(block + i, dst + 512*i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool syncBlocks() {
+    return true;
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    writes++;
+    put(block, src);
+    return true;
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t nb) {
+    for (size_t i = 0; i < nb; i++) {
+      writeBlock(block + i, src + 512*i);
+    }
+    return true;
+  }
+  /** Store a block without counting it. */
+  void put(uint32_t block, const void* src) {
+    std::vector<uint8_t>& b = m_blocks[block];
+    b.assign((const uint8_t*)src, (const uint8_t*)src + 512);
+  }
+  uint32_t reads;
+  uint32_t writes;
+
+ private:
+  bool get(uint32_t block, uint8_t* dst) {
+    std::map<uint32_t, std::vector<uint8_t> >::iterator it;
+    it = m_blocks.find(block);
+    if (it == m_blocks.end()) {
+      memset(dst, 0, 512);
+    } else {
+      memcpy(dst, &it->second[0], 512);
+    }
+    return true;
+  }
+  std::map<uint32_t, std::vector<uint8_t> > m_blocks;
+};
+//------------------------------------------------------------------------------
+const uint32_t VOLUME_BLOCKS = 8388608;   // 4 GB
+const uint8_t BLOCKS_PER_CLUSTER = 64;    // 32 KB, as SD cards ship
+const uint16_t RESERVED_BLOCKS = 32;
+const uint16_t TRACK_COUNT = 100;
+const uint32_t TRACK_SIZE = 262144;       // 16 s at 128 kbit/s
+const uint16_t PLAY_COUNT = 10;
+const uint16_t OPEN_COUNT = 2000;
+
+RamCard card;
+FatFileSystem fs;
+//------------------------------------------------------------------------------
+// Write a FAT32 boot block, FSINFO and the first FAT entries.
+void format() {
+  uint32_t clusters = VOLUME_BLOCKS/BLOCKS_PER_CLUSTER;
+  uint32_t fatBlocks = (4*clusters + 511)/512;
+  uint8_t block[512];
+  fat32_boot_t* pb = reinterpret_cast<fat32_boot_t*>(block);
+  memset(block, 0, 512);
+  pb->jump[0] = 0XEB;
+  pb->jump[1] = 0X58;
+  pb->jump[2] = 0X90;
+  memcpy(pb->oemId, "FATBENCH", 8);
+  pb->bytesPerSector = 512;
+  pb->sectorsPerCluster = BLOCKS_PER_CLUSTER;
+  pb->reservedSectorCount = RESERVED_BLOCKS;
+  pb->fatCount = 2;
+  pb->mediaType = 0XF8;
+  pb->totalSectors32 = VOLUME_BLOCKS;
+  pb->sectorsPerFat32 = fatBlocks;
+  pb->fat32RootCluster = 2;
+  pb->fat32FSInfo = 1;
+  pb->fat32BackBootBlock = 6;
+  pb->driveNumber = 0X80;
+  pb->bootSignature = EXTENDED_BOOT_SIG;
+  memcpy(pb->volumeLabel, "NO NAME    ", 11);
+  memcpy(pb->fileSystemType, "FAT32   ", 8);
+  pb->bootSectorSig0 = BOOTSIG0;
+  pb->bootSectorSig1 = BOOTSIG1;
+  card.put(0, block);
+  card.put(6, block);
+
+  fat32_fsinfo_t* pf = reinterpret_cast<fat32_fsinfo_t*>(block);
+  memset(block, 0, 512);
+  pf->leadSignature = FSINFO_LEAD_SIG;
+  pf->structSignature = FSINFO_STRUCT_SIG;
+  pf->freeCount = 0XFFFFFFFF;
+  pf->nextFree = 0XFFFFFFFF;
+  block[510] = BOOTSIG0;
+  block[511] = BOOTSIG1;
+  card.put(1, block);
+
+  uint32_t* fat = reinterpret_cast<uint32_t*>(block);
+  memset(block, 0, 512);
+  fat[0] = 0X0FFFFFF8;
+  fat[1] = FAT32EOC;
+  fat[2] = FAT32EOC;
+  card.put(RESERVED_BLOCKS, block);
+  card.put(RESERVED_BLOCKS + fatBlocks, block);
+}
+//------------------------------------------------------------------------------
+void trackName(char* name, size_t size, uint16_t n) {
+  snprintf(name, size, "%03u - Some Artist - Title of Track %u.mp3", n, n);
+}
+//------------------------------------------------------------------------------
+// Create the MUSIC folder with TRACK_COUNT tracks, each ending in an
+// ID3v1 tag.
+bool fill() {
+  FatFile dir;
+  uint8_t buf[512];
+  char name[64];
+  if (!dir.mkdir(fs.vwd(), "MUSIC")) {
+    return false;
+  }
+  for (uint16_t n = 0; n < TRACK_COUNT; n++) {
+    FatFile file;
+    trackName(name, sizeof(name), n);
+    if (!file.open(&dir, name, O_CREAT | O_WRITE)) {
+      return false;
+    }
+    memset(buf, 0XFF & n, sizeof(buf));
+    for (uint32_t pos = 0; pos < TRACK_SIZE; pos += sizeof(buf)) {
+      if (pos + sizeof(buf) == TRACK_SIZE) {
+        memcpy(buf + sizeof(buf) - 128, "TAG", 3);
+      }
+      if (file.write(buf, sizeof(buf)) != sizeof(buf)) {
+        return false;
+      }
+    }
+    if (!file.close()) {
+      return false;
+    }
+  }
+  return dir.close();
+}
+//------------------------------------------------------------------------------
+// Read the ID3v1 tag at the end of a file and return to the play position.
+bool readTag(FatFile* file) {
+  uint8_t tag[128];
+  uint32_t pos = file->curPosition();
+  if (!file->seekSet(file->fileSize() - 128)
+      || file->read(tag, 128) != 128 || memcmp(tag, "TAG", 3)) {
+    return false;
+  }
+  return file->seekSet(pos);
+}
+//------------------------------------------------------------------------------
+// Play PLAY_COUNT tracks.  Every 4 KB the playing track's tag is read, and
+// every 16 KB the next track is opened by name and its tag read.
+bool cache() {
+  FatFile dir;
+  char name[64];
+  uint8_t buf[32];
+  if (!dir.open(fs.vwd(), "MUSIC", O_READ)) {
+    return false;
+  }
+  for (uint16_t n = 0; n < PLAY_COUNT; n++) {
+    FatFile file;
+    trackName(name, sizeof(name), n);
+    if (!file.open(&dir, name, O_READ) || !readTag(&file)) {
+      return false;
+    }
+    for (uint32_t pos = 0; pos < TRACK_SIZE; pos += sizeof(buf)) {
+      if (file.read(buf, sizeof(buf)) != sizeof(buf)) {
+        return false;
+      }
+      if (pos % 4096 == 0 && !readTag(&file)) {
+        return false;
+      }
+      if (pos % 16384 == 0) {
+        FatFile next;
+        trackName(name, sizeof(name), (n + 1) % TRACK_COUNT);
+        if (!next.open(&dir, name, O_READ) || !readTag(&next)) {
+          return false;
+        }
+        next.close();
+      }
+    }
+    file.close();
+  }
+  printf("entries %u: %lu hits, %lu misses, %lu block reads, %lu writes\n",
+         FAT_CACHE_ENTRIES, (unsigned long)fs.cacheHits(),
+         (unsigned long)fs.cacheMisses(), (unsigned long)card.reads,
+         (unsigned long)card.writes);
+  return true;
+}
+//------------------------------------------------------------------------------
+// Open every track of a folder by name, stepping through the names in an
+// order unrelated to the folder's.
+bool openAll(FatFile* dir, const char* label) {
+  char name[64];
+  fs.cacheClear();
+  card.reads = 0;
+  uint32_t m = micros();
+  for (uint32_t i = 0; i < OPEN_COUNT; i++) {
+    FatFile file;
+    trackName(name, sizeof(name), i*7919 % OPEN_COUNT);
+    if (!file.open(dir, name, O_READ)) {
+      return false;
+    }
+    file.close();
+  }
+  m = micros() - m;
+  printf("%s: %.0f opens/s, %.1f block reads per open\n", label,
+         1e6*OPEN_COUNT/(m ? m : 1), (double)card.reads/OPEN_COUNT);
+  return true;
+}
+//------------------------------------------------------------------------------
+bool opens() {
+  FatFile dir;
+  char name[64];
+  if (!dir.mkdir(fs.vwd(), "LIBRARY")) {
+    return false;
+  }
+  for (uint16_t n = 0; n < OPEN_COUNT; n++) {
+    FatFile file;
+    trackName(name, sizeof(name), n);
+    if (!file.open(&dir, name, O_CREAT | O_WRITE) || !file.close()) {
+      return false;
+    }
+  }
+  if (!openAll(&dir, "search")) {
+    return false;
+  }
+#if USE_FAT_NAME_HASH
+  static FatNameHash table[OPEN_COUNT];
+  card.reads = 0;
+  if (!dir.setNameHash(table, OPEN_COUNT)) {
+    return false;
+  }
+  printf("table: %u names in %lu block reads\n", dir.nameHashCount(),
+         (unsigned long)card.reads);
+  if (!openAll(&dir, "table")) {
+    return false;
+  }
+#endif  // USE_FAT_NAME_HASH
+  return dir.close();
+}
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+  const char* bench = argc > 1 ? argv[1] : "";
+  format();
+  if (!fs.begin(&card) || !fill()) {
+    printf("setup failed\n");
+    return 1;
+  }
+  fs.cacheClear();
+  fs.cacheResetStats();
+  card.reads = 0;
+  card.writes = 0;
+  bool ok;
+  if (!strcmp(bench, "cache")) {
+    ok = cache();
+  } else if (!strcmp(bench, "open")) {
+    ok = opens();
+  } else {
+    printf("usage: fatbench cache|open\n");
+    return 1;
+  }
+  if (!ok) {
+    printf("%s failed\n", bench);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+
+#!/usr/bin/perl
+
+#** @file mp3trace.pl
+# @verbatim
+#####################################################################
+# This program is not guaranteed to work at all, and by using this  #
+# program you release the author of any and all liability.          #
+#                                                                   #
+# You may use this code as long as you are in compliance with the   #
+# license (see the LICENSE file) and this notice, disclaimer and    #
+# comment box remain intact and unchanged.                          #
+#                                                                   #
+# Purpose: to render the binary trace sent by                       #
+# SFEMP3Shield::dumpTrace() as a timeline, with a lane for each     #
+# kind of event, followed by a summary of counts and SdCard read    #
+# latency.                                                          #
+#                                                                   #
+# example usage: mp3trace.pl .\trace.bin                            #
+#                                                                   #
+#####################################################################
+# @endverbatim
+#*
+use strict;
+use warnings;
+
+#** @var $inF
+# Input Arguement of Filename of the captured trace.
+#*
+my $inF = $ARGV[0] or die "Need input file.\n";
+
+open(my $infile, '<:raw', $inF) or die "Could not open '$inF' $!\n";
+my $data = do { local $/; <$infile> };
+close($infile);
+
+# Skip anything captured ahead of the trace, such as the sketch's own prints.
+my $start = index($data, "MP3T");
+die "No trace found in '$inF'.\n" if $start < 0;
+my ($size, $count) = unpack('C v', substr($data, $start + 4, 3));
+die "Empty trace.\n" if !$size || !$count;
+
+#** @var @lanes
+# Column of each type of record, as TRACE_SCI_READ thru TRACE_STATE.
+#*
+my @lanes = ('', 'SCI', 'SCI', 'SDI', 'DREQ', 'SD', 'CACHE', 'STATE');
+my @states = ('uninitialized', 'initialized', 'deactivated', 'loading',
+              'ready', 'playback', 'playMIDIbeep', 'paused_playback',
+              'testing_memory', 'testing_sinewave', 'recording',
+              'realtime_midi');
+my %counts;
+my @latency;
+my $first;
+
+printf("%10s %10s  %-24s %-12s %-8s %-28s %-16s %s\n",
+       'ms', 'delta', 'SCI', 'SDI', 'DREQ', 'SD', 'CACHE', 'STATE');
+
+my $last;
+for (my $i = 0; $i < $count; $i++) {
+	my $record = substr($data, $start + 7 + $i * $size, $size);
+	last if length($record) < $size; # capture cut short.
+	my ($time, $type, $a, $b, $c) = unpack('V C C v V', $record);
+	$first = $time if !defined($first);
+	my $ms = (($time - $first) & 0xFFFFFFFF) / 1000;
+	my $delta = defined($last) ? (($time - $last) & 0xFFFFFFFF) / 1000 : 0;
+	$last = $time;
+
+	my $text;
+	if    ($type == 1) { $text = sprintf("rd  %02X = %04X", $a, $b); }
+	elsif ($type == 2) { $text = sprintf("wr  %02X = %04X", $a, $b); }
+	elsif ($type == 3) { $text = "$b bytes"; }
+	elsif ($type == 4) { $text = $a ? 'high' : 'low'; }
+	elsif ($type == 5) { $text = sprintf("%u+%u %uus", $c, $a, $b); push(@latency, $b); }
+	elsif ($type == 6) { $text = sprintf("%u opt %u", $c, $a); }
+	elsif ($type == 7) { $text = ($states[$b] // $b) . ' -> ' . ($states[$a] // $a); }
+	else { $text = "type $type"; }
+
+	my $lane = $lanes[$type] // '?';
+	$counts{$lane}++;
+	my @columns = ('', '', '', '', '', '');
+	my %column = (SCI => 0, SDI => 1, DREQ => 2, SD => 3, CACHE => 4, STATE => 5);
+	$columns[$column{$lane} // 5] = $text;
+	printf("%10.3f %10.3f  %-24s %-12s %-8s %-28s %-16s %s\n", $ms, $delta, @columns);
+}
+
+print "\n";
+foreach my $lane (sort keys %counts) {
+	printf("%-6s %u events\n", $lane, $counts{$lane});
+}
+if (@latency) {
+	my @sorted = sort { $a <=> $b } @latency;
+	my $sum = 0;
+	$sum += $_ foreach @sorted;
+	printf("SD read latency: min %uus, median %uus, mean %.0fus, max %uus\n",
+	       $sorted[0], $sorted[$#sorted / 2], $sum / @sorted, $sorted[-1]);
+}
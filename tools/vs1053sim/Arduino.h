@@ -0,0 +1,175 @@
+/*
+ * Arduino core for vs1053sim, run on the simulated clock of sim.cpp.
+ *
+ * Only what SFEMP3Shield and SdFat use.  Pins, interrupts and time are
+ * those of the simulated shield, and Serial prints to stdout.
+ */
+#ifndef Arduino_h
+#define Arduino_h
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <avr/pgmspace.h>
+
+#define F_CPU 16000000UL
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define SS 10
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t irq, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t irq);
+void interrupts();
+void noInterrupts();
+void yield();
+#define cli() noInterrupts()
+#define sei() interrupts()
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : (p) == 3 ? 1 : -1)
+extern volatile uint8_t SREG;
+
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+
+class __FlashStringHelper;
+
+class String {
+ public:
+  String(const char* s = "") : m_s(s) {}
+  const char* c_str() const {
+    return m_s;
+  }
+
+ private:
+  const char* m_s;
+};
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buf, size_t n) {
+    size_t r = 0;
+    while (n--) {
+      r += write(*buf++);
+    }
+    return r;
+  }
+  size_t write(const char* s) {
+    return write((const uint8_t*)s, strlen(s));
+  }
+  int availableForWrite() {
+    return 0;
+  }
+  void flush() {}
+  size_t print(const char* s) {
+    return write(s);
+  }
+  size_t print(const __FlashStringHelper* s) {
+    return write(reinterpret_cast<const char*>(s));
+  }
+  size_t print(char c) {
+    return write((uint8_t)c);
+  }
+  size_t print(unsigned char n, int base = DEC) {
+    return printNumber(n, base);
+  }
+  size_t print(int n, int base = DEC) {
+    return print((long)n, base);
+  }
+  size_t print(unsigned n, int base = DEC) {
+    return printNumber(n, base);
+  }
+  size_t print(long n, int base = DEC) {
+    if (n < 0 && base == DEC) {
+      return write('-') + printNumber(-(unsigned long)n, base);
+    }
+    return printNumber(n, base);
+  }
+  size_t print(unsigned long n, int base = DEC) {
+    return printNumber(n, base);
+  }
+  size_t print(double d, int digits = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, d);
+    return write(buf);
+  }
+  template<typename T> size_t println(T v) {
+    return print(v) + println();
+  }
+  template<typename T> size_t println(T v, int base) {
+    return print(v, base) + println();
+  }
+  size_t println() {
+    return write("\r\n");
+  }
+
+ private:
+  size_t printNumber(unsigned long n, int base) {
+    char buf[33];
+    char* p = buf + sizeof(buf) - 1;
+    *p = 0;
+    do {
+      uint8_t d = n % base;
+      *--p = d < 10 ? '0' + d : 'A' + d - 10;
+      n /= base;
+    } while (n);
+    return write(p);
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t b) {
+    return putchar(b) == EOF ? 0 : 1;
+  }
+  using Print::write;
+  int available() {
+    return 0;
+  }
+  int read() {
+    return -1;
+  }
+  int peek() {
+    return -1;
+  }
+  operator bool() {
+    return true;
+  }
+};
+extern HardwareSerial Serial;
+#endif  // Arduino_h
@@ -0,0 +1,39 @@
+/*
+ * SPI library for vs1053sim.  Each byte goes to the simulated device whose
+ * chip select is low, see sim.cpp.
+ */
+#ifndef _SPI_H_INCLUDED
+#define _SPI_H_INCLUDED
+#include <Arduino.h>
+
+#define SPI_CLOCK_DIV4 0x00
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_CLOCK_DIV64 0x02
+#define SPI_CLOCK_DIV128 0x03
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV8 0x05
+#define SPI_CLOCK_DIV32 0x06
+#define SPI_MODE0 0x00
+#define MSBFIRST 1
+
+class SPISettings {
+ public:
+  SPISettings() : clock(4000000) {}
+  SPISettings(uint32_t clock, uint8_t, uint8_t) : clock(clock) {}
+  uint32_t clock;
+};
+
+class SPIClass {
+ public:
+  void begin() {}
+  void end() {}
+  void beginTransaction(SPISettings settings);
+  void endTransaction() {}
+  void setClockDivider(uint8_t div);
+  void setBitOrder(uint8_t) {}
+  void setDataMode(uint8_t) {}
+  void usingInterrupt(uint8_t) {}
+  uint8_t transfer(uint8_t data);
+};
+extern SPIClass SPI;
+#endif  // _SPI_H_INCLUDED
@@ -0,0 +1,17 @@
+/* Program memory is ordinary memory on the host. */
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+#include <stdint.h>
+#include <string.h>
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(a) (*(const uint8_t*)(a))
+#define pgm_read_word(a) (*(const uint16_t*)(a))
+#define pgm_read_dword(a) (*(const uint32_t*)(a))
+#define pgm_read_byte_near(a) pgm_read_byte(a)
+#define pgm_read_word_near(a) pgm_read_word(a)
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+#endif  // __PGMSPACE_H_
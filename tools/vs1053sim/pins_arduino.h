@@ -0,0 +1 @@
+/* The simulated board is an Uno, with the shield's default pins. */
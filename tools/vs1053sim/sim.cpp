@@ -0,0 +1,680 @@
+/*
+ * vs1053sim - the simulated shield, see sim.h.
+ */
+#include "sim.h"
+#include <Arduino.h>
+#include <SPI.h>
+#include "SFEMP3Shield.h"
+
+SimCard simCard;
+SimVs simVs;
+HardwareSerial Serial;
+SPIClass SPI;
+volatile uint8_t SREG;
+
+//==============================================================================
+// Clock, pins and interrupt.
+
+static uint64_t now_ns = 0;
+static uint8_t pins[32];
+static struct PinsInit {
+  PinsInit() {
+    memset(pins, HIGH, sizeof(pins));  // pulled up until driven
+  }
+} pinsInit;
+static void (*isr)(void) = 0;
+static bool irqEnabled = true;
+static bool inIsr = false;
+static bool irqPending = false;
+static bool lastDreq = false;
+static uint64_t spiByteNs = 1500;
+
+uint64_t simNow() {
+  return now_ns;
+}
+
+// Let the devices catch up, and take the DREQ interrupt on its rising edge.
+static void service() {
+  simVs.update(now_ns);
+  bool d = simVs.dreq(now_ns);
+  if (d && !lastDreq && isr) {
+    irqPending = true;
+  }
+  lastDreq = d;
+  if (irqPending && irqEnabled && !inIsr && isr) {
+    // as an AVR, with interrupts disabled on entry and enabled by reti.
+    irqPending = false;
+    inIsr = true;
+    irqEnabled = false;
+    isr();
+    inIsr = false;
+    irqEnabled = true;
+  }
+}
+
+void simAdvance(uint64_t ns) {
+  while (ns) {
+    uint64_t step = ns < 20000 ? ns : 20000;
+    now_ns += step;
+    ns -= step;
+    service();
+  }
+}
+
+unsigned long millis() {
+  simAdvance(1000);
+  return now_ns / 1000000;
+}
+
+unsigned long micros() {
+  simAdvance(1000);
+  return now_ns / 1000;
+}
+
+void delay(unsigned long ms) {
+  simAdvance((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  simAdvance((uint64_t)us * 1000);
+}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  simAdvance(500);
+  if (pin >= sizeof(pins) || pins[pin] == value) {
+    return;
+  }
+  pins[pin] = value;
+  if (pin == MP3_RESET) {
+    simVs.reset(!value);
+  } else if (pin == MP3_XCS && value) {
+    simVs.sciEnd();
+  } else if (pin == SD_SEL && value) {
+    simCard.unselect();
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  simAdvance(500);
+  if (pin == MP3_DREQ) {
+    return simVs.dreq(now_ns);
+  }
+  return pin < sizeof(pins) ? pins[pin] : LOW;
+}
+
+void attachInterrupt(uint8_t, void (*f)(void), int) {
+  isr = f;
+  irqPending = false;
+}
+
+void detachInterrupt(uint8_t) {
+  isr = 0;
+  irqPending = false;
+}
+
+void interrupts() {
+  irqEnabled = true;
+}
+
+void noInterrupts() {
+  irqEnabled = false;
+}
+
+void yield() {}
+
+//==============================================================================
+// SPI, to whichever device is selected.  A byte takes its 8 clocks plus half
+// a microsecond of the AVR's loop.
+
+void SPIClass::beginTransaction(SPISettings settings) {
+  uint32_t hz = settings.clock < 8000000 ? settings.clock : 8000000;
+  spiByteNs = 500 + 8000000000ULL / hz;
+}
+
+void SPIClass::setClockDivider(uint8_t div) {
+  static const uint8_t shift[] = {2, 4, 6, 7, 1, 3, 5};
+  spiByteNs = 500 + (8000ULL << shift[div & 7]) / 16;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  uint8_t r = 0XFF;
+  simAdvance(spiByteNs);
+  if (!pins[SD_SEL] + !pins[MP3_XCS] + !pins[MP3_XDCS] > 1) {
+    printf("SPI: more than one chip select is low\n");
+    exit(1);
+  }
+  if (!pins[SD_SEL]) {
+    r = simCard.transfer(data);
+  } else if (!pins[MP3_XCS]) {
+    r = simVs.sciTransfer(data);
+  } else if (!pins[MP3_XDCS]) {
+    simVs.sdiTransfer(data);
+  }
+  return r;
+}
+
+//==============================================================================
+// SdCard.
+
+static const uint32_t CARD_BLOCKS = 8388608;  // 4 GB
+static const uint64_t READ_ACCESS_NS = 300000;
+static const uint64_t READ_NEXT_NS = 20000;
+static const uint64_t WRITE_NS = 700000;
+static const uint64_t WRITE_ERASED_NS = 150000;
+static const uint64_t STOP_TRAN_NS = 300000;
+
+static uint16_t crcCcitt(const uint8_t* p, uint16_t n) {
+  uint16_t crc = 0;
+  while (n--) {
+    crc ^= (uint16_t)*p++ << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = crc & 0X8000 ? (crc << 1) ^ 0X1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+SimCard::SimCard() : stallEvery(256), stallNs(100000000), blocksWritten(0),
+  maxBusyNs(0), m_state(IDLE), m_cmdLen(0), m_ready(false), m_appCmd(false),
+  m_busyUntil(0), m_multiple(false), m_block(0), m_size(0), m_pos(0),
+  m_tokenAt(0), m_crc(0), m_eraseCount(0), m_preErased(false),
+  m_dataLen(0) {}
+
+void SimCard::put(uint32_t block, const uint8_t* src) {
+  m_blocks[block].assign(src, src + 512);
+}
+
+void SimCard::get(uint32_t block, uint8_t* dst) {
+  std::map<uint32_t, std::vector<uint8_t> >::iterator it;
+  it = m_blocks.find(block);
+  if (it == m_blocks.end()) {
+    memset(dst, 0, 512);
+  } else {
+    memcpy(dst, &it->second[0], 512);
+  }
+}
+
+void SimCard::unselect() {
+  // a command cut short is dropped.
+  if (m_state == COMMAND) {
+    m_state = IDLE;
+  }
+}
+
+void SimCard::startData(uint32_t block, uint16_t size, uint64_t delayNs) {
+  m_block = block;
+  m_size = size;
+  m_pos = 0;
+  m_tokenAt = simNow() + delayNs;
+  if (size == 512) {
+    uint8_t buf[512];
+    get(block, buf);
+    m_crc = crcCcitt(buf, 512);
+  } else {
+    m_crc = crcCcitt(m_reg, size);
+  }
+  m_state = READING;
+}
+
+void SimCard::written() {
+  uint64_t busy = m_multiple && m_preErased ? WRITE_ERASED_NS : WRITE_NS;
+  put(m_block++, m_data);
+  if (stallEvery && !(++blocksWritten % stallEvery)) {
+    busy += stallNs;
+  }
+  if (busy > maxBusyNs) {
+    maxBusyNs = busy;
+  }
+  m_out.push_back(0XE5);  // data accepted
+  m_busyUntil = simNow() + busy;
+  m_state = m_multiple ? WRITE_TOKEN : IDLE;
+}
+
+void SimCard::command() {
+  uint8_t cmd = m_cmd[0] & 0X3F;
+  uint32_t arg = (uint32_t)m_cmd[1] << 24 | (uint32_t)m_cmd[2] << 16
+                 | (uint32_t)m_cmd[3] << 8 | m_cmd[4];
+  uint8_t r1 = m_ready ? 0 : 1;
+  bool app = m_appCmd;
+
+  m_appCmd = false;
+  m_state = IDLE;
+  m_out.clear();
+  m_out.push_back(0XFF);  // NCR
+  switch (cmd) {
+    case 0:
+      m_ready = false;
+      m_out.push_back(1);
+      break;
+    case 8:
+      m_out.push_back(r1);
+      m_out.push_back(0);
+      m_out.push_back(0);
+      m_out.push_back(1);
+      m_out.push_back(0XAA);
+      break;
+    case 9:
+      // CSD version 2.0, of CARD_BLOCKS.
+      memset(m_reg, 0, sizeof(m_reg));
+      m_reg[0] = 0X40;
+      m_reg[7] = ((CARD_BLOCKS / 1024 - 1) >> 16) & 0X3F;
+      m_reg[8] = ((CARD_BLOCKS / 1024 - 1) >> 8) & 0XFF;
+      m_reg[9] = (CARD_BLOCKS / 1024 - 1) & 0XFF;
+      m_reg[10] = 0X7F;
+      m_reg[11] = 0X80;
+      m_out.push_back(0);
+      startData(0, 16, 0);
+      break;
+    case 10:
+      memset(m_reg, 0, sizeof(m_reg));
+      memcpy(m_reg + 3, "SIMSD", 5);
+      m_out.push_back(0);
+      startData(0, 16, 0);
+      break;
+    case 12:
+      m_out.push_back(0XFF);  // stuff byte
+      m_out.push_back(0);
+      break;
+    case 13:
+      m_out.push_back(r1);
+      m_out.push_back(0);
+      break;
+    case 17:
+    case 18:
+      m_out.push_back(0);
+      m_multiple = cmd == 18;
+      startData(arg, 512, READ_ACCESS_NS);
+      break;
+    case 23:
+      if (app) {
+        m_eraseCount = arg;
+      }
+      m_out.push_back(0);
+      break;
+    case 24:
+    case 25:
+      m_out.push_back(0);
+      m_multiple = cmd == 25;
+      m_preErased = m_multiple && m_eraseCount;
+      m_eraseCount = 0;
+      m_block = arg;
+      m_state = WRITE_TOKEN;
+      break;
+    case 41:
+      m_ready = app;
+      m_out.push_back(m_ready ? 0 : 1);
+      break;
+    case 55:
+      m_appCmd = true;
+      m_out.push_back(r1);
+      break;
+    case 58:
+      m_out.push_back(r1);
+      m_out.push_back(0XC0);  // powered up, SDHC
+      m_out.push_back(0XFF);
+      m_out.push_back(0X80);
+      m_out.push_back(0);
+      break;
+    case 59:
+      m_out.push_back(r1);
+      break;
+    default:
+      m_out.push_back(r1 | 4);  // illegal command
+      break;
+  }
+}
+
+uint8_t SimCard::transfer(uint8_t in) {
+  uint64_t now = simNow();
+  uint8_t out;
+
+  if (m_state == READING && m_out.empty() && now >= m_tokenAt) {
+    // token, data and crc of the block or register.
+    if (m_pos == 0) {
+      out = 0XFE;
+    } else if (m_pos <= m_size) {
+      if (m_size == 512) {
+        uint8_t buf[512];
+        get(m_block, buf);
+        out = buf[m_pos - 1];
+      } else {
+        out = m_reg[m_pos - 1];
+      }
+    } else {
+      out = m_pos == m_size + 1 ? m_crc >> 8 : m_crc;
+    }
+    if (++m_pos == m_size + 3) {
+      if (m_multiple && m_size == 512) {
+        startData(m_block + 1, 512, READ_NEXT_NS);
+      } else {
+        m_state = IDLE;
+      }
+    }
+  } else if (!m_out.empty()) {
+    out = m_out.front();
+    m_out.pop_front();
+  } else {
+    out = now < m_busyUntil ? 0 : 0XFF;
+  }
+
+  switch (m_state) {
+    case COMMAND:
+      m_cmd[m_cmdLen++] = in;
+      if (m_cmdLen == 6) {
+        command();
+      }
+      break;
+    case WRITE_TOKEN:
+      if (now < m_busyUntil) {
+        break;
+      }
+      if (in == 0XFE || in == 0XFC) {
+        m_dataLen = 0;
+        m_state = WRITE_DATA;
+      } else if (in == 0XFD && m_multiple) {
+        m_busyUntil = now + STOP_TRAN_NS;
+        m_state = IDLE;
+      }
+      break;
+    case WRITE_DATA:
+      m_data[m_dataLen++] = in;
+      if (m_dataLen == sizeof(m_data)) {
+        written();
+      }
+      break;
+    default:
+      // IDLE, or a read, which a command ends.
+      if ((in & 0XC0) == 0X40 && now >= m_busyUntil) {
+        m_cmd[0] = in;
+        m_cmdLen = 1;
+        m_state = COMMAND;
+      }
+      break;
+  }
+  return out;
+}
+
+//==============================================================================
+// VS1053.
+
+static const uint16_t FIFO_SIZE = 2048;
+static const uint16_t REC_WORDS = 1024;
+static const uint64_t RESET_NS = 1800000;
+static const uint16_t BYTE_RATE = 16000;
+
+uint8_t mp3Frame(uint32_t index, uint16_t k) {
+  static const uint8_t header[4] = {0XFF, 0XFB, 0X90, 0X64};
+  if (k < 4) {
+    return header[k];
+  }
+  if (k < 8) {
+    return (index >> (7 * (k - 4))) & 0X7F;
+  }
+  // never 0XFF, so never a false sync, nor 0, the endFillByte.
+  return 1 + (index * 31 + k * 13) % 250;
+}
+
+uint8_t adpcmByte(uint32_t n) {
+  uint32_t block = n / 256;
+  switch (n % 256) {
+    case 0:
+      return block * 37;  // predictor, low byte
+    case 1:
+      return (block * 37) >> 8;
+    case 2:
+      return block % 89;  // step index
+    case 3:
+      return 0;
+    default:
+      return block * 131 + (n % 256) * 7;
+  }
+}
+
+SimVs::SimVs() : sdiOverruns(0), recording(false), recMade(0), recRead(0),
+  recLost(0), m_inReset(true) {
+  reset(true);
+}
+
+void SimVs::softReset(uint16_t mode) {
+  m_fifo.clear();
+  m_frame.clear();
+  m_ready = false;
+  m_playing = false;
+  m_cancel = false;
+  m_decodeNs = 0;
+  m_regs[SCI_MODE] = mode & ~(SM_RESET | SM_CANCEL);
+  m_regs[SCI_DECODE_TIME] = 0;
+  m_regs[SCI_HDAT0] = 0;
+  m_regs[SCI_HDAT1] = 0;
+  wram[para_byteRate] = 0;
+  wram[para_endFillByte] = 0;
+  wram[para_positionMsec_0] = 0XFFFF;  // not known for MP3
+  wram[para_positionMsec_1] = 0XFFFF;
+  m_busyUntil = simNow() + RESET_NS;
+  recording = false;
+  m_recWords.clear();
+  if (mode & SM_ADPCM) {
+    uint16_t rate = m_regs[SCI_AICTRL0] ? m_regs[SCI_AICTRL0] : 8000;
+    recording = true;
+    recMade = 0;
+    recRead = 0;
+    recLost = 0;
+    m_recStart = m_busyUntil;
+    m_recRate = rate * 256.0 / 505 / 2 / 1e9;  // words per ns
+  }
+}
+
+void SimVs::reset(bool hold) {
+  m_inReset = hold;
+  if (hold) {
+    memset(m_regs, 0, sizeof(m_regs));
+    wram.clear();
+    softReset(SM_LINE1 | SM_SDINEW);
+  } else {
+    m_busyUntil = simNow() + RESET_NS;
+  }
+  m_sciLen = 0;
+}
+
+bool SimVs::dreq(uint64_t now) {
+  return !m_inReset && now >= m_busyUntil
+         && (recording || m_fifo.size() <= FIFO_SIZE - 32U);
+}
+
+void SimVs::cancel() {
+  m_fifo.clear();
+  m_frame.clear();
+  m_ready = false;
+  m_playing = false;
+  m_cancel = false;
+  m_regs[SCI_MODE] &= ~SM_CANCEL;
+}
+
+void SimVs::startFrame(uint64_t start) {
+  uint32_t index = 0;
+  bool broken = false;
+  for (uint8_t k = 0; k < 4; k++) {
+    index |= (uint32_t)(m_frame[4 + k] & 0X7F) << (7 * k);
+  }
+  for (uint16_t k = 0; k < MP3_FRAME_BYTES; k++) {
+    if (m_frame[k] != mp3Frame(index, k)) {
+      broken = true;
+      break;
+    }
+  }
+  SimFrame f = {start, index, broken};
+  frames.push_back(f);
+  m_frame.clear();
+  m_ready = false;
+  m_playing = true;
+  m_playStart = start;
+  m_decodeNs += MP3_FRAME_NS;
+  m_regs[SCI_DECODE_TIME] = m_decodeNs / 1000000000;
+  wram[para_byteRate] = BYTE_RATE;
+}
+
+// Take the bytes of the next frame from the stream buffer, no faster than the
+// playing frame plays, skipping all else up to a frame header.
+void SimVs::assemble(uint64_t now) {
+  uint32_t allowed = MP3_FRAME_BYTES;
+  if (m_playing && now < m_playStart + MP3_FRAME_NS) {
+    allowed = MP3_FRAME_BYTES * (now - m_playStart) / MP3_FRAME_NS;
+  }
+  while (!m_fifo.empty() && m_frame.size() < MP3_FRAME_BYTES) {
+    uint8_t b = m_fifo.front();
+    if (m_frame.size() == 0) {
+      if (b == 0XFF) {
+        m_frame.push_back(b);
+      }
+    } else if (m_frame.size() == 1 && b != 0XFB) {
+      m_frame.clear();
+      continue;  // the byte may itself start a header.
+    } else if (m_frame.size() < allowed) {
+      m_frame.push_back(b);
+    } else {
+      break;
+    }
+    m_fifo.pop_front();
+  }
+  if (!m_ready && m_frame.size() == MP3_FRAME_BYTES) {
+    m_ready = true;
+    m_readyAt = now;
+  }
+}
+
+void SimVs::update(uint64_t now) {
+  if (m_inReset) {
+    return;
+  }
+  if (recording && now > m_recStart) {
+    uint32_t made = (now - m_recStart) * m_recRate;
+    for (; recMade < made; recMade++) {
+      if (m_recWords.size() < REC_WORDS) {
+        m_recWords.push_back(recMade);
+      }
+    }
+    return;
+  }
+  while (1) {
+    uint64_t end = m_playStart + MP3_FRAME_NS;
+    if (m_cancel && (!m_playing || end <= now)) {
+      cancel();
+    }
+    assemble(now);
+    if (m_ready && (!m_playing || end <= now)) {
+      // straight on from the playing frame, unless the data came late.
+      startFrame(!m_playing ? m_readyAt :
+                 m_readyAt < end + 50000 ? end : m_readyAt);
+    } else {
+      if (m_playing && end <= now && !m_ready) {
+        m_playing = false;  // underrun
+      }
+      return;
+    }
+  }
+}
+
+void SimVs::write(uint8_t reg, uint16_t value) {
+  switch (reg) {
+    case SCI_MODE:
+      if (value & SM_RESET) {
+        softReset(value);
+        return;
+      }
+      m_cancel = value & SM_CANCEL;
+      break;
+    case SCI_DECODE_TIME:
+      m_decodeNs = value * 1000000000ULL;
+      break;
+    case SCI_WRAM:
+      wram[m_regs[SCI_WRAMADDR]++] = value;
+      return;
+    case SCI_VOL: {
+      SimVolume v = {simNow(), (value >> 8) >= 0XFE && (value & 0XFF) >= 0XFE};
+      volumes.push_back(v);
+      break;
+    }
+    case SCI_HDAT0:
+    case SCI_HDAT1:
+      return;
+  }
+  m_regs[reg] = value;
+}
+
+uint16_t SimVs::read(uint8_t reg) {
+  switch (reg) {
+    case SCI_STATUS:
+      return 0X40;  // VS1053
+    case SCI_WRAM: {
+      std::map<uint16_t, uint16_t>::iterator it;
+      it = wram.find(m_regs[SCI_WRAMADDR]++);
+      return it == wram.end() ? 0 : it->second;
+    }
+    case SCI_HDAT0:
+      if (recording && !m_recWords.empty()) {
+        uint32_t n = m_recWords.front();
+        m_recWords.pop_front();
+        // those lost while the buffer was full, ahead of this one.
+        recLost = n - recRead++;
+        return adpcmByte(2 * n) << 8 | adpcmByte(2 * n + 1);
+      }
+      return 0;
+    case SCI_HDAT1:
+      return recording ? m_recWords.size() : 0;
+  }
+  return m_regs[reg];
+}
+
+uint8_t SimVs::sciTransfer(uint8_t in) {
+  uint8_t out = 0;
+  if (m_inReset) {
+    return 0;
+  }
+  switch (m_sciLen) {
+    case 0:
+      m_sciOp = in;
+      break;
+    case 1:
+      m_sciReg = in & 0X0F;
+      if (m_sciOp == 3) {
+        m_sciOut = read(m_sciReg);
+      }
+      break;
+    case 4:
+      // as the datasheet, a further word is of the same register.
+      if (m_sciOp == 3) {
+        m_sciOut = read(m_sciReg);
+      }
+      m_sciLen = 2;
+      // fall through
+    case 2:
+      m_sciHigh = in;
+      out = m_sciOut >> 8;
+      break;
+    case 3:
+      out = m_sciOut;
+      if (m_sciOp == 2) {
+        write(m_sciReg, m_sciHigh << 8 | in);
+      }
+      break;
+  }
+  m_sciLen++;
+  return out;
+}
+
+void SimVs::sciEnd() {
+  m_sciLen = 0;
+}
+
+void SimVs::sdiTransfer(uint8_t in) {
+  if (m_inReset || recording) {
+    return;
+  }
+  if (m_fifo.size() >= FIFO_SIZE) {
+    sdiOverruns++;
+    return;
+  }
+  m_fifo.push_back(in);
+}
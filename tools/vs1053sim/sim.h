@@ -0,0 +1,165 @@
+/*
+ * vs1053sim - the simulated shield: clock, SdCard and VS1053.
+ *
+ * The Arduino core of Arduino.h and SPI.h runs on a simulated clock, which
+ * advances with each SPI byte, pin access and delay.  As it advances, the
+ * VS1053 decodes and records, and its DREQ interrupt is taken when enabled.
+ */
+#ifndef sim_h
+#define sim_h
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+/** Simulated time in nanoseconds. */
+uint64_t simNow();
+/** Advance the simulated clock, servicing the devices and the interrupt. */
+void simAdvance(uint64_t ns);
+
+//------------------------------------------------------------------------------
+/**
+ * SdCard in SPI mode, an SDHC card of 4 GB held in RAM.
+ *
+ * Answers the commands SdSpiCard sends.  Reads take an access time before
+ * their data token.  Each block written leaves the card busy for the write
+ * time, longer unless pre-erased by ACMD23, and every stallEvery blocks a
+ * stall of stallNs, as cards do when they erase or wear level.
+ */
+class SimCard {
+ public:
+  SimCard();
+  uint8_t transfer(uint8_t in);
+  void unselect();
+  /** Host access to the storage, without the SPI. */
+  void put(uint32_t block, const uint8_t* src);
+  void get(uint32_t block, uint8_t* dst);
+
+  uint32_t stallEvery;
+  uint64_t stallNs;
+  uint32_t blocksWritten;
+  uint64_t maxBusyNs;
+
+ private:
+  enum {IDLE, COMMAND, READING, WRITE_TOKEN, WRITE_DATA};
+  void command();
+  void startData(uint32_t block, uint16_t size, uint64_t delayNs);
+  void written();
+
+  std::map<uint32_t, std::vector<uint8_t> > m_blocks;
+  std::deque<uint8_t> m_out;
+  uint8_t m_state;
+  uint8_t m_cmd[6];
+  uint8_t m_cmdLen;
+  bool m_ready;
+  bool m_appCmd;
+  uint64_t m_busyUntil;
+  // reads
+  bool m_multiple;
+  uint32_t m_block;
+  uint8_t m_reg[16];
+  uint16_t m_size;
+  uint16_t m_pos;
+  uint64_t m_tokenAt;
+  uint16_t m_crc;
+  // writes
+  uint32_t m_eraseCount;
+  bool m_preErased;
+  uint8_t m_data[514];
+  uint16_t m_dataLen;
+};
+
+//------------------------------------------------------------------------------
+/** A frame decoded by the simulated VS1053. */
+struct SimFrame {
+  uint64_t start;
+  uint32_t index;
+  bool broken;
+};
+
+/** A write of SCI_VOL. */
+struct SimVolume {
+  uint64_t time;
+  bool muted;
+};
+
+/**
+ * VS1053 with its SCI registers, WRAM, 2048 byte stream buffer and a model
+ * of its MP3 decoder and IMA ADPCM encoder.
+ *
+ * The decoder plays the frames of the stream written by mp3Frame(), taking
+ * the bytes of the next frame from the stream buffer at the rate they play,
+ * and skipping anything other than a frame header as fast as it arrives.  A
+ * frame whose bytes are not all those of one frame of the file is logged as
+ * broken.  SM_CANCEL takes effect at the end of the playing frame, or at
+ * once when idle, discarding the stream buffer.
+ *
+ * The encoder, once started by a reset with SM_ADPCM, makes the words of
+ * adpcmByte() at the rate of AICTRL0 into a buffer of 1024 words, dropping
+ * those made while it is full.  The words dropped ahead of the last word read
+ * are counted as lost, those after it were never wanted.
+ */
+class SimVs {
+ public:
+  SimVs();
+  void reset(bool hold);
+  void update(uint64_t now);
+  bool dreq(uint64_t now);
+  uint8_t sciTransfer(uint8_t in);
+  void sciEnd();
+  void sdiTransfer(uint8_t in);
+
+  std::map<uint16_t, uint16_t> wram;
+  std::vector<SimFrame> frames;
+  std::vector<SimVolume> volumes;
+  uint32_t sdiOverruns;
+  // recording
+  bool recording;
+  uint32_t recMade;
+  uint32_t recRead;
+  uint32_t recLost;
+
+ private:
+  void write(uint8_t reg, uint16_t value);
+  uint16_t read(uint8_t reg);
+  void softReset(uint16_t mode);
+  void assemble(uint64_t now);
+  void startFrame(uint64_t start);
+  void cancel();
+
+  uint16_t m_regs[16];
+  bool m_inReset;
+  uint64_t m_busyUntil;
+  uint8_t m_sciLen;
+  uint8_t m_sciOp;
+  uint8_t m_sciReg;
+  uint8_t m_sciHigh;
+  uint16_t m_sciOut;
+  std::deque<uint8_t> m_fifo;
+  // decoder
+  std::vector<uint8_t> m_frame;
+  bool m_ready;
+  uint64_t m_readyAt;
+  bool m_playing;
+  uint64_t m_playStart;
+  uint64_t m_decodeNs;
+  bool m_cancel;
+  // encoder
+  uint64_t m_recStart;
+  double m_recRate;
+  std::deque<uint32_t> m_recWords;
+};
+
+//------------------------------------------------------------------------------
+/** Bytes of each frame of the simulated MP3, at 128 kbit/s and 44100 Hz. */
+const uint16_t MP3_FRAME_BYTES = 417;
+/** Play time of each frame, 1152 samples at 44100 Hz. */
+const uint64_t MP3_FRAME_NS = 26122449;
+/** Byte \p k of frame \p index of the simulated MP3. */
+uint8_t mp3Frame(uint32_t index, uint16_t k);
+/** Byte \p n of the IMA ADPCM stream made by the simulated encoder. */
+uint8_t adpcmByte(uint32_t n);
+
+extern SimCard simCard;
+extern SimVs simVs;
+#endif  // sim_h
@@ -0,0 +1,494 @@
+/*
+ * vs1053sim - host tests of the SFEMP3Shield library on a simulated shield.
+ *
+ * Runs the library and SdFat as built for the shield, against the SdCard and
+ * VS1053 of sim.cpp, on a simulated clock.  See sim.h for what is modelled.
+ *
+ *  record  Records IMA ADPCM WAV files at 8000 Hz, and at 48000 Hz when
+ *          MP3_RECORD_BLOCKS buffers the SdCard's writes, stopped both by
+ *          stopRecording() and by the end of the preallocated file, through
+ *          an SdCard that stalls for 100 ms every 256 blocks.  Checks the WAV
+ *          header, that each 256 byte ADPCM block is the next one made by
+ *          the encoder, that nothing was lost, that the file is truncated to
+ *          whole blocks, and that the patches are reloaded afterwards.
+ *
+ *  seek    Plays an MP3 of 128 kbit/s and seeks ten times, first as skipTo()
+ *          did before its jump procedure (mute, cancel, refill and
+ *          delay(50)), then with skipTo() as it is.  Reports the time to
+ *          hear the new position, the silence and the old position heard
+ *          before it, and the frames decoded across the jump.
+ *
+ * Build and run from the repository root, for example:
+ *
+ *  g++ -O2 -fpermissive -DARDUINO=10800 -Itools/vs1053sim -ISdFat/src \
+ *      -ISdFat/src/FatLib -ISFEMP3Shield tools/vs1053sim/*.cpp \
+ *      SFEMP3Shield/SFEMP3Shield.cpp SdFat/src/SdCard/SdSpiCard.cpp \
+ *      SdFat/src/FatLib/*.cpp -o vs1053sim \
+ *      && ./vs1053sim record && ./vs1053sim seek
+ *
+ * Add -DRAMEND=0x8FF for the library as configured for an Uno.  SdFat's
+ * ostream needs -fpermissive to print pointers on a 64 bit host.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include <SPI.h>
+#include <SdFat.h>
+// the seek test repeats the old skipTo(), with the library's private members.
+#define private public
+#include <SFEMP3Shield.h>
+#undef private
+
+SdFat sd;
+SFEMP3Shield MP3player;
+
+static bool failed = false;
+
+static void fail(const char* what) {
+  printf("  FAILED: %s\n", what);
+  failed = true;
+}
+//------------------------------------------------------------------------------
+// Write a FAT32 volume of 4 GB, as fatbench does, straight to the card.
+static void format() {
+  const uint32_t volumeBlocks = 8388608;
+  const uint8_t blocksPerCluster = 64;
+  const uint16_t reservedBlocks = 32;
+  uint32_t fatBlocks = (4*(volumeBlocks/blocksPerCluster) + 511)/512;
+  uint8_t block[512];
+  fat32_boot_t* pb = reinterpret_cast<fat32_boot_t*>(block);
+  memset(block, 0, 512);
+  pb->jump[0] = 0XEB;
+  pb->jump[1] = 0X58;
+  pb->jump[2] = 0X90;
+  memcpy(pb->oemId, "VS1053SM", 8);
+  pb->bytesPerSector = 512;
+  pb->sectorsPerCluster = blocksPerCluster;
+  pb->reservedSectorCount = reservedBlocks;
+  pb->fatCount = 2;
+  pb->mediaType = 0XF8;
+  pb->totalSectors32 = volumeBlocks;
+  pb->sectorsPerFat32 = fatBlocks;
+  pb->fat32RootCluster = 2;
+  pb->fat32FSInfo = 1;
+  pb->fat32BackBootBlock = 6;
+  pb->driveNumber = 0X80;
+  pb->bootSignature = EXTENDED_BOOT_SIG;
+  memcpy(pb->volumeLabel, "NO NAME    ", 11);
+  memcpy(pb->fileSystemType, "FAT32   ", 8);
+  pb->bootSectorSig0 = BOOTSIG0;
+  pb->bootSectorSig1 = BOOTSIG1;
+  simCard.put(0, block);
+  simCard.put(6, block);
+
+  fat32_fsinfo_t* pf = reinterpret_cast<fat32_fsinfo_t*>(block);
+  memset(block, 0, 512);
+  pf->leadSignature = FSINFO_LEAD_SIG;
+  pf->structSignature = FSINFO_STRUCT_SIG;
+  pf->freeCount = 0XFFFFFFFF;
+  pf->nextFree = 0XFFFFFFFF;
+  block[510] = BOOTSIG0;
+  block[511] = BOOTSIG1;
+  simCard.put(1, block);
+
+  uint32_t* fat = reinterpret_cast<uint32_t*>(block);
+  memset(block, 0, 512);
+  fat[0] = 0X0FFFFFF8;
+  fat[1] = FAT32EOC;
+  fat[2] = FAT32EOC;
+  simCard.put(reservedBlocks, block);
+  simCard.put(reservedBlocks + fatBlocks, block);
+}
+//------------------------------------------------------------------------------
+// A patch that sets a word of WRAM, to show it was loaded.
+const uint16_t PATCH_ADDR = 0X1800;
+const uint16_t PATCH_MARK = 0XBEEF;
+
+static bool writePatch() {
+  const uint16_t patch[] = {SCI_WRAMADDR, 1, PATCH_ADDR, SCI_WRAM, 1, PATCH_MARK};
+  SdFile file;
+  return file.open("patches.053", O_CREAT | O_WRITE | O_TRUNC)
+         && file.write(patch, sizeof(patch)) == sizeof(patch) && file.close();
+}
+
+static bool patched() {
+  return simVs.wram.count(PATCH_ADDR) && simVs.wram[PATCH_ADDR] == PATCH_MARK;
+}
+//------------------------------------------------------------------------------
+static bool begin() {
+  format();
+  if (!sd.begin(SD_SEL, SPI_FULL_SPEED) || !writePatch()) {
+    printf("SdCard setup failed\n");
+    return false;
+  }
+  uint8_t result = MP3player.begin();
+  if (result || !patched()) {
+    printf("MP3player.begin() returned %u\n", result);
+    return false;
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+static uint32_t getLittleEndian(const uint8_t* p, uint8_t n) {
+  uint32_t v = 0;
+  while (n--) {
+    v = (v << 8) | p[n];
+  }
+  return v;
+}
+
+static void expect(const uint8_t* hdr, uint16_t at, const char* tag) {
+  if (memcmp(hdr + at, tag, 4)) {
+    printf("  FAILED: no \"%s\" at %u\n", tag, at);
+    failed = true;
+  }
+}
+
+static void expect(const uint8_t* hdr, uint16_t at, uint8_t n, uint32_t value,
+                   const char* what) {
+  uint32_t v = getLittleEndian(hdr + at, n);
+  if (v != value) {
+    printf("  FAILED: %s is %lu, not %lu\n", what, (unsigned long)v,
+           (unsigned long)value);
+    failed = true;
+  }
+}
+
+// Check the WAV file of a recording, of whole ADPCM blocks of the encoder's
+// stream from its start, to the last whole block read from the VS1053.
+static void checkWav(const char* name, uint16_t rate) {
+  uint32_t read = 2 * simVs.recRead;
+  uint32_t size = read - read % 256;
+  uint8_t hdr[512];
+  uint8_t block[256];
+  SdFile file;
+
+  if (!file.open(name, O_READ) || file.read(hdr, 512) != 512) {
+    fail("the recording can not be read");
+    return;
+  }
+  expect(hdr, 0, "RIFF");
+  expect(hdr, 4, 4, file.fileSize() - 8, "RIFF size");
+  expect(hdr, 8, "WAVE");
+  expect(hdr, 12, "fmt ");
+  expect(hdr, 16, 4, 20, "fmt size");
+  expect(hdr, 20, 2, 0X11, "format");
+  expect(hdr, 22, 2, 1, "channels");
+  expect(hdr, 24, 4, rate, "sample rate");
+  expect(hdr, 28, 4, (uint32_t)rate * 256 / 505, "byte rate");
+  expect(hdr, 32, 2, 256, "block align");
+  expect(hdr, 34, 2, 4, "bits per sample");
+  expect(hdr, 36, 2, 2, "extra size");
+  expect(hdr, 38, 2, 505, "samples per block");
+  expect(hdr, 40, "fact");
+  expect(hdr, 44, 4, 4, "fact size");
+  expect(hdr, 48, 4, size / 256 * 505, "fact samples");
+  expect(hdr, 52, "JUNK");
+  expect(hdr, 56, 4, 504 - 60, "JUNK size");
+  expect(hdr, 504, "data");
+  expect(hdr, 508, 4, size, "data size");
+  if (file.fileSize() != 512 + size) {
+    printf("  FAILED: file of %lu bytes, not %lu\n",
+           (unsigned long)file.fileSize(), (unsigned long)(512 + size));
+    failed = true;
+  }
+  for (uint32_t n = 0; n < size; n += 256) {
+    if (file.read(block, 256) != 256) {
+      fail("data can not be read");
+      break;
+    }
+    for (uint16_t i = 0; i < 256; i++) {
+      if (block[i] != adpcmByte(n + i)) {
+        printf("  FAILED: block %lu is not the encoder's\n",
+               (unsigned long)(n / 256));
+        failed = true;
+        n = size;
+        break;
+      }
+    }
+  }
+  file.close();
+  printf("  %lu blocks, %lu bytes read after the last dropped\n",
+         (unsigned long)(size / 256), (unsigned long)(read - size));
+}
+
+// Record for stopMs, or until the file is full if zero.
+static void record(uint16_t rate, uint32_t seconds, uint32_t stopMs) {
+  char name[] = "rec.wav";
+  record_stats_t stats;
+
+  printf("record %u Hz for %lu s, %s\n", rate, (unsigned long)seconds,
+         stopMs ? "stopped by stopRecording()" : "until the file is full");
+  uint8_t result = MP3player.startRecording(name, seconds, rate, 0);
+  if (result) {
+    printf("  FAILED: startRecording() returned %u\n", result);
+    failed = true;
+    return;
+  }
+  uint32_t t0 = millis();
+  while (MP3player.isPlaying() == 2) {
+    if (stopMs && millis() - t0 >= stopMs) {
+      result = MP3player.stopRecording();
+      break;
+    }
+    result = MP3player.serviceRecording();
+  }
+  if (result) {
+    printf("  FAILED: recording returned %u\n", result);
+    failed = true;
+  }
+  MP3player.getRecordStats(&stats);
+  printf("  %lu ms, %lu SdCard blocks, %u checkpoints, %u stalls, "
+         "longest busy %lu us\n", millis() - t0, (unsigned long)stats.blocks,
+         stats.checkpoints, stats.stalls, (unsigned long)stats.maxBusy);
+  if (simVs.recLost) {
+    printf("  FAILED: %lu words lost by the VS1053\n",
+           (unsigned long)simVs.recLost);
+    failed = true;
+  }
+  if (!stopMs && 2 * simVs.recRead / 256 * 505 < seconds * rate) {
+    fail("shorter than asked for");
+  }
+  if (!patched()) {
+    fail("the patches were not reloaded");
+  }
+  checkWav(name, rate);
+}
+
+static bool recordTest() {
+  char name[] = "rec.wav";
+  if (MP3player.startRecording(name, 10, 0, 0) != 5
+      || MP3player.startRecording(name, 10, 48001, 0) != 5) {
+    fail("a sample rate out of range is taken");
+  }
+  record(8000, 60, 7300);
+  record(8000, 2, 0);
+#if MP3_RECORD_BLOCKS
+  // without the buffer, the VS1053's 84 ms at 48000 Hz can not cover a stall.
+  record(48000, 60, 7300);
+  record(48000, 1, 0);
+#endif  // MP3_RECORD_BLOCKS
+  return !failed;
+}
+//------------------------------------------------------------------------------
+const uint32_t TRACK_FRAMES = 3000;  // 78 s
+const uint16_t BYTE_RATE = 16000;    // para_byteRate, of 128 kbit/s
+const uint8_t SEEKS = 10;
+const uint32_t SEEK_MS[SEEKS] = {
+  30000, 8000, 45000, 15000, 60000, 5000, 38000, 22000, 52000, 12000
+};
+
+static bool writeTrack() {
+  uint8_t frame[MP3_FRAME_BYTES];
+  SdFile file;
+  if (!file.open("seek.mp3", O_CREAT | O_WRITE | O_TRUNC)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < TRACK_FRAMES; i++) {
+    for (uint16_t k = 0; k < MP3_FRAME_BYTES; k++) {
+      frame[k] = mp3Frame(i, k);
+    }
+    if (file.write(frame, sizeof(frame)) != sizeof(frame)) {
+      return false;
+    }
+  }
+  return file.close();
+}
+
+// skipTo() as it was, muting the cancel and the new data for 50 ms, at the
+// offset found by seekOffset().
+static void oldSkipTo(uint32_t timecode) {
+  SFEMP3Shield& p = MP3player;
+  p.disableRefill();
+  p.playing_state = paused_playback;
+  if (!p.track.seekSet(p.seekOffset(timecode))) {
+    return;
+  }
+  p.Mp3WriteRegister(SCI_VOL, 0XFE, 0XFE);
+  p.flush_cancel(pre);
+  p.refill();
+  delay(50);
+  p.setVolume(p.VolL, p.VolR);
+  p.playing_state = playback;
+  p.enableRefill();
+}
+
+static void play(uint32_t ms) {
+  uint32_t t0 = millis();
+  while (millis() - t0 < ms) {
+    MP3player.available();
+    delay(1);
+  }
+}
+
+static bool mutedAt(uint64_t t) {
+  bool muted = false;
+  for (size_t i = 0; i < simVs.volumes.size() && simVs.volumes[i].time <= t;
+       i++) {
+    muted = simVs.volumes[i].muted;
+  }
+  return muted;
+}
+
+// Nanoseconds of [a, b) heard, as not muted.
+static uint64_t heard(uint64_t a, uint64_t b) {
+  uint64_t sum = 0;
+  for (uint64_t t = a; t < b; t += 100000) {
+    if (!mutedAt(t)) {
+      sum += b - t < 100000 ? b - t : 100000;
+    }
+  }
+  return sum;
+}
+
+struct SeekResult {
+  double blockMs;
+  double newMs;
+  double silentMs;
+  double oldMs;
+  uint32_t broken;
+};
+
+// Measure the seek called at [call, done) to first, up to the next seek.
+static SeekResult measure(uint64_t call, uint64_t done, uint64_t next,
+                          uint32_t first) {
+  SeekResult r = {(done - call) / 1e6, 0, 0, 0, 0};
+  uint64_t heardNew = next;
+  uint64_t heardOld = 0;
+  uint64_t heardAny = 0;
+  const std::vector<SimFrame>& f = simVs.frames;
+
+  for (size_t i = 0; i < f.size(); i++) {
+    uint64_t a = f[i].start;
+    uint64_t b = i + 1 < f.size() && f[i + 1].start < a + MP3_FRAME_NS ?
+                 f[i + 1].start : a + MP3_FRAME_NS;
+    if (b <= call || a >= next) {
+      continue;
+    }
+    if (a < call) {
+      a = call;
+    }
+    if (f[i].broken && a < heardNew) {
+      r.broken++;
+    }
+    if (!f[i].broken && f[i].index >= first && f[i].index < first + 200) {
+      // the new position, heard once not muted.
+      for (uint64_t t = a; t < b && t < heardNew; t += 100000) {
+        if (!mutedAt(t)) {
+          heardNew = t;
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < f.size(); i++) {
+    uint64_t a = f[i].start < call ? call : f[i].start;
+    uint64_t b = i + 1 < f.size() && f[i + 1].start < f[i].start + MP3_FRAME_NS
+                 ? f[i + 1].start : f[i].start + MP3_FRAME_NS;
+    if (b > heardNew) {
+      b = heardNew;
+    }
+    if (a >= b) {
+      continue;
+    }
+    uint64_t h = heard(a, b);
+    heardAny += h;
+    if (!f[i].broken && (f[i].index < first || f[i].index >= first + 200)) {
+      heardOld += h;
+    }
+  }
+  r.newMs = (heardNew - call) / 1e6;
+  r.silentMs = (heardNew - call - heardAny) / 1e6;
+  r.oldMs = heardOld / 1e6;
+  return r;
+}
+
+static void seekRun(bool old) {
+  char name[] = "seek.mp3";
+  uint64_t call[SEEKS + 1];
+  uint64_t done[SEEKS];
+  SeekResult sum = {0, 0, 0, 0, 0};
+  SeekResult most = {0, 0, 0, 0, 0};
+
+  simVs.frames.clear();
+  simVs.volumes.clear();
+  if (MP3player.playMP3(name)) {
+    fail("playMP3()");
+    return;
+  }
+  play(2000);
+  for (uint8_t k = 0; k < SEEKS; k++) {
+    call[k] = simNow();
+    if (old) {
+      oldSkipTo(SEEK_MS[k]);
+    } else if (MP3player.skipTo(SEEK_MS[k])) {
+      fail("skipTo()");
+    }
+    done[k] = simNow();
+    play(1500);
+  }
+  call[SEEKS] = simNow();
+  MP3player.stopTrack();
+  if (simVs.sdiOverruns) {
+    fail("data was sent with DREQ low");
+  }
+
+  for (uint8_t k = 0; k < SEEKS; k++) {
+    uint32_t offset = (uint64_t)SEEK_MS[k] * BYTE_RATE / 1000;
+    uint32_t first = (offset + MP3_FRAME_BYTES - 1) / MP3_FRAME_BYTES;
+    SeekResult r = measure(call[k], done[k], call[k + 1], first);
+    if (r.newMs >= (call[k + 1] - call[k]) / 1e6) {
+      fail("the new position was not heard");
+    }
+    sum.blockMs += r.blockMs;
+    sum.newMs += r.newMs;
+    sum.silentMs += r.silentMs;
+    sum.oldMs += r.oldMs;
+    sum.broken += r.broken;
+    most.blockMs = r.blockMs > most.blockMs ? r.blockMs : most.blockMs;
+    most.newMs = r.newMs > most.newMs ? r.newMs : most.newMs;
+    most.silentMs = r.silentMs > most.silentMs ? r.silentMs : most.silentMs;
+    most.oldMs = r.oldMs > most.oldMs ? r.oldMs : most.oldMs;
+  }
+  printf("%-22s %5.1f %5.1f  %5.1f %5.1f  %5.1f %5.1f  %5.1f %5.1f  %5.1f\n",
+         old ? "mute, cancel, delay" : "jump with resync",
+         sum.blockMs / SEEKS, most.blockMs, sum.newMs / SEEKS, most.newMs,
+         sum.silentMs / SEEKS, most.silentMs, sum.oldMs / SEEKS, most.oldMs,
+         (double)sum.broken / SEEKS);
+}
+
+static bool seekTest() {
+  if (!writeTrack()) {
+    printf("seek.mp3 can not be written\n");
+    return false;
+  }
+  printf("milliseconds per seek,   blocked     to new      silent"
+         "      old heard   broken\n");
+  printf("%-22s %5s %5s  %5s %5s  %5s %5s  %5s %5s  %5s\n", "", "mean", "max",
+         "mean", "max", "mean", "max", "mean", "max", "frames");
+  seekRun(true);
+  seekRun(false);
+  return !failed;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+  const char* test = argc > 1 ? argv[1] : "";
+  bool ok;
+  setvbuf(stdout, 0, _IONBF, 0);
+  if (!begin()) {
+    return 1;
+  }
+  if (!strcmp(test, "record")) {
+    ok = recordTest();
+  } else if (!strcmp(test, "seek")) {
+    ok = seekTest();
+  } else {
+    printf("usage: vs1053sim record|seek\n");
+    return 1;
+  }
+  if (!ok) {
+    printf("%s failed\n", test);
+    return 1;
+  }
+  return 0;
+}